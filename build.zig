@@ -41,6 +41,7 @@ fn setup_game_build(
     // FIXME: remove the UB-ness
     exe.addCSourceFiles(.{ .files = &.{
         "src/audio/opl3/opl3.c",
+        "src/audio/opl3/dbopl.c",
         "src/audio/miniaudio/miniaudio.c",
         "src/audio/pocketmod/pocketmod.c",
     }, .flags = &.{
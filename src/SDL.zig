@@ -59,6 +59,7 @@ pub const SCANCODE_D = This.SDL_SCANCODE_D;
 pub const SCANCODE_G = This.SDL_SCANCODE_G;
 pub const SCANCODE_N = This.SDL_SCANCODE_N;
 pub const SCANCODE_Q = This.SDL_SCANCODE_Q;
+pub const SCANCODE_R = This.SDL_SCANCODE_R;
 pub const SCANCODE_E = This.SDL_SCANCODE_E;
 
 pub const KMOD_ALT = This.SDL_KMOD_ALT;
@@ -329,6 +330,7 @@ pub const setRenderLogicalPresentation = This.SDL_SetRenderLogicalPresentation;
 pub const setRenderDrawColor = This.SDL_SetRenderDrawColor;
 pub const createTextureFromSurface = This.SDL_CreateTextureFromSurface;
 pub const setTextureScaleMode = This.SDL_SetTextureScaleMode;
+pub const setTextureColorMod = This.SDL_SetTextureColorMod;
 pub const destroyTexture = This.SDL_DestroyTexture;
 pub const renderLine = This.SDL_RenderLine;
 pub const writeSurfacePixel = This.SDL_WriteSurfacePixel;
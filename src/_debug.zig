@@ -6,6 +6,7 @@ pub const ladder_flag: bool = false;
 pub const controller_osd: bool = false;
 pub const dump_sprites: bool = false;
 pub const enable_cheats: bool = false;
+pub const audio_latency: bool = false;
 
 pub const track_sdl_surfaces: bool = false;
 pub const track_sdl_allocations: bool = false;
@@ -28,7 +28,6 @@
 const Adlib = @This();
 
 const std = @import("std");
-const Mutex = std.Thread.Mutex;
 
 const Backend = @import("Backend.zig");
 
@@ -42,11 +41,15 @@ const GameEvent = events.GameEvent;
 const _bytes = @import("../bytes.zig");
 
 const OPL3 = @import("opl3/opl3.zig");
+const TrackCache = @import("TrackCache.zig");
 
 const data = @import("../data.zig");
+const game = @import("../game.zig");
 
-const data_titus = @embedFile("dos/titus.bin");
-const data_moktar = @embedFile("dos/moktar.bin");
+pub const data_titus = @embedFile("dos/titus.bin");
+pub const data_moktar = @embedFile("dos/moktar.bin");
+// Tracks in both music files
+pub const TrackCount = 16;
 
 inline fn chomp_u8(bytes: *[]const u8) u8 {
     return _bytes.chompInt(u8, .little, bytes);
@@ -157,24 +160,84 @@ perc_stat: u8 = 0,
 skip_delay: u8 = 0,
 skip_delay_counter: u8 = 0,
 current_track: ?u8 = null,
-mutex: Mutex = Mutex{},
 
 seg_reduction: u16 = 0,
 sfx_on: bool = false,
 sfx_time: u16 = 0,
 
+sample_rate: u32 = 0,
+// Frames left to render before the driver ticks again
+frames_to_tick: u64 = 0,
+// The driver ticks every 13.75 ms, which isn't a whole number of frames. The leftover is carried
+// here (in us * sample_rate) so the tempo doesn't drift.
+timer_remainder: u64 = 0,
+// Frame offset into the block being rendered, for timing the sound effect register writes
+render_position: u32 = 0,
+sfx_writes: [sfx_write_capacity]TimedWrite = undefined,
+sfx_write_count: usize = 0,
+
 sfx: [SfxCount]Instrument = [_]Instrument{.{}} ** SfxCount,
 instrument_data: [InstrumentCount]Instrument = [_]Instrument{.{}} ** InstrumentCount,
 music_data: []const u8 = "",
 engine: *AudioEngine = undefined,
+allocator: std.mem.Allocator = undefined,
+
+// Pre-rendered tracks, and the one playing instead of the music chip
+cache: TrackCache = .{},
+stream: ?TrackCache.Stream = null,
+
+// OPL software emulator structures. The original plays sound effects on channel 6 of the same chip
+// as the music, we give them their own chip so they can go on the sound bus.
+opl_chip: OPL3.Chip = undefined,
+sfx_chip: OPL3.Chip = undefined,
+
+// Takes the driver's register writes instead of the OPL chips, for playing the music on another synth
+pub const RegisterSink = struct {
+    ptr: *anyopaque,
+    write: *const fn (ptr: *anyopaque, reg: u16, value: u8) void,
+    writeSfx: *const fn (ptr: *anyopaque, reg: u16, value: u8) void,
+};
+sink: ?RegisterSink = null,
 
-// OPL software emulator structure.
-opl_chip: OPL3.opl3_chip = undefined,
+const TimedWrite = struct {
+    frame: u32,
+    reg: u16,
+    value: u8,
+};
+const sfx_write_capacity = 256;
 
+// The music is always rendered up to the current tick before the driver runs, so its writes land
+// on the exact frame.
 inline fn writeRegister(self: *Adlib, reg_num: u16, value: u8) void {
-    OPL3.OPL3_WriteRegBuffered(&self.opl_chip, reg_num, value);
+    if (self.sink) |sink| {
+        sink.write(sink.ptr, reg_num, value);
+        return;
+    }
+    self.opl_chip.writeRegister(reg_num, value);
 }
 
+// The sound effects are rendered after the music, so their writes are kept until then.
+fn writeSfxRegister(self: *Adlib, reg_num: u16, value: u8) void {
+    if (self.sink) |sink| {
+        sink.writeSfx(sink.ptr, reg_num, value);
+        return;
+    }
+    if (self.sfx_write_count == sfx_write_capacity) {
+        // Too many to keep, this one is a bit early
+        self.sfx_chip.writeRegister(reg_num, value);
+        return;
+    }
+    self.sfx_writes[self.sfx_write_count] = .{
+        .frame = self.render_position,
+        .reg = reg_num,
+        .value = value,
+    };
+    self.sfx_write_count += 1;
+}
+
+// The sound effects are played on the bass drum, so the sfx chip is always in rhythm mode
+const sfx_perc_stat = 0x20;
+
 pub fn backend(self: *Adlib) Backend {
     return .{
         .name = "AdLib",
@@ -184,29 +247,18 @@ pub fn backend(self: *Adlib) Backend {
             .init = init,
             .deinit = deinit,
             .fillBuffer = fillBuffer,
+            .fillSfxBuffer = fillSfxBuffer,
             .playTrack = playTrack,
             .triggerEvent = triggerEvent,
             .isPlayingATrack = isPlayingATrack,
-            .lock = lock,
-            .unlock = unlock,
         },
     };
 }
 
-fn init(ctx: *anyopaque, engine: *AudioEngine, _: std.mem.Allocator, sample_rate: u32) Backend.Error!void {
+fn init(ctx: *anyopaque, engine: *AudioEngine, allocator: std.mem.Allocator, sample_rate: u32) Backend.Error!void {
     const self: *Adlib = @ptrCast(@alignCast(ctx));
-    self.active_channels = 0;
-    self.perc_stat = 0;
-    self.skip_delay = 0;
-    self.skip_delay_counter = 0;
-    self.current_track = null;
-
-    self.seg_reduction = 0;
-    self.sfx_on = false;
-    self.sfx_time = 0;
-
     self.engine = engine;
-    self.mutex = Mutex{};
+    self.allocator = allocator;
 
     const bytes = switch (data.game)
     {
@@ -216,6 +268,33 @@ fn init(ctx: *anyopaque, engine: *AudioEngine, _: std.mem.Allocator, sample_rate
             return Backend.Error.InvalidData;
         }
     };
+    try self.load(bytes, game.settings.opl_core, sample_rate);
+    if (game.settings.prerendered_music) {
+        self.cache = TrackCache.load(allocator, .Adlib, data.game, sample_rate);
+    }
+}
+
+// Set up the driver for a music file, rendering with the given OPL core.
+pub fn load(self: *Adlib, bytes: []const u8, core: OPL3.Core, sample_rate: u32) Backend.Error!void {
+    try self.loadDriver(bytes, sample_rate);
+
+    // Create the emulator structures:
+    self.opl_chip.init(core, sample_rate);
+    self.sfx_chip.init(core, sample_rate);
+}
+
+// Set up just the driver for a music file, for when a sink takes its register writes.
+pub fn loadDriver(self: *Adlib, bytes: []const u8, sample_rate: u32) Backend.Error!void {
+    self.stream = null;
+    self.active_channels = 0;
+    self.perc_stat = 0;
+    self.skip_delay = 0;
+    self.skip_delay_counter = 0;
+    self.current_track = null;
+
+    self.seg_reduction = 0;
+    self.sfx_on = false;
+    self.sfx_time = 0;
 
     switch (bytes.len) {
         18749 => {
@@ -230,45 +309,74 @@ fn init(ctx: *anyopaque, engine: *AudioEngine, _: std.mem.Allocator, sample_rate
         },
     }
 
-    // Create the emulator structure:
-    OPL3.OPL3_Reset(&self.opl_chip, sample_rate);
+    self.sample_rate = sample_rate;
+    // Tick right away
+    self.frames_to_tick = 0;
+    self.timer_remainder = 0;
+    self.render_position = 0;
+    self.sfx_write_count = 0;
 
     self.music_data = bytes;
     self.sfx_init();
-
-    self.engine.setCallback(0, TimerCallback, @constCast(@ptrCast(self)));
 }
 
 fn deinit(ctx: *anyopaque) void {
     const self: *Adlib = @ptrCast(@alignCast(ctx));
-    self.engine.clearCallbacks();
+    self.stream = null;
+    self.cache.deinit(self.allocator);
 }
 
-fn lock(ctx: *anyopaque) void {
-    const self: *Adlib = @ptrCast(@alignCast(ctx));
-    self.mutex.lock();
-}
-
-fn unlock(ctx: *anyopaque) void {
+// Render whole blocks between the driver ticks, running each tick on its exact frame.
+fn fillBuffer(ctx: *anyopaque, buffer: []i16, nsamples: u32) void {
     const self: *Adlib = @ptrCast(@alignCast(ctx));
-    self.mutex.unlock();
+    var done: u32 = 0;
+    while (done < nsamples) {
+        if (self.frames_to_tick == 0) {
+            self.render_position = done;
+            self.tick();
+        }
+        const frames: u32 = @intCast(@min(nsamples - done, self.frames_to_tick));
+        const out = buffer[done * 2 ..][0 .. frames * 2];
+        if (self.stream) |*stream| {
+            // The driver still ticks for the sound effects, but the music chip has nothing to do
+            const streamed = stream.fill(out, frames);
+            if (streamed < frames) {
+                @memset(out[streamed * 2 ..], 0);
+                self.stream = null;
+                self.current_track = null;
+            }
+        } else {
+            self.opl_chip.generate(out, frames);
+        }
+        done += frames;
+        self.frames_to_tick -= frames;
+    }
+    self.render_position = 0;
 }
 
-fn fillBuffer(ctx: *anyopaque, buffer: []i16, nsamples: u32) void {
+// Render the same block for the sound effects, applying their writes where the ticks made them.
+fn fillSfxBuffer(ctx: *anyopaque, buffer: []i16, nsamples: u32) void {
     const self: *Adlib = @ptrCast(@alignCast(ctx));
-    self.mutex.lock();
-    if (nsamples > 0) {
-        OPL3.OPL3_GenerateStream(&self.opl_chip, &buffer[0], nsamples);
+    var done: u32 = 0;
+    for (self.sfx_writes[0..self.sfx_write_count]) |write| {
+        const frame = @min(write.frame, nsamples);
+        if (frame > done) {
+            self.sfx_chip.generate(buffer[done * 2 ..], frame - done);
+            done = frame;
+        }
+        self.sfx_chip.writeRegister(write.reg, write.value);
     }
-    self.mutex.unlock();
+    self.sfx_write_count = 0;
+    self.sfx_chip.generate(buffer[done * 2 ..], nsamples - done);
 }
 
 fn isPlayingATrack(ctx: *anyopaque) bool {
     const self: *Adlib = @ptrCast(@alignCast(ctx));
-    return self.active_channels != 0;
+    return self.stream != null or self.active_channels != 0;
 }
 
-fn playTrackNumber(self: *Adlib, song_number: u8) void {
+pub fn playTrackNumber(self: *Adlib, song_number: u8) void {
+    self.stream = null;
     self.current_track = song_number;
 
     var raw_data = self.music_data;
@@ -359,10 +467,19 @@ fn playTrack(ctx: *anyopaque, track: ?AudioTrack) void {
     const song_number_ = getTrackNumber(track);
     if (song_number_ == null) {
         // stop playing... this is probably wrong
+        self.stream = null;
         self.active_channels = 0;
         self.current_track = null;
         return;
     }
+    if (self.cache.get(track.?)) |cached| {
+        // Silence the chip, the track comes from the cache
+        self.all_vox_zero();
+        self.active_channels = 0;
+        self.current_track = song_number_;
+        self.stream = .{ .track = cached };
+        return;
+    }
     self.playTrackNumber(song_number_.?);
 }
 
@@ -408,9 +525,9 @@ fn playSfx(self: *Adlib, fx_number: u8) void {
     self.sfx_time = 15;
     self.sfx_on = true;
     const index: usize = @intCast(fx_number);
-    Adlib.insmaker(self, &self.sfx[index].op[0], 0x13); //Channel 6 operator 1
-    Adlib.insmaker(self, &self.sfx[index].op[1], 0x10); //Channel 6 operator 2
-    self.writeRegister(0xC6, self.sfx[index].fb_alg); //Channel 6 (Feedback/Algorithm)
+    sfxInsmaker(self, &self.sfx[index].op[0], 0x13); //Channel 6 operator 1
+    sfxInsmaker(self, &self.sfx[index].op[1], 0x10); //Channel 6 operator 2
+    self.writeSfxRegister(0xC6, self.sfx[index].fb_alg); //Channel 6 (Feedback/Algorithm)
 }
 
 fn sfx_init(self: *Adlib) void {
@@ -436,11 +553,11 @@ fn sfx_driver(self: *Adlib) void {
     if (!self.sfx_on) {
         return;
     }
-    self.writeRegister(0xBD, 0xEF & self.perc_stat);
-    self.writeRegister(0xA6, 0x57);
-    self.writeRegister(0xB6, 1);
-    self.writeRegister(0xB6, 5);
-    self.writeRegister(0xBD, 0x10 | self.perc_stat);
+    self.writeSfxRegister(0xBD, 0xEF & sfx_perc_stat);
+    self.writeSfxRegister(0xA6, 0x57);
+    self.writeSfxRegister(0xB6, 1);
+    self.writeSfxRegister(0xB6, 5);
+    self.writeSfxRegister(0xBD, 0x10 | sfx_perc_stat);
     self.sfx_time -= 1;
     if (self.sfx_time == 0) {
         self.sfx_stop();
@@ -450,10 +567,10 @@ fn sfx_driver(self: *Adlib) void {
 fn sfx_stop(self: *Adlib) void {
     const tmpins1: []const u8 = &.{ 0xF5, 0x7F, 0x00, 0x11, 0x00 };
     const tmpins2: []const u8 = &.{ 0xF8, 0xFF, 0x04, 0x30, 0x00 };
-    self.writeRegister(0xB6, 32);
-    insmaker(self, tmpins1, 0x13); //Channel 6 operator 1
-    insmaker(self, tmpins2, 0x10); //Channel 6 operator 2
-    self.writeRegister(0xC6, 0x08); //Channel 6 (Feedback/Algorithm)
+    self.writeSfxRegister(0xB6, 32);
+    sfxInsmaker(self, tmpins1, 0x13); //Channel 6 operator 1
+    sfxInsmaker(self, tmpins2, 0x10); //Channel 6 operator 2
+    self.writeSfxRegister(0xC6, 0x08); //Channel 6 (Feedback/Algorithm)
     self.sfx_on = false;
 }
 
@@ -701,6 +818,14 @@ fn insmaker(self: *Adlib, insdata: []const u8, channel: u8) void {
     self.writeRegister(0xE0 + channel, insdata[4]); //Wave type
 }
 
+fn sfxInsmaker(self: *Adlib, insdata: []const u8, channel: u8) void {
+    self.writeSfxRegister(0x60 + channel, insdata[0]); //Attack Rate / Decay Rate
+    self.writeSfxRegister(0x80 + channel, insdata[1]); //Sustain Level / Release Rate
+    self.writeSfxRegister(0x40 + channel, insdata[2]); //Key scaling level / Operator output level
+    self.writeSfxRegister(0x20 + channel, insdata[3]); //Amp Mod / Vibrato / EG type / Key Scaling / Multiple
+    self.writeSfxRegister(0xE0 + channel, insdata[4]); //Wave type
+}
+
 fn all_vox_zero(self: *Adlib) void {
     for (0xB0..0xB9) |i|
         self.writeRegister(@intCast(i), 0); //Clear voice, octave and upper bits of frequence
@@ -729,14 +854,25 @@ fn all_vox_zero(self: *Adlib) void {
     self.writeRegister(0x55, 0x3F);
 }
 
-fn TimerCallback(callback_data: ?*anyopaque) void {
-    var self: *Adlib = @alignCast(@ptrCast(callback_data));
-    self.mutex.lock();
+// Identifies the state of the music driver, for finding the point a track loops back to
+pub fn driverState(self: *const Adlib) u64 {
+    var hasher = std.hash.Wyhash.init(0);
+    std.hash.autoHash(&hasher, self.channels);
+    std.hash.autoHash(&hasher, self.active_channels);
+    std.hash.autoHash(&hasher, self.perc_stat);
+    std.hash.autoHash(&hasher, self.skip_delay_counter);
+    return hasher.final();
+}
+
+// Run the driver once, and work out how many frames it takes until it runs again.
+pub fn tick(self: *Adlib) void {
     // Read data until we must make a delay.
     self.fillchip();
-    self.mutex.unlock();
 
-    // Schedule the next timer callback.
+    // Schedule the next tick.
     // Delay is original 13.75 ms
-    self.engine.setCallback(13750, TimerCallback, callback_data);
+    const usecs_in_sec = 1000 * 1000;
+    self.timer_remainder += 13750 * @as(u64, self.sample_rate);
+    self.frames_to_tick = self.timer_remainder / usecs_in_sec;
+    self.timer_remainder %= usecs_in_sec;
 }
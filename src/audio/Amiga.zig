@@ -22,12 +22,9 @@
 // General Public License for more details.
 //
 
-// TODO: research how Amiga version does sound effects, use those too
-
 const Amiga = @This();
 
 const std = @import("std");
-const Mutex = std.Thread.Mutex;
 
 const Backend = @import("Backend.zig");
 
@@ -39,6 +36,8 @@ const events = @import("../events.zig");
 const GameEvent = events.GameEvent;
 
 const data = @import("../data.zig");
+const game = @import("../game.zig");
+const TrackCache = @import("TrackCache.zig");
 
 const pocketmod = @cImport({
     @cInclude("pocketmod.h");
@@ -64,22 +63,20 @@ const track_over_mok = @embedFile("amiga/overmok.mod");
 const track_pres = @embedFile("amiga/pres.mod");
 const track_null: [0]u8 = .{};
 
-fn loadSample(comptime N: usize, comptime input: [N:0]u8) []const i8 {
-    var output: [N]i8 = undefined;
-    @memcpy(input, output);
-    return &output;
+// Raw signed 8-bit mono samples
+fn loadSample(comptime bytes: []const u8) []const i8 {
+    return @ptrCast(bytes);
 }
 
+// The samples are named after what they are for: tirperso is the player throwing ("tir perso"),
+// fox is Titus or Moktar getting hurt, coup is a blow landing and ballon is the ball. ressort, the spring,
+// has no game event yet, so it is not embedded.
 const sfx_tirperso = loadSample(@embedFile("amiga/tirperso"));
-const sfx_ressort = loadSample(@embedFile("amiga/ressort"));
 const sfx_fox = loadSample(@embedFile("amiga/fox"));
 const sfx_coup = loadSample(@embedFile("amiga/coup"));
 const sfx_ballon = loadSample(@embedFile("amiga/ballon"));
-
-const Sound = struct {
-    sample: []const i8,
-    index: usize,
-};
+// Paula playing C-3 on a PAL machine (period 428)
+const sfx_rate = 8287;
 
 fn getTrackData(track_in: ?AudioTrack) []const u8 {
     if (track_in == null) {
@@ -119,10 +116,11 @@ fn getTrackData(track_in: ?AudioTrack) []const u8 {
 
 allocator: std.mem.Allocator = undefined,
 current_track: ?AudioTrack = null,
-mutex: Mutex = Mutex{},
 sample_rate: u32 = undefined,
 music_context: ?pocketmod.pocketmod_context = null,
-sound_context: ?Sound = null,
+// Pre-rendered tracks, and the one playing instead of pocketmod
+cache: TrackCache = .{},
+stream: ?TrackCache.Stream = null,
 
 engine: *AudioEngine = undefined,
 
@@ -138,8 +136,6 @@ pub fn backend(self: *Amiga) Backend {
             .playTrack = playTrack,
             .triggerEvent = triggerEvent,
             .isPlayingATrack = isPlayingATrack,
-            .lock = lock,
-            .unlock = unlock,
         },
     };
 }
@@ -148,83 +144,99 @@ fn init(ctx: *anyopaque, engine: *AudioEngine, allocator: std.mem.Allocator, sam
     const self: *Amiga = @ptrCast(@alignCast(ctx));
     self.engine = engine;
     self.allocator = allocator;
-    self.mutex = Mutex{};
     self.sample_rate = sample_rate;
     self.current_track = null;
     self.music_context = null;
-    self.sound_context = null;
+    self.stream = null;
+    if (game.settings.prerendered_music) {
+        self.cache = TrackCache.load(allocator, .Amiga, data.game, sample_rate);
+    }
 }
 
 fn deinit(ctx: *anyopaque) void {
     const self: *Amiga = @ptrCast(@alignCast(ctx));
-    self.mutex = Mutex{};
     self.sample_rate = undefined;
     self.current_track = null;
     self.music_context = null;
-    self.sound_context = null;
+    self.stream = null;
+    self.cache.deinit(self.allocator);
 }
 
-fn lock(ctx: *anyopaque) void {
-    const self: *Amiga = @ptrCast(@alignCast(ctx));
-    self.mutex.lock();
+// Frames rendered by pocketmod in one go
+const render_chunk_frames = 1024;
+const lanes = std.simd.suggestVectorLength(f32) orelse 4;
+
+// Clamp to -1..1 and convert to i16
+fn convertSamples(output: []i16, input: []const f32) void {
+    const FloatVector = @Vector(lanes, f32);
+    const SampleVector = @Vector(lanes, i16);
+    const low: FloatVector = @splat(-1.0);
+    const high: FloatVector = @splat(1.0);
+    const scale: FloatVector = @splat(std.math.maxInt(i16));
+    var i: usize = 0;
+    while (i + lanes <= input.len) : (i += lanes) {
+        const samples: FloatVector = input[i..][0..lanes].*;
+        const converted: SampleVector = @intFromFloat(@min(@max(samples, low), high) * scale);
+        output[i..][0..lanes].* = converted;
+    }
+    while (i < input.len) : (i += 1) {
+        output[i] = @intFromFloat(std.math.clamp(input[i], -1.0, 1.0) * std.math.maxInt(i16));
+    }
 }
 
-fn unlock(ctx: *anyopaque) void {
-    const self: *Amiga = @ptrCast(@alignCast(ctx));
-    self.mutex.unlock();
+test "sample conversion clamps" {
+    const input = [_]f32{ -2.0, -1.0, -0.5, 0.0, 0.5, 1.0, 2.0, 0.25, 3.0 };
+    var output: [input.len]i16 = undefined;
+    convertSamples(&output, &input);
+    try std.testing.expectEqualSlices(i16, &.{ -32767, -32767, -16383, 0, 16383, 32767, 32767, 8191, 32767 }, &output);
 }
 
 fn fillBuffer(ctx: *anyopaque, buffer: []i16, nFrames: u32) void {
-    if (nFrames == 0) {
-        return;
-    }
-    // TODO: deal with this
-    const sample_buffer_size = 32000;
+    const self: *Amiga = @ptrCast(@alignCast(ctx));
     // we render two channels, f32, which is 8 bytes per frame
     const frameSize = @sizeOf(f32) * 2;
-    if (nFrames * frameSize > sample_buffer_size) {
-        unreachable;
-    }
-    var floatBuffer: [sample_buffer_size]f32 = undefined;
 
-    const self: *Amiga = @ptrCast(@alignCast(ctx));
-    self.mutex.lock();
-    defer self.mutex.unlock();
-
-    if (self.music_context) |*music_context| {
-        var rendered: u32 = 0;
-        var to_render: u32 = nFrames;
-        while (rendered != nFrames) {
+    var rendered: usize = 0;
+    if (self.stream) |*stream| {
+        rendered = stream.fill(buffer, nFrames);
+        if (rendered < nFrames) {
+            self.stream = null;
+            self.current_track = null;
+        }
+    } else if (self.music_context) |*music_context| {
+        var floatBuffer: [render_chunk_frames * 2]f32 = undefined;
+        while (rendered < nFrames) {
+            const to_render: usize = @min(render_chunk_frames, nFrames - rendered);
             // FIXME: this returns number of bytes instead of number of frames, which is insane
-            const rendered_now = pocketmod.pocketmod_render(
+            const rendered_now: usize = pocketmod.pocketmod_render(
                 music_context,
-                &floatBuffer[rendered * 2],
-                to_render * frameSize,
+                &floatBuffer,
+                @intCast(to_render * frameSize),
             ) / frameSize;
-            for (rendered..rendered + rendered_now) |i| {
-                const ii = i * 2;
-                buffer[ii] = @intFromFloat(std.math.clamp(floatBuffer[ii], -1.0, 1.0) * std.math.maxInt(i16));
-                buffer[ii + 1] = @intFromFloat(std.math.clamp(floatBuffer[ii + 1], -1.0, 1.0) * std.math.maxInt(i16));
-            }
-            to_render -= rendered_now;
+            convertSamples(buffer[rendered * 2 ..][0 .. rendered_now * 2], floatBuffer[0 .. rendered_now * 2]);
             rendered += rendered_now;
             // if we looped, stop playing
             const looped = pocketmod.pocketmod_loop_count(music_context) == 1;
-            if (looped) {
-                @memset(buffer[rendered * 2 ..], 0);
+            if (looped or rendered_now == 0) {
                 self.music_context = null;
                 self.current_track = null;
-                return;
+                break;
             }
         }
     }
+    @memset(buffer[rendered * 2 ..], 0);
 }
 
 fn playTrack(ctx: *anyopaque, track: ?AudioTrack) void {
     const self: *Amiga = @ptrCast(@alignCast(ctx));
+    self.stream = null;
     if (track == null) {
         self.music_context = null;
         self.current_track = null;
+    } else if (self.cache.get(track.?)) |cached| {
+        self.music_context = null;
+        self.current_track = track;
+        self.stream = .{ .track = cached };
     } else {
         var music_context: pocketmod.pocketmod_context = undefined;
         const track_data = getTrackData(track);
@@ -236,10 +248,16 @@ fn playTrack(ctx: *anyopaque, track: ?AudioTrack) void {
     }
 }
 
-// TODO: implement playing original sounds
 fn triggerEvent(ctx: *anyopaque, event: GameEvent) void {
-    _ = ctx;
-    _ = event;
+    const self: *Amiga = @ptrCast(@alignCast(ctx));
+    const sample: []const i8 = switch (event) {
+        .HitEnemy, .PlayerHeadImpact => sfx_coup,
+        .HitPlayer => sfx_fox,
+        .PlayerThrow => sfx_tirperso,
+        .BallBounce => sfx_ballon,
+        else => return,
+    };
+    self.engine.mixer.playSample(sample, sfx_rate);
 }
 
 fn isPlayingATrack(ctx: *anyopaque) bool {
@@ -249,8 +267,3 @@ fn isPlayingATrack(ctx: *anyopaque) bool {
     }
     return false;
 }
-
-fn play_sfx(ctx: *anyopaque, fx_number: u8) void {
-    _ = ctx;
-    _ = fx_number;
-}
@@ -26,8 +26,7 @@
 //
 
 const std = @import("std");
-const Mutex = std.Thread.Mutex;
-const Order = std.math.Order;
+const Atomic = std.atomic.Value;
 
 const Backend = @import("Backend.zig");
 pub const BackendType = Backend.BackendType;
@@ -41,6 +40,8 @@ const GameEvent = events.GameEvent;
 const Adlib = @import("Adlib.zig");
 const Amiga = @import("Amiga.zig");
 const PCSpeaker = @import("PCSpeaker.zig");
+const CommandQueue = @import("CommandQueue.zig");
+pub const Mixer = @import("Mixer.zig");
 
 pub const miniaudio = @cImport({
     @cInclude("miniaudio.h");
@@ -48,61 +49,51 @@ pub const miniaudio = @cImport({
 const game = @import("../game.zig");
 const data = @import("../data.zig");
 
-const usecs_in_sec: u64 = 1000 * 1000;
-
 const SampleType = i16;
 const NumChannels = 2;
-const MixingFreq = 44100;
+// Period size hint for the low latency profile, when the settings don't ask for a size.
+// miniaudio picks the closest the device supports.
+const PeriodMilliseconds = 10;
 const Stride = @sizeOf(SampleType) * NumChannels;
 
-// Queue of callbacks waiting to be invoked.
-pub const Callback = ?*const fn (?*anyopaque) void;
-pub const QueuedCallback = struct {
-    callback: Callback = null,
-    data: ?*anyopaque = null,
-    time: u64 = 0,
-};
-fn timeOrder(context: void, a: QueuedCallback, b: QueuedCallback) Order {
-    _ = context;
-    return std.math.order(a.time, b.time);
-}
-
-const CallbackQueue = std.PriorityQueue(QueuedCallback, void, timeOrder);
-
-test "test queue priority" {
-    var queue = CallbackQueue.init(std.testing.allocator, {});
-    defer queue.deinit();
-    try queue.add(QueuedCallback{ .time = 0 });
-    try queue.add(QueuedCallback{ .time = 1 });
-    try queue.add(QueuedCallback{ .time = 2 });
-    try std.testing.expectEqual(QueuedCallback{ .time = 0 }, queue.remove());
-    try std.testing.expectEqual(QueuedCallback{ .time = 1 }, queue.remove());
-    try std.testing.expectEqual(QueuedCallback{ .time = 2 }, queue.remove());
-}
-
 const Self = @This();
 
 allocator: std.mem.Allocator = undefined,
 
 config: miniaudio.ma_device_config = undefined,
 device: miniaudio.ma_device = undefined,
+// The device's native rate, which everything renders at, so miniaudio doesn't have to resample
+sample_rate: u32 = 0,
 
 adlib: Adlib = .{},
 amiga: Amiga = .{},
 pcSpeaker: PCSpeaker = .{},
 backend: ?Backend = null,
+mixer: Mixer = .{},
 last_song: ?AudioTrack = null,
 volume: u8 = 128,
 
-// When the callback mutex is locked using OPL_Lock, callback functions are not invoked.
-callback_mutex: Mutex = Mutex{},
-
-// Queue of callbacks to call at future timestamps (tracked in usecs)
-callback_queue: CallbackQueue = undefined,
-callback_queue_mutex: Mutex = Mutex{},
-
-// Current time, in us since startup:
-current_time: u64 = 0,
+// Commands from the game thread, applied by the audio callback. Everything below that is touched
+// by the callback is only ever touched by the callback, or while the device is stopped.
+commands: CommandQueue = .{},
+// Game thread side: the last requested track and its serial
+requested_track: ?AudioTrack = null,
+requested_serial: CommandQueue.Serial = 0,
+// Audio thread side: serial of the last applied track request
+applied_serial: CommandQueue.Serial = 0,
+// Published by the audio thread: applied serial << 1 | whether the backend is playing a track
+track_status: Atomic(u32) = .init(0),
+
+// Monotonic clock the commands are timestamped with
+epoch: ?std.time.Instant = null,
+// When the last callback started, on that clock
+last_callback_time: u64 = 0,
+
+// Telemetry for the debug overlay, in microseconds
+latency: Latency = .{},
+// Game thread side: the peak the overlay shows, and when its window started
+shown_command_peak: u32 = 0,
+peak_window_start: u64 = 0,
 
 // Temporary mixing buffer used by the mixing callback.
 mix_buffer: []SampleType = &.{},
@@ -117,7 +108,20 @@ pub fn init(self: *Self, allocator: std.mem.Allocator) !void {
     self.config = miniaudio.ma_device_config_init(miniaudio.ma_device_type_playback);
     self.config.playback.format = miniaudio.ma_format_s16;
     self.config.playback.channels = NumChannels;
-    self.config.sampleRate = MixingFreq;
+    // 0 means the device's native rate
+    self.config.sampleRate = 0;
+    // The callback writes every frame, so there is no point in clearing the buffer first
+    self.config.noPreSilencedOutputBuffer = miniaudio.MA_TRUE;
+    self.config.performanceProfile = if (game.settings.audio_low_latency)
+        miniaudio.ma_performance_profile_low_latency
+    else
+        miniaudio.ma_performance_profile_conservative;
+    // 0 leaves the choice to miniaudio
+    self.config.periodSizeInFrames = game.settings.audio_period_frames;
+    self.config.periods = game.settings.audio_periods;
+    if (game.settings.audio_period_frames == 0 and game.settings.audio_low_latency) {
+        self.config.periodSizeInMilliseconds = PeriodMilliseconds;
+    }
     self.config.dataCallback = data_callback;
     self.config.pUserData = self;
 
@@ -126,19 +130,25 @@ pub fn init(self: *Self, allocator: std.mem.Allocator) !void {
         return error.OpenAudioDeviceFailed;
     }
     errdefer miniaudio.ma_device_uninit(&self.device);
+    self.sample_rate = self.device.sampleRate;
+    const buffer_frames = @as(u64, self.device.playback.internalPeriodSizeInFrames) * self.device.playback.internalPeriods;
+    self.latency.output.store(@intCast(buffer_frames * std.time.us_per_s / self.sample_rate), .monotonic);
+    std.log.info("Audio device: {d} Hz, {d} periods of {d} frames, native format {s}", .{
+        self.sample_rate,
+        self.device.playback.internalPeriods,
+        self.device.playback.internalPeriodSizeInFrames,
+        std.mem.span(miniaudio.ma_get_format_name(self.device.playback.internalFormat)),
+    });
 
     _ = miniaudio.ma_device_set_master_volume(
         &self.device,
         @as(f32, @floatFromInt(self.volume)) / 128.0,
     );
 
-    // Queue structure of callbacks to invoke.
-    self.callback_queue = CallbackQueue.init(allocator, {});
-    self.current_time = 0;
-
-    self.callback_mutex = Mutex{};
-    self.callback_queue_mutex = Mutex{};
+    self.epoch = std.time.Instant.now() catch null;
+    self.last_callback_time = 0;
 
+    self.mixer.init(self.sample_rate, game.settings.volume_music, game.settings.volume_sound);
     self.setBackendType(game.settings.audio_backend);
 
     _ = miniaudio.ma_device_start(&self.device);
@@ -156,44 +166,97 @@ pub fn deinit(self: *Self) void {
         backend.deinit();
     }
     miniaudio.ma_device_uninit(&self.device);
+}
+
+const PendingCommand = struct {
+    command: CommandQueue.Command,
+    // In frames from the start of the buffer
+    offset: u32,
+};
 
-    self.callback_queue.deinit();
+fn applyCommand(self: *Self, command: CommandQueue.Command) void {
+    switch (command) {
+        .play_track => |request| {
+            self.applied_serial = request.serial;
+            if (self.backend) |*backend| {
+                backend.playTrack(request.track);
+            }
+        },
+        .trigger_event => |event| {
+            if (self.backend) |*backend| {
+                backend.triggerEvent(event);
+            }
+        },
+    }
 }
 
-fn advanceTimeAndRunCallbacks(self: *Self, nsamples: u64) void {
-    self.callback_queue_mutex.lock();
+pub const Latency = struct {
+    // From the game pushing the last command to the callback picking it up
+    command: Atomic(u32) = .init(0),
+    // The most of that since the peak window started
+    command_peak: Atomic(u32) = .init(0),
+    // The device buffer, which every sample has to get through
+    output: Atomic(u32) = .init(0),
+};
 
-    const us: u64 = (nsamples * usecs_in_sec) / @as(u64, @intCast(MixingFreq));
-    self.current_time += us;
+pub const LatencyStats = struct {
+    command: u32,
+    command_peak: u32,
+    output: u32,
+};
 
-    while (self.callback_queue.count() > 0 and self.current_time >= self.callback_queue.peek().?.time) {
-        const entry = self.callback_queue.remove();
+const PeakWindow = std.time.ns_per_s;
 
-        // The mutex stuff here is a bit complicated.  We must
-        // hold callback_mutex when we invoke the callback (so that
-        // the control thread can use OPL_Lock() to prevent callbacks
-        // from being invoked), but we must not be holding
-        // callback_queue_mutex, as the callback must be able to
-        // call setCallback to schedule new callbacks.
+// Latency telemetry, for the debug overlay. The peak is over the last full second, so it stays
+// up long enough to read no matter how often this is called.
+pub fn takeLatencyStats(self: *Self) LatencyStats {
+    const now = self.timestamp();
+    if (now - self.peak_window_start >= PeakWindow) {
+        self.shown_command_peak = self.latency.command_peak.swap(0, .monotonic);
+        self.peak_window_start = now;
+    }
+    return .{
+        .command = self.latency.command.load(.monotonic),
+        .command_peak = self.shown_command_peak,
+        .output = self.latency.output.load(.monotonic),
+    };
+}
+
+fn recordCommandLatency(self: *Self, nanoseconds: u64) void {
+    const us: u32 = @intCast(@min(nanoseconds / std.time.ns_per_us, std.math.maxInt(u32)));
+    self.latency.command.store(us, .monotonic);
+    _ = self.latency.command_peak.fetchMax(us, .monotonic);
+}
 
-        self.callback_queue_mutex.unlock();
-        self.callback_mutex.lock();
-        entry.callback.?(entry.data);
-        self.callback_mutex.unlock();
-        self.callback_queue_mutex.lock();
+// Monotonic nanoseconds since init, 0 if there is no such clock.
+fn timestamp(self: *const Self) u64 {
+    const epoch = self.epoch orelse return 0;
+    const now = std.time.Instant.now() catch return 0;
+    return now.since(epoch);
+}
+
+// Where in a buffer of frame_count frames a command pushed at time goes: as far into it as the
+// command came into the time between the last callback and this one, which started at now. That
+// keeps sound effects spaced as the game triggered them, and holds none back by more than one
+// callback period.
+fn commandOffset(self: *const Self, time: u64, now: u64, frame_count: u32) u32 {
+    if (time == 0 or self.last_callback_time == 0 or time <= self.last_callback_time or now <= self.last_callback_time or frame_count == 0) {
+        return 0;
     }
+    const period = now - self.last_callback_time;
+    const frames = @min(time - self.last_callback_time, period) * frame_count / period;
+    return @intCast(@min(frames, frame_count - 1));
+}
 
-    self.callback_queue_mutex.unlock();
+fn publishTrackStatus(self: *Self) void {
+    const playing = if (self.backend) |*backend| backend.isPlayingATrack() else false;
+    self.track_status.store(@as(u32, self.applied_serial) << 1 | @intFromBool(playing), .release);
 }
 
-// Call the OPL emulator code to fill the specified buffer.
+// Mix the backend and the sample voices into the specified buffer.
 fn fillBuffer(self: *Self, buffer: *u8, nFrames: u32) void {
     const result: []i16 = @as([*]i16, @alignCast(@ptrCast(buffer)))[0 .. nFrames * 2];
-    if (self.backend) |*backend| {
-        backend.fillBuffer(@ptrCast(result), nFrames);
-    } else {
-        @memset(result, 0);
-    }
+    self.mixer.mix(self.backend, result, nFrames);
 }
 
 fn data_callback(pDevice: ?*anyopaque, buffer: ?*anyopaque, pInput: ?*const anyopaque, frameCount: u32) callconv(.c) void {
@@ -202,56 +265,70 @@ fn data_callback(pDevice: ?*anyopaque, buffer: ?*anyopaque, pInput: ?*const anyo
     var self: *Self = @alignCast(@ptrCast(device.pUserData.?));
     var filled: u64 = 0;
 
-    // Repeatedly call the OPL emulator update function until the buffer is full.
-    // TODO: move this OPL mess into AdLib, expect backends to do their internal business... internally
-    while (filled < frameCount) {
-        var nFrames: u64 = 0;
-
-        self.callback_queue_mutex.lock();
-
-        // Work out the time until the next callback waiting in
-        // the callback queue must be invoked.  We can then fill the
-        // buffer with this many frames.
-
-        if (self.callback_queue.count() == 0) {
-            nFrames = frameCount - filled;
-        } else {
-            const next_callback_time = self.callback_queue.peek().?.time;
-
-            nFrames = (next_callback_time - self.current_time) * @as(u32, @intCast(MixingFreq));
-            nFrames = (nFrames + usecs_in_sec - 1) / usecs_in_sec;
+    // Take what the game sent since the last callback. The queue only ever holds capacity
+    // commands, but the game may push more while we're at it.
+    const now = self.timestamp();
+    var pending: [CommandQueue.capacity]PendingCommand = undefined;
+    var pending_count: usize = 0;
+    while (pending_count < pending.len) {
+        const entry = self.commands.pop() orelse break;
+        if (entry.time != 0 and now > entry.time) {
+            self.recordCommandLatency(now - entry.time);
+        }
+        pending[pending_count] = .{ .command = entry.command, .offset = self.commandOffset(entry.time, now, frameCount) };
+        pending_count += 1;
+    }
+    self.last_callback_time = now;
+    var next_pending: usize = 0;
 
-            if (nFrames > frameCount - filled) {
-                nFrames = frameCount - filled;
-            }
+    // Fill the buffer up to each command in turn, until it is full.
+    while (filled < frameCount) {
+        while (next_pending < pending_count and pending[next_pending].offset <= filled) : (next_pending += 1) {
+            self.applyCommand(pending[next_pending].command);
         }
 
-        self.callback_queue_mutex.unlock();
+        // Work out the time until the next command is due. We can then fill the buffer with
+        // this many frames.
+        var nFrames: u64 = frameCount - filled;
+        if (next_pending < pending_count) {
+            nFrames = @min(nFrames, pending[next_pending].offset - filled);
+        }
 
         self.fillBuffer(@as([*c]u8, @ptrCast(buffer)) + filled * Stride, @truncate(nFrames));
         filled += nFrames;
+    }
+    // Only for an empty buffer
+    while (next_pending < pending_count) : (next_pending += 1) {
+        self.applyCommand(pending[next_pending].command);
+    }
+    self.publishTrackStatus();
+}
 
-        self.advanceTimeAndRunCallbacks(nFrames);
+// Game thread side of the command queue
+fn pushCommand(self: *Self, command: CommandQueue.Command) void {
+    if (!self.commands.push(.{ .command = command, .time = self.timestamp() })) {
+        std.log.warn("Audio command queue is full, dropping {s}", .{@tagName(command)});
     }
 }
 
-pub fn setCallback(self: *Self, us: u64, callback: Callback, callback_data: ?*anyopaque) void {
-    self.callback_queue_mutex.lock();
-    // FIXME: actual error handling
-    self.callback_queue.add(QueuedCallback{
-        .callback = callback,
-        .data = callback_data,
-        .time = self.current_time + us,
-    }) catch {
-        unreachable;
-    };
-    self.callback_queue_mutex.unlock();
+pub fn playTrack(self: *Self, track: ?AudioTrack) void {
+    self.requested_serial +%= 1;
+    self.requested_track = track;
+    self.pushCommand(.{ .play_track = .{ .track = track, .serial = self.requested_serial } });
 }
 
-pub fn clearCallbacks(self: *Self) void {
-    self.callback_queue_mutex.lock();
-    self.callback_queue.items.len = 0;
-    self.callback_queue_mutex.unlock();
+pub fn triggerEvent(self: *Self, event: GameEvent) void {
+    self.pushCommand(.{ .trigger_event = event });
+}
+
+// Whether the backend is playing a track, as of the last audio callback. A track request the
+// callback hasn't picked up yet counts as playing.
+pub fn isPlayingATrack(self: *Self) bool {
+    const status = self.track_status.load(.acquire);
+    if (status >> 1 != self.requested_serial) {
+        return self.requested_track != null;
+    }
+    return status & 1 != 0;
 }
 
 pub fn setBackendType(self: *Self, backend_type: BackendType) void {
@@ -261,6 +338,31 @@ pub fn setBackendType(self: *Self, backend_type: BackendType) void {
     }
 
     game.settings.audio_backend = backend_type;
+    self.startBackend(backend_type);
+}
+
+// Start the backend over, for when one of its settings changed.
+pub fn restartBackend(self: *Self) void {
+    self.startBackend(self.getBackendType());
+}
+
+fn startBackend(self: *Self, backend_type: BackendType) void {
+    // The callback owns the backend, so it can't run while the backend is swapped out.
+    // Stopping waits for a running callback to return.
+    if (self.initialized) {
+        _ = miniaudio.ma_device_stop(&self.device);
+    }
+    defer {
+        if (self.initialized) {
+            _ = miniaudio.ma_device_start(&self.device);
+        }
+    }
+    // Whatever was queued was meant for the old backend
+    while (self.commands.pop()) |_| {}
+    self.last_callback_time = 0;
+    self.mixer.stopSamples();
+    self.applied_serial = self.requested_serial;
+    self.track_status.store(@as(u32, self.applied_serial) << 1, .release);
 
     if (self.backend) |*backend| {
         backend.deinit();
@@ -283,7 +385,7 @@ pub fn setBackendType(self: *Self, backend_type: BackendType) void {
         }
     };
     if (backend) |*b| {
-        b.init(self, self.allocator, MixingFreq) catch {
+        b.init(self, self.allocator, self.sample_rate) catch {
             self.backend = null;
             return;
         };
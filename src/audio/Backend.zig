@@ -60,15 +60,16 @@ vtable: *const VTable,
 name: []const u8,
 backend_type: BackendType,
 
+// All of these are called from the audio callback, or while the audio device is stopped.
 pub const VTable = struct {
     init: *const fn (ctx: *anyopaque, engine: *AudioEngine, allocator: std.mem.Allocator, sample_rate: u32) Error!void,
     deinit: *const fn (ctx: *anyopaque) void,
     fillBuffer: *const fn (ctx: *anyopaque, buffer: []i16, nsamples: u32) void,
+    // Sound effects the backend synthesizes itself, mixed on the sound bus
+    fillSfxBuffer: ?*const fn (ctx: *anyopaque, buffer: []i16, nsamples: u32) void = null,
     playTrack: *const fn (ctx: *anyopaque, track: ?AudioTrack) void,
     triggerEvent: *const fn (ctx: *anyopaque, event: GameEvent) void,
     isPlayingATrack: *const fn (ctx: *anyopaque) bool,
-    lock: *const fn (ctx: *anyopaque) void,
-    unlock: *const fn (ctx: *anyopaque) void,
 };
 
 pub inline fn init(self: Backend, engine: *AudioEngine, allocator: std.mem.Allocator, sample_rate: u32) Error!void {
@@ -83,6 +84,13 @@ pub inline fn fillBuffer(self: Backend, buffer: []i16, nsamples: u32) void {
     return self.vtable.fillBuffer(self.ptr, buffer, nsamples);
 }
 
+// Returns false if the backend doesn't synthesize any sound effects.
+pub inline fn fillSfxBuffer(self: Backend, buffer: []i16, nsamples: u32) bool {
+    const fill = self.vtable.fillSfxBuffer orelse return false;
+    fill(self.ptr, buffer, nsamples);
+    return true;
+}
+
 pub inline fn playTrack(self: Backend, song_number: ?AudioTrack) void {
     self.vtable.playTrack(self.ptr, song_number);
 }
@@ -94,11 +102,3 @@ pub inline fn triggerEvent(self: Backend, event: GameEvent) void {
 pub inline fn isPlayingATrack(self: Backend) bool {
     return self.vtable.isPlayingATrack(self.ptr);
 }
-
-pub inline fn lock(self: Backend) void {
-    self.vtable.lock(self.ptr);
-}
-
-pub inline fn unlock(self: Backend) void {
-    self.vtable.unlock(self.ptr);
-}
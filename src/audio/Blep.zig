@@ -0,0 +1,119 @@
+//
+// Copyright (C) 2024 The OpenTitus team
+//
+// Authors:
+// Petr Mrázek
+//
+// "Titus the Fox: To Marrakech and Back" (1992) and
+// "Lagaf': Les Aventures de Moktar - Vol 1: La Zoubida" (1991)
+// was developed by, and is probably copyrighted by Titus Software,
+// which, according to Wikipedia, stopped buisness in 2005.
+//
+// OpenTitus is not affiliated with Titus Software.
+//
+// OpenTitus is  free software; you can redistribute  it and/or modify
+// it under the  terms of the GNU General  Public License as published
+// by the Free  Software Foundation; either version 3  of the License,
+// or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+// MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+// General Public License for more details.
+//
+
+
+// Band-limited steps: every change of level goes in as a windowed sinc impulse at its exact
+// (fractional) frame, and the output is the running sum of those. Square waves made of such steps
+// don't alias the way naive ones do, and cost a few multiply-adds per edge instead of per frame.
+
+const Blep = @This();
+
+const std = @import("std");
+
+const Mixer = @import("Mixer.zig");
+
+// Frames read in one go at most
+pub const capacity = Mixer.chunk_frames;
+// Step times are in frames, with this many bits of fraction
+pub const frac_bits = 16;
+// Length of the impulse, and how finely its position within a frame is resolved
+const taps = 16;
+const phase_bits = 5;
+const phases = 1 << phase_bits;
+// The impulses are scaled up by this many bits, and every one of them sums up to exactly 1
+const table_bits = 15;
+// Fraction of the Nyquist frequency the steps are band-limited to
+const cutoff = 0.9;
+
+const Kernel = @Vector(taps, i32);
+const table: [phases]Kernel = makeTable();
+
+fn makeTable() [phases]Kernel {
+    @setEvalBranchQuota(100_000);
+    var result: [phases]Kernel = undefined;
+    for (0..phases) |phase| {
+        var kernel: [taps]f64 = undefined;
+        var sum: f64 = 0;
+        for (0..taps) |tap| {
+            // Distance from the step, in frames
+            const x = @as(f64, @floatFromInt(tap)) - (taps / 2 - 1) - @as(f64, @floatFromInt(phase)) / phases;
+            const sinc = if (x == 0) 1.0 else @sin(std.math.pi * cutoff * x) / (std.math.pi * cutoff * x);
+            const window = 0.5 + 0.5 * @cos(std.math.pi * x / (taps / 2));
+            kernel[tap] = sinc * window;
+            sum += kernel[tap];
+        }
+        var row: [taps]i32 = undefined;
+        var total: i32 = 0;
+        for (0..taps) |tap| {
+            row[tap] = @intFromFloat(@round(kernel[tap] / sum * (1 << table_bits)));
+            total += row[tap];
+        }
+        // Whatever rounding left over would make the output drift
+        row[taps / 2 - 1] += (1 << table_bits) - total;
+        result[phase] = row;
+    }
+    return result;
+}
+
+// Impulses still to be summed, scaled up by table_bits. The tail past the frames read so far
+// carries over to the next read.
+deltas: [capacity + taps]i32 = @splat(0),
+level: i32 = 0,
+
+// Change the level by delta at time (in frames << frac_bits, within the next capacity frames).
+pub fn addStep(self: *Blep, time: u64, delta: i32) void {
+    const frame: usize = @intCast(time >> frac_bits);
+    std.debug.assert(frame < capacity);
+    const phase: usize = @intCast((time >> (frac_bits - phase_bits)) & (phases - 1));
+    const window = self.deltas[frame..][0..taps];
+    const current: Kernel = window.*;
+    window.* = current + table[phase] * @as(Kernel, @splat(delta));
+}
+
+// Read frames of output into a stereo buffer, and move on by as many.
+pub fn read(self: *Blep, buffer: []i16, frames: u32) void {
+    std.debug.assert(frames <= capacity);
+    for (0..frames) |i| {
+        self.level += self.deltas[i];
+        const sample: i16 = @intCast(std.math.clamp(self.level >> table_bits, std.math.minInt(i16), std.math.maxInt(i16)));
+        buffer[i * 2] = sample;
+        buffer[i * 2 + 1] = sample;
+    }
+    std.mem.copyForwards(i32, self.deltas[0..taps], self.deltas[frames..][0..taps]);
+    @memset(self.deltas[taps..][0..frames], 0);
+}
+
+test "band-limited steps settle on the exact level" {
+    var blep: Blep = .{};
+    var buffer: [capacity * 2]i16 = undefined;
+    blep.addStep((3 << frac_bits) + 12345, 1000);
+    blep.addStep((100 << frac_bits) + 777, -3000);
+    blep.addStep(((capacity - 1) << frac_bits) + 4321, 500);
+    blep.read(&buffer, capacity);
+    try std.testing.expectEqual(@as(i16, 1000), buffer[50 * 2]);
+    try std.testing.expectEqual(@as(i16, -2000), buffer[200 * 2 + 1]);
+    // The last step finishes in the next block
+    blep.read(&buffer, taps);
+    try std.testing.expectEqual(@as(i16, -1500), buffer[(taps - 1) * 2]);
+}
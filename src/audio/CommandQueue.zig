@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2024 The OpenTitus team
+//
+// Authors:
+// Petr Mrázek
+//
+// "Titus the Fox: To Marrakech and Back" (1992) and
+// "Lagaf': Les Aventures de Moktar - Vol 1: La Zoubida" (1991)
+// was developed by, and is probably copyrighted by Titus Software,
+// which, according to Wikipedia, stopped buisness in 2005.
+//
+// OpenTitus is not affiliated with Titus Software.
+//
+// OpenTitus is  free software; you can redistribute  it and/or modify
+// it under the  terms of the GNU General  Public License as published
+// by the Free  Software Foundation; either version 3  of the License,
+// or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+// MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+// General Public License for more details.
+//
+
+
+// Single-producer/single-consumer ring of commands from the game thread to the audio callback.
+// Neither side ever blocks: the game thread pushes, the callback pops everything at its start.
+
+const CommandQueue = @This();
+
+const std = @import("std");
+const Atomic = std.atomic.Value;
+
+const audio = @import("audio.zig");
+const AudioTrack = audio.AudioTrack;
+
+const events = @import("../events.zig");
+const GameEvent = events.GameEvent;
+
+pub const Serial = u31;
+
+pub const Command = union(enum) {
+    // serial identifies the request, so the game thread can tell when the callback has seen it
+    play_track: struct { track: ?AudioTrack, serial: Serial },
+    trigger_event: GameEvent,
+};
+
+// A command and when it was pushed (monotonic nanoseconds, 0 if unknown), so the callback can
+// place it in the buffer and measure how long it waited.
+pub const Entry = struct {
+    command: Command,
+    time: u64 = 0,
+};
+
+pub const capacity = 64;
+
+// Both indices only ever grow (wrapping), the slot is the index modulo capacity.
+// They live on separate cache lines so the two threads don't fight over one.
+head: Atomic(usize) align(std.atomic.cache_line) = .init(0),
+tail: Atomic(usize) align(std.atomic.cache_line) = .init(0),
+entries: [capacity]Entry = undefined,
+
+// Producer side. Returns false if the queue is full and the command was dropped.
+pub fn push(self: *CommandQueue, entry: Entry) bool {
+    const tail = self.tail.load(.monotonic);
+    if (tail -% self.head.load(.acquire) == capacity) {
+        return false;
+    }
+    self.entries[tail % capacity] = entry;
+    self.tail.store(tail +% 1, .release);
+    return true;
+}
+
+// Consumer side.
+pub fn pop(self: *CommandQueue) ?Entry {
+    const head = self.head.load(.monotonic);
+    if (head == self.tail.load(.acquire)) {
+        return null;
+    }
+    const entry = self.entries[head % capacity];
+    self.head.store(head +% 1, .release);
+    return entry;
+}
+
+test "command queue order and capacity" {
+    var queue: CommandQueue = .{};
+    try std.testing.expectEqual(null, queue.pop());
+    for (0..capacity) |i| {
+        try std.testing.expect(queue.push(.{ .command = .{ .play_track = .{ .track = null, .serial = @intCast(i) } }, .time = i }));
+    }
+    try std.testing.expect(!queue.push(.{ .command = .{ .trigger_event = .HitEnemy } }));
+    for (0..capacity) |i| {
+        const entry = queue.pop().?;
+        try std.testing.expectEqual(@as(Serial, @intCast(i)), entry.command.play_track.serial);
+        try std.testing.expectEqual(@as(u64, i), entry.time);
+    }
+    try std.testing.expectEqual(null, queue.pop());
+}
@@ -0,0 +1,200 @@
+//
+// Copyright (C) 2024 The OpenTitus team
+//
+// Authors:
+// Petr Mrázek
+//
+// "Titus the Fox: To Marrakech and Back" (1992) and
+// "Lagaf': Les Aventures de Moktar - Vol 1: La Zoubida" (1991)
+// was developed by, and is probably copyrighted by Titus Software,
+// which, according to Wikipedia, stopped buisness in 2005.
+//
+// OpenTitus is not affiliated with Titus Software.
+//
+// OpenTitus is  free software; you can redistribute  it and/or modify
+// it under the  terms of the GNU General  Public License as published
+// by the Free  Software Foundation; either version 3  of the License,
+// or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+// MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+// General Public License for more details.
+//
+
+
+// Mixes the music and sound buses into the output buffer.
+// The music bus is the backend's track, the sound bus is the backend's synthesized sound effects
+// (if it has any) plus any playing sample voices.
+
+const Mixer = @This();
+
+const std = @import("std");
+const Atomic = std.atomic.Value;
+
+const Backend = @import("Backend.zig");
+
+pub const Bus = enum {
+    Music,
+    Sound,
+};
+
+// Frames mixed in one go. The backends never get asked for more than this.
+pub const chunk_frames = 512;
+const NumChannels = 2;
+
+pub const voice_count = 8;
+
+const SampleVoice = struct {
+    sample: []const i8,
+    // Position and step through the sample, in 32.32 fixed point
+    position: u64,
+    step: u64,
+};
+
+const lanes = std.simd.suggestVectorLength(i16) orelse 8;
+const SampleVector = @Vector(lanes, i16);
+const WideVector = @Vector(lanes, i32);
+
+sample_rate: u32 = 0,
+voices: [voice_count]?SampleVoice = @splat(null),
+
+// 0-128, set from the game thread
+volume_music: Atomic(u8) = .init(128),
+volume_sound: Atomic(u8) = .init(128),
+
+music_buffer: [chunk_frames * NumChannels]i16 = undefined,
+sound_buffer: [chunk_frames * NumChannels]i16 = undefined,
+
+pub fn init(self: *Mixer, sample_rate: u32, volume_music: u8, volume_sound: u8) void {
+    self.sample_rate = sample_rate;
+    self.voices = @splat(null);
+    self.volume_music.store(volume_music, .monotonic);
+    self.volume_sound.store(volume_sound, .monotonic);
+}
+
+pub fn setVolume(self: *Mixer, bus: Bus, volume: u8) void {
+    switch (bus) {
+        .Music => self.volume_music.store(volume, .monotonic),
+        .Sound => self.volume_sound.store(volume, .monotonic),
+    }
+}
+
+pub fn getVolume(self: *const Mixer, bus: Bus) u8 {
+    return switch (bus) {
+        .Music => self.volume_music.load(.monotonic),
+        .Sound => self.volume_sound.load(.monotonic),
+    };
+}
+
+// Start a signed 8-bit mono sample recorded at `rate` on the sound bus. If all voices are busy,
+// the one closest to finishing is replaced.
+pub fn playSample(self: *Mixer, sample: []const i8, rate: u32) void {
+    if (sample.len == 0 or self.sample_rate == 0) {
+        return;
+    }
+    var slot: usize = 0;
+    var slot_remaining: u64 = std.math.maxInt(u64);
+    for (self.voices, 0..) |voice_in, i| {
+        const voice = voice_in orelse {
+            slot = i;
+            break;
+        };
+        const remaining = (@as(u64, voice.sample.len) << 32) - voice.position;
+        if (remaining < slot_remaining) {
+            slot = i;
+            slot_remaining = remaining;
+        }
+    }
+    self.voices[slot] = .{
+        .sample = sample,
+        .position = 0,
+        .step = (@as(u64, rate) << 32) / self.sample_rate,
+    };
+}
+
+pub fn stopSamples(self: *Mixer) void {
+    self.voices = @splat(null);
+}
+
+pub fn mix(self: *Mixer, backend: ?Backend, output: []i16, nFrames: u32) void {
+    var done: u32 = 0;
+    while (done < nFrames) {
+        const frames: u32 = @min(chunk_frames, nFrames - done);
+        const music = self.music_buffer[0 .. frames * NumChannels];
+        const sound = self.sound_buffer[0 .. frames * NumChannels];
+
+        if (backend) |b| {
+            b.fillBuffer(music, frames);
+            if (!b.fillSfxBuffer(sound, frames)) {
+                @memset(sound, 0);
+            }
+        } else {
+            @memset(music, 0);
+            @memset(sound, 0);
+        }
+        self.mixVoices(sound);
+
+        mixBuses(
+            output[done * NumChannels ..][0 .. frames * NumChannels],
+            music,
+            self.volume_music.load(.monotonic),
+            sound,
+            self.volume_sound.load(.monotonic),
+        );
+        done += frames;
+    }
+}
+
+fn mixVoices(self: *Mixer, sound: []i16) void {
+    for (&self.voices) |*voice_slot| {
+        if (voice_slot.*) |*voice| {
+            const end = @as(u64, voice.sample.len) << 32;
+            var i: usize = 0;
+            while (i < sound.len) : (i += NumChannels) {
+                if (voice.position >= end) {
+                    voice_slot.* = null;
+                    break;
+                }
+                const value = @as(i16, voice.sample[@intCast(voice.position >> 32)]) << 8;
+                sound[i] +|= value;
+                sound[i + 1] +|= value;
+                voice.position += voice.step;
+            }
+        }
+    }
+}
+
+inline fn scale(samples: SampleVector, volume: u8) SampleVector {
+    const wide: WideVector = @intCast(samples);
+    // volume is at most 128, so this can't leave the i16 range
+    return @intCast((wide * @as(WideVector, @splat(volume))) >> @splat(7));
+}
+
+fn mixBuses(output: []i16, music: []const i16, volume_music: u8, sound: []const i16, volume_sound: u8) void {
+    var i: usize = 0;
+    while (i + lanes <= output.len) : (i += lanes) {
+        const m: SampleVector = music[i..][0..lanes].*;
+        const s: SampleVector = sound[i..][0..lanes].*;
+        output[i..][0..lanes].* = scale(m, volume_music) +| scale(s, volume_sound);
+    }
+    while (i < output.len) : (i += 1) {
+        const m = (@as(i32, music[i]) * volume_music) >> 7;
+        const s = (@as(i32, sound[i]) * volume_sound) >> 7;
+        output[i] = @intCast(std.math.clamp(m + s, std.math.minInt(i16), std.math.maxInt(i16)));
+    }
+}
+
+test "mixing saturates instead of wrapping" {
+    var output: [lanes + 1]i16 = undefined;
+    const loud: [lanes + 1]i16 = @splat(30000);
+    const quiet: [lanes + 1]i16 = @splat(-100);
+    mixBuses(&output, &loud, 128, &loud, 128);
+    for (output) |sample| {
+        try std.testing.expectEqual(std.math.maxInt(i16), sample);
+    }
+    mixBuses(&output, &loud, 64, &quiet, 128);
+    for (output) |sample| {
+        try std.testing.expectEqual(@as(i16, 14900), sample);
+    }
+}
@@ -22,14 +22,21 @@
 // General Public License for more details.
 //
 
+
 // TODO: include QBasic files from https://ttf.mine.nu/music.htm as data
-// TODO: implement something like this: https://github.com/QB64Official/qb64/blob/master/internal/c/parts/audio/out/audio.cpp#L871-L1527
+
+// A cheap square wave synth, for machines where emulating an OPL chip is too much.
+// The AdLib driver plays the music from the same data as usual, but its register writes come here
+// instead of going to a chip: every keyed on voice plays a band-limited square wave at its
+// frequency, and the rhythm section plays short tones and noise bursts.
 
 const PCSpeaker = @This();
 
 const std = @import("std");
 
 const Backend = @import("Backend.zig");
+const Adlib = @import("Adlib.zig");
+const Blep = @import("Blep.zig");
 
 const audio = @import("audio.zig");
 const AudioEngine = audio.AudioEngine;
@@ -38,10 +45,140 @@ const AudioTrack = audio.AudioTrack;
 const events = @import("../events.zig");
 const GameEvent = events.GameEvent;
 
-sample_rate: u32 = undefined,
+const data = @import("../data.zig");
+
+// Melodic OPL channels
+const ToneCount = 9;
+// OPL frequency numbers are in steps of this rate
+const opl_rate = 49716;
+// Frequency multiples of the OPL operators, doubled
+const multiples = [16]u64{ 1, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 20, 24, 24, 30, 30 };
+
+const tone_amplitude = 2000;
+const drum_amplitude = 3000;
+const sfx_amplitude = 4000;
+
+const Drum = struct {
+    bit: u8,
+    hz: u32,
+    noise: bool,
+    // How long it sounds, in driver ticks
+    ticks: u8,
+};
+
+// In the order they win over each other when hit together
+const drums = [_]Drum{
+    .{ .bit = 0x10, .hz = 60, .noise = false, .ticks = 3 }, // Bass drum
+    .{ .bit = 0x08, .hz = 3000, .noise = true, .ticks = 3 }, // Snare drum
+    .{ .bit = 0x04, .hz = 200, .noise = false, .ticks = 2 }, // Tom-tom
+    .{ .bit = 0x02, .hz = 6000, .noise = true, .ticks = 4 }, // Cymbal
+    .{ .bit = 0x01, .hz = 9000, .noise = true, .ticks = 1 }, // Hi-hat
+};
+
+const Tone = struct {
+    amplitude: i32,
+    // Noise changes level at random every half period, instead of every time
+    noise: bool = false,
+    // Half a period in frames << Blep.frac_bits, 0 when silent
+    half_period: u64 = 0,
+    // When the level changes next, from the start of the block
+    next_edge: u64 = 0,
+    level: i32 = 0,
+
+    fn start(self: *Tone, blep: *Blep, time: u64, half_period: u64) void {
+        // Anything above the Nyquist frequency would only alias
+        if (half_period < 1 << Blep.frac_bits) {
+            self.stop(blep, time);
+            return;
+        }
+        if (self.half_period == 0) {
+            blep.addStep(time, self.amplitude - self.level);
+            self.level = self.amplitude;
+            self.next_edge = time + half_period;
+        } else {
+            self.next_edge = @min(self.next_edge, time + half_period);
+        }
+        self.half_period = half_period;
+    }
+
+    fn stop(self: *Tone, blep: *Blep, time: u64) void {
+        if (self.level != 0) {
+            blep.addStep(time, -self.level);
+        }
+        self.level = 0;
+        self.half_period = 0;
+    }
+
+    // Put in the edges up to end.
+    fn render(self: *Tone, blep: *Blep, end: u64, lfsr: *u16) void {
+        if (self.half_period == 0) {
+            return;
+        }
+        while (self.next_edge < end) {
+            var level = -self.level;
+            if (self.noise) {
+                const bit = lfsr.* & 1;
+                lfsr.* >>= 1;
+                if (bit != 0) {
+                    lfsr.* ^= 0xB400;
+                }
+                level = if (bit != 0) self.amplitude else -self.amplitude;
+            }
+            if (level != self.level) {
+                blep.addStep(self.next_edge, level - self.level);
+                self.level = level;
+            }
+            self.next_edge += self.half_period;
+        }
+    }
+
+    // Move on to the next block.
+    fn rebase(self: *Tone, frames: u32) void {
+        if (self.half_period != 0) {
+            self.next_edge -= @as(u64, frames) << Blep.frac_bits;
+        }
+    }
+};
+
+// A change of the sound effect tone, made while the driver ticked in fillBuffer
+const SfxEvent = struct {
+    frame: u32,
+    // 0 stops the tone
+    half_period: u64,
+};
+const sfx_event_capacity = 64;
 
+driver: Adlib = .{},
+sample_rate: u32 = undefined,
 engine: *AudioEngine = undefined,
 
+music: Blep = .{},
+tones: [ToneCount]Tone = @splat(.{ .amplitude = tone_amplitude }),
+drum: Tone = .{ .amplitude = drum_amplitude },
+drum_ticks: u8 = 0,
+lfsr: u16 = 1,
+
+// Music register state
+fnum_low: [ToneCount]u8 = @splat(0),
+rhythm: u8 = 0,
+
+// Where the driver is running, for timing its register writes: from the start of the block being
+// rendered (in frames << Blep.frac_bits), and from the start of the whole buffer (for the sfx).
+time: u64 = 0,
+frame: u32 = 0,
+
+sfx: Blep = .{},
+sfx_tone: Tone = .{ .amplitude = sfx_amplitude },
+sfx_ticks: u8 = 0,
+sfx_events: [sfx_event_capacity]SfxEvent = undefined,
+sfx_event_count: usize = 0,
+
+// Sound effect register state
+sfx_fnum_low: u8 = 0,
+sfx_block: u8 = 0,
+sfx_multiple: u8 = 1,
+sfx_rhythm: u8 = 0,
+
 pub fn backend(self: *PCSpeaker) Backend {
     return .{
         .name = "PC Speaker",
@@ -51,11 +188,10 @@ pub fn backend(self: *PCSpeaker) Backend {
             .init = init,
             .deinit = deinit,
             .fillBuffer = fillBuffer,
+            .fillSfxBuffer = fillSfxBuffer,
             .playTrack = playTrack,
             .triggerEvent = triggerEvent,
             .isPlayingATrack = isPlayingATrack,
-            .lock = lock,
-            .unlock = unlock,
         },
     };
 }
@@ -63,46 +199,217 @@ pub fn backend(self: *PCSpeaker) Backend {
 fn init(ctx: *anyopaque, engine: *AudioEngine, allocator: std.mem.Allocator, sample_rate: u32) Backend.Error!void {
     _ = allocator;
     const self: *PCSpeaker = @ptrCast(@alignCast(ctx));
+    self.* = .{};
     self.engine = engine;
     self.sample_rate = sample_rate;
+
+    const bytes = switch (data.game)
+    {
+        .Moktar => Adlib.data_moktar,
+        .Titus => Adlib.data_titus,
+        .None => {
+            return Backend.Error.InvalidData;
+        }
+    };
+    self.driver.sink = .{
+        .ptr = self,
+        .write = writeRegister,
+        .writeSfx = writeSfxRegister,
+    };
+    try self.driver.loadDriver(bytes, sample_rate);
 }
 
 fn deinit(ctx: *anyopaque) void {
     _ = ctx;
 }
 
-fn lock(ctx: *anyopaque) void {
-    _ = ctx;
+// Frequency number and block of an OPL channel, as half a period.
+fn halfPeriod(self: *const PCSpeaker, fnum_low: u8, block_fnum_high: u8) u64 {
+    const fnum = @as(u64, fnum_low) | (@as(u64, block_fnum_high & 0x03) << 8);
+    if (fnum == 0) {
+        return 0;
+    }
+    const block = (block_fnum_high >> 2) & 0x07;
+    // frequency = fnum * opl_rate / 2^(20 - block)
+    const shift: u6 = @intCast(Blep.frac_bits + 19 - @as(u32, block));
+    return (@as(u64, self.sample_rate) << shift) / (fnum * opl_rate);
 }
 
-fn unlock(ctx: *anyopaque) void {
-    _ = ctx;
+fn writeRegister(ptr: *anyopaque, reg: u16, value: u8) void {
+    const self: *PCSpeaker = @ptrCast(@alignCast(ptr));
+    switch (reg) {
+        0xA0...0xA8 => {
+            self.fnum_low[reg - 0xA0] = value;
+        },
+        0xB0...0xB8 => {
+            const channel = reg - 0xB0;
+            // In rhythm mode, the last three channels belong to the drums
+            if (channel >= 6 and self.rhythm & 0x20 != 0) {
+                return;
+            }
+            const tone = &self.tones[channel];
+            if (value & 0x20 != 0) {
+                tone.start(&self.music, self.time, self.halfPeriod(self.fnum_low[channel], value));
+            } else {
+                tone.stop(&self.music, self.time);
+            }
+        },
+        0xBD => {
+            const hits = value & ~self.rhythm & 0x1F;
+            self.rhythm = value;
+            if (value & 0x20 != 0) {
+                for (self.tones[6..]) |*tone| {
+                    tone.stop(&self.music, self.time);
+                }
+            }
+            for (drums) |drum| {
+                if (hits & drum.bit != 0) {
+                    self.drum.noise = drum.noise;
+                    self.drum.start(&self.music, self.time, (@as(u64, self.sample_rate) << Blep.frac_bits) / (2 * drum.hz));
+                    self.drum_ticks = drum.ticks;
+                    break;
+                }
+            }
+        },
+        else => {},
+    }
 }
 
+// The sound effects play the bass drum of their own chip, and the driver hits it every tick while
+// one is on.
+fn writeSfxRegister(ptr: *anyopaque, reg: u16, value: u8) void {
+    const self: *PCSpeaker = @ptrCast(@alignCast(ptr));
+    switch (reg) {
+        0xA6 => {
+            self.sfx_fnum_low = value;
+        },
+        0xB6 => {
+            self.sfx_block = value;
+        },
+        // Carrier of the bass drum: Amp Mod / Vibrato / EG type / Key Scaling / Multiple
+        0x33 => {
+            self.sfx_multiple = value & 0x0F;
+        },
+        0xBD => {
+            if (value & 0x10 != 0 and self.sfx_rhythm & 0x10 == 0) {
+                const half_period = self.halfPeriod(self.sfx_fnum_low, self.sfx_block) * 2 / multiples[self.sfx_multiple];
+                self.addSfxEvent(half_period);
+                self.sfx_ticks = 2;
+            }
+            self.sfx_rhythm = value;
+        },
+        else => {},
+    }
+}
+
+fn addSfxEvent(self: *PCSpeaker, half_period: u64) void {
+    if (self.sfx_event_count == sfx_event_capacity) {
+        return;
+    }
+    self.sfx_events[self.sfx_event_count] = .{ .frame = self.frame, .half_period = half_period };
+    self.sfx_event_count += 1;
+}
+
+fn tick(self: *PCSpeaker) void {
+    if (self.drum_ticks > 0) {
+        self.drum_ticks -= 1;
+        if (self.drum_ticks == 0) {
+            self.drum.stop(&self.music, self.time);
+        }
+    }
+    if (self.sfx_ticks > 0) {
+        self.sfx_ticks -= 1;
+        if (self.sfx_ticks == 0) {
+            self.addSfxEvent(0);
+        }
+    }
+    self.driver.tick();
+}
+
+fn renderTones(self: *PCSpeaker, end: u64) void {
+    for (&self.tones) |*tone| {
+        tone.render(&self.music, end, &self.lfsr);
+    }
+    self.drum.render(&self.music, end, &self.lfsr);
+}
+
+// Render in blocks between the driver ticks, like the AdLib backend does.
 fn fillBuffer(ctx: *anyopaque, buffer: []i16, nsamples: u32) void {
-    _ = ctx;
-    if (nsamples > 0) {
-        //pocketmod.OPL3_GenerateStream(&self.opl_chip, &buffer[0], nsamples);
-        @memset(buffer, 0);
+    const self: *PCSpeaker = @ptrCast(@alignCast(ctx));
+    var done: u32 = 0;
+    while (done < nsamples) {
+        const block: u32 = @min(nsamples - done, Blep.capacity);
+        var position: u32 = 0;
+        while (position < block) {
+            if (self.driver.frames_to_tick == 0) {
+                self.time = @as(u64, position) << Blep.frac_bits;
+                self.frame = done + position;
+                self.tick();
+            }
+            const frames: u32 = @intCast(@min(block - position, self.driver.frames_to_tick));
+            position += frames;
+            self.renderTones(@as(u64, position) << Blep.frac_bits);
+            self.driver.frames_to_tick -= frames;
+        }
+        self.music.read(buffer[done * 2 ..][0 .. block * 2], block);
+        for (&self.tones) |*tone| {
+            tone.rebase(block);
+        }
+        self.drum.rebase(block);
+        done += block;
+    }
+    // Anything the game does before the next buffer happens at its start
+    self.time = 0;
+    self.frame = 0;
+}
+
+// Render the same buffer for the sound effects, changing the tone where the ticks did.
+fn fillSfxBuffer(ctx: *anyopaque, buffer: []i16, nsamples: u32) void {
+    const self: *PCSpeaker = @ptrCast(@alignCast(ctx));
+    var done: u32 = 0;
+    var next_event: usize = 0;
+    while (done < nsamples) {
+        const block: u32 = @min(nsamples - done, Blep.capacity);
+        while (next_event < self.sfx_event_count) : (next_event += 1) {
+            const event = self.sfx_events[next_event];
+            const frame = @min(event.frame, nsamples - 1);
+            if (frame >= done + block) {
+                break;
+            }
+            const time = @as(u64, frame - done) << Blep.frac_bits;
+            self.sfx_tone.render(&self.sfx, time, &self.lfsr);
+            if (event.half_period == 0) {
+                self.sfx_tone.stop(&self.sfx, time);
+            } else {
+                self.sfx_tone.start(&self.sfx, time, event.half_period);
+            }
+        }
+        self.sfx_tone.render(&self.sfx, @as(u64, block) << Blep.frac_bits, &self.lfsr);
+        self.sfx.read(buffer[done * 2 ..][0 .. block * 2], block);
+        self.sfx_tone.rebase(block);
+        done += block;
     }
+    self.sfx_event_count = 0;
 }
 
 fn playTrack(ctx: *anyopaque, track: ?AudioTrack) void {
-    _ = ctx;
-    _ = track;
+    const self: *PCSpeaker = @ptrCast(@alignCast(ctx));
+    if (track == null) {
+        // The driver just stops reading, it's up to us to stop the notes
+        for (&self.tones) |*tone| {
+            tone.stop(&self.music, self.time);
+        }
+        self.drum.stop(&self.music, self.time);
+    }
+    self.driver.backend().playTrack(track);
 }
 
 fn triggerEvent(ctx: *anyopaque, event: GameEvent) void {
-    _ = ctx;
-    _ = event;
+    const self: *PCSpeaker = @ptrCast(@alignCast(ctx));
+    self.driver.backend().triggerEvent(event);
 }
 
 fn isPlayingATrack(ctx: *anyopaque) bool {
-    _ = ctx;
-    return false;
-}
-
-fn play_sfx(ctx: *anyopaque, fx_number: u8) void {
-    _ = ctx;
-    _ = fx_number;
+    const self: *PCSpeaker = @ptrCast(@alignCast(ctx));
+    return self.driver.backend().isPlayingATrack();
 }
@@ -0,0 +1,256 @@
+//
+// Copyright (C) 2024 The OpenTitus team
+//
+// Authors:
+// Petr Mrázek
+//
+// "Titus the Fox: To Marrakech and Back" (1992) and
+// "Lagaf': Les Aventures de Moktar - Vol 1: La Zoubida" (1991)
+// was developed by, and is probably copyrighted by Titus Software,
+// which, according to Wikipedia, stopped buisness in 2005.
+//
+// OpenTitus is not affiliated with Titus Software.
+//
+// OpenTitus is  free software; you can redistribute  it and/or modify
+// it under the  terms of the GNU General  Public License as published
+// by the Free  Software Foundation; either version 3  of the License,
+// or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+// MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+// General Public License for more details.
+//
+
+
+// Pre-rendered music tracks, made by `opentitus --render-music`. When they are enabled, a backend
+// streams these instead of synthesizing its tracks live.
+//
+// The tracks are 16-bit stereo WAV files, named after the backend, the game and the track. A track
+// that loops has the loop in a 'smpl' chunk, the loop always runs to the end of the track.
+
+const TrackCache = @This();
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+const audio = @import("audio.zig");
+const AudioTrack = audio.AudioTrack;
+const BackendType = audio.BackendType;
+
+const data = @import("../data.zig");
+const _bytes = @import("../bytes.zig");
+
+pub const directory = "music";
+const track_count = @typeInfo(AudioTrack).@"enum".fields.len;
+const max_file_size = 256 * 1024 * 1024;
+const NumChannels = 2;
+
+pub const Track = struct {
+    sample_rate: u32,
+    // Interleaved stereo
+    samples: []i16,
+    // Frame the track continues from when it reaches the end, or null if it stops there
+    loop_start: ?usize = null,
+
+    pub fn frameCount(self: *const Track) usize {
+        return self.samples.len / NumChannels;
+    }
+
+    pub fn deinit(self: *Track, allocator: Allocator) void {
+        allocator.free(self.samples);
+    }
+};
+
+// Plays a cached track
+pub const Stream = struct {
+    track: *const Track,
+    position: usize = 0,
+
+    // Copy the next frames into the buffer. Returns how many frames there were, fewer than asked
+    // for once the track has ended.
+    pub fn fill(self: *Stream, buffer: []i16, frames: u32) u32 {
+        const total = self.track.frameCount();
+        var done: usize = 0;
+        while (done < frames) {
+            if (self.position == total) {
+                self.position = self.track.loop_start orelse break;
+            }
+            const count = @min(frames - done, total - self.position);
+            @memcpy(
+                buffer[done * NumChannels ..][0 .. count * NumChannels],
+                self.track.samples[self.position * NumChannels ..][0 .. count * NumChannels],
+            );
+            done += count;
+            self.position += count;
+        }
+        return @intCast(done);
+    }
+};
+
+tracks: [track_count]?Track = @splat(null),
+
+pub fn fileName(buffer: []u8, backend_type: BackendType, game: data.GameType, track: AudioTrack) ![]const u8 {
+    return std.fmt.bufPrint(buffer, directory ++ "/{s}-{s}-{s}.wav", .{ @tagName(backend_type), @tagName(game), @tagName(track) });
+}
+
+// Load whatever tracks have been rendered for this backend and game at this sample rate.
+pub fn load(allocator: Allocator, backend_type: BackendType, game: data.GameType, sample_rate: u32) TrackCache {
+    var cache: TrackCache = .{};
+    for (std.enums.values(AudioTrack)) |track| {
+        var name_buffer: [256]u8 = undefined;
+        const name = fileName(&name_buffer, backend_type, game, track) catch continue;
+        const bytes = std.fs.cwd().readFileAlloc(allocator, name, max_file_size) catch |err| {
+            if (err != error.FileNotFound) {
+                std.log.warn("Cannot read {s}: {}", .{ name, err });
+            }
+            continue;
+        };
+        defer allocator.free(bytes);
+        var loaded = readWav(allocator, bytes) catch |err| {
+            std.log.warn("Cannot load {s}: {}", .{ name, err });
+            continue;
+        };
+        if (loaded.sample_rate != sample_rate) {
+            std.log.warn("{s} is rendered at {d} Hz instead of {d} Hz, not using it", .{ name, loaded.sample_rate, sample_rate });
+            loaded.deinit(allocator);
+            continue;
+        }
+        cache.tracks[@intFromEnum(track)] = loaded;
+    }
+    return cache;
+}
+
+pub fn deinit(self: *TrackCache, allocator: Allocator) void {
+    for (&self.tracks) |*track_slot| {
+        if (track_slot.*) |*track| {
+            track.deinit(allocator);
+        }
+        track_slot.* = null;
+    }
+}
+
+pub fn get(self: *const TrackCache, track: AudioTrack) ?*const Track {
+    if (self.tracks[@intFromEnum(track)]) |*cached| {
+        return cached;
+    }
+    return null;
+}
+
+pub fn readWav(allocator: Allocator, file: []const u8) !Track {
+    if (file.len < 12 or !std.mem.eql(u8, file[0..4], "RIFF") or !std.mem.eql(u8, file[8..12], "WAVE")) {
+        return error.NotAWavFile;
+    }
+    var rest = file[12..];
+    var sample_rate: ?u32 = null;
+    var loop_start: ?usize = null;
+    var samples: ?[]i16 = null;
+    errdefer if (samples) |s| allocator.free(s);
+    while (rest.len >= 8) {
+        const id = rest[0..4];
+        rest = rest[4..];
+        const size = _bytes.chompInt(u32, .little, &rest);
+        if (size > rest.len) {
+            return error.TruncatedWavFile;
+        }
+        var chunk = rest[0..size];
+        // Chunks are padded to an even size
+        rest = rest[@min(rest.len, size + (size & 1))..];
+
+        if (std.mem.eql(u8, id, "fmt ")) {
+            if (chunk.len < 16) {
+                return error.TruncatedWavFile;
+            }
+            const format = _bytes.chompInt(u16, .little, &chunk);
+            const channels = _bytes.chompInt(u16, .little, &chunk);
+            const rate = _bytes.chompInt(u32, .little, &chunk);
+            chunk = chunk[6..]; // byte rate and block align
+            const bits = _bytes.chompInt(u16, .little, &chunk);
+            if (format != 1 or channels != NumChannels or bits != 16) {
+                return error.UnsupportedWavFormat;
+            }
+            sample_rate = rate;
+        } else if (std.mem.eql(u8, id, "smpl")) {
+            // The loop count is the 8th field, the first loop's start the 3rd field after the header
+            if (chunk.len >= 36 + 24 and _bytes.getInt(u32, .little, chunk[28..32]) > 0) {
+                loop_start = _bytes.getInt(u32, .little, chunk[36 + 8 .. 36 + 12]);
+            }
+        } else if (std.mem.eql(u8, id, "data")) {
+            if (samples != null) {
+                return error.UnsupportedWavFormat;
+            }
+            // Whole frames only
+            const out = try allocator.alloc(i16, chunk.len / (NumChannels * @sizeOf(i16)) * NumChannels);
+            for (out) |*sample| {
+                sample.* = _bytes.chompInt(i16, .little, &chunk);
+            }
+            samples = out;
+        }
+    }
+    var track = Track{
+        .sample_rate = sample_rate orelse return error.UnsupportedWavFormat,
+        .samples = samples orelse return error.TruncatedWavFile,
+        .loop_start = loop_start,
+    };
+    // Loops that don't loop anything are no loops
+    if (track.loop_start) |start| {
+        if (start >= track.frameCount()) {
+            track.loop_start = null;
+        }
+    }
+    return track;
+}
+
+pub fn writeWav(writer: *std.Io.Writer, sample_rate: u32, samples: []const i16, loop_start: ?usize) !void {
+    const data_size: u32 = @intCast(samples.len * @sizeOf(i16));
+    const smpl_size: u32 = if (loop_start != null) 36 + 24 else 0;
+    const riff_size: u32 = 4 + (8 + 16) + (if (smpl_size != 0) 8 + smpl_size else 0) + (8 + data_size);
+
+    try writer.writeAll("RIFF");
+    try writer.writeInt(u32, riff_size, .little);
+    try writer.writeAll("WAVE");
+
+    try writer.writeAll("fmt ");
+    try writer.writeInt(u32, 16, .little);
+    try writer.writeInt(u16, 1, .little); // PCM
+    try writer.writeInt(u16, NumChannels, .little);
+    try writer.writeInt(u32, sample_rate, .little);
+    try writer.writeInt(u32, sample_rate * NumChannels * @sizeOf(i16), .little);
+    try writer.writeInt(u16, NumChannels * @sizeOf(i16), .little);
+    try writer.writeInt(u16, 16, .little);
+
+    if (loop_start) |start| {
+        const frames: u32 = @intCast(samples.len / NumChannels);
+        try writer.writeAll("smpl");
+        try writer.writeInt(u32, smpl_size, .little);
+        // manufacturer, product, sample period, MIDI unity note, MIDI pitch fraction, SMPTE format,
+        // SMPTE offset, loop count, sampler data
+        for ([_]u32{ 0, 0, std.time.ns_per_s / sample_rate, 60, 0, 0, 0, 1, 0 }) |value| {
+            try writer.writeInt(u32, value, .little);
+        }
+        // cue point id, type (forward), start, end (inclusive), fraction, play count (forever)
+        for ([_]u32{ 0, 0, @intCast(start), frames - 1, 0, 0 }) |value| {
+            try writer.writeInt(u32, value, .little);
+        }
+    }
+
+    try writer.writeAll("data");
+    try writer.writeInt(u32, data_size, .little);
+    for (samples) |sample| {
+        try writer.writeInt(i16, sample, .little);
+    }
+}
+
+test "wav round trip" {
+    const allocator = std.testing.allocator;
+    const samples = [_]i16{ 0, 1, -1, 2, std.math.minInt(i16), std.math.maxInt(i16) };
+    var buffer: [256]u8 = undefined;
+    var writer = std.Io.Writer.fixed(&buffer);
+    try writeWav(&writer, 22050, &samples, 1);
+
+    var track = try readWav(allocator, writer.buffered());
+    defer track.deinit(allocator);
+    try std.testing.expectEqual(@as(u32, 22050), track.sample_rate);
+    try std.testing.expectEqualSlices(i16, &samples, track.samples);
+    try std.testing.expectEqual(@as(?usize, 1), track.loop_start);
+}
@@ -15,6 +15,7 @@ pub const AudioTrack = enum {
 
 pub const AudioEngine = @import("AudioEngine.zig");
 pub const BackendType = AudioEngine.BackendType;
+pub const OplCore = @import("opl3/opl3.zig").Core;
 
 const game = @import("../game.zig");
 const SDL = @import("../SDL.zig");
@@ -37,9 +38,7 @@ pub fn music_set_playing(playing: bool) void {
         return;
     }
     if (!game.settings.music) {
-        engine.backend.?.lock();
-        engine.backend.?.playTrack(null);
-        engine.backend.?.unlock();
+        engine.playTrack(null);
     }
 }
 
@@ -72,7 +71,7 @@ pub fn music_wait_to_finish() void {
         if (input_state.should_redraw) {
             window.window_render();
         }
-        if (!engine.backend.?.isPlayingATrack()) {
+        if (!engine.isPlayingATrack()) {
             return;
         }
     }
@@ -86,7 +85,7 @@ pub fn music_restart_if_finished() void {
         return;
     }
 
-    if (!engine.backend.?.isPlayingATrack()) {
+    if (!engine.isPlayingATrack()) {
         playTrack(engine.last_song);
     }
 }
@@ -100,21 +99,14 @@ pub fn playTrack(track: ?AudioTrack) void {
     if (engine.backend == null) {
         return;
     }
-    engine.backend.?.lock();
-    {
-        engine.backend.?.playTrack(track);
-    }
-    engine.backend.?.unlock();
+    engine.playTrack(track);
 }
 
 pub fn triggerEvent(event: GameEvent) void {
     if (engine.backend == null) {
         return;
     }
-    var backend = &engine.backend.?;
-    backend.lock();
-    backend.triggerEvent(event);
-    backend.unlock();
+    engine.triggerEvent(event);
 }
 
 pub fn set_volume(volume: u8) void {
@@ -134,6 +126,24 @@ pub fn get_volume() u8 {
     return engine.volume;
 }
 
+pub fn set_music_volume(volume: u8) void {
+    game.settings.volume_music = @min(volume, 128);
+    engine.mixer.setVolume(.Music, game.settings.volume_music);
+}
+
+pub fn get_music_volume() u8 {
+    return engine.mixer.getVolume(.Music);
+}
+
+pub fn set_sound_volume(volume: u8) void {
+    game.settings.volume_sound = @min(volume, 128);
+    engine.mixer.setVolume(.Sound, game.settings.volume_sound);
+}
+
+pub fn get_sound_volume() u8 {
+    return engine.mixer.getVolume(.Sound);
+}
+
 pub fn getBackendType() BackendType {
     return engine.getBackendType();
 }
@@ -141,3 +151,17 @@ pub fn getBackendType() BackendType {
 pub fn setBackendType(backend_type: BackendType) void {
     engine.setBackendType(backend_type);
 }
+
+pub fn getOplCore() OplCore {
+    return game.settings.opl_core;
+}
+
+pub fn setOplCore(core: OplCore) void {
+    if (game.settings.opl_core == core) {
+        return;
+    }
+    game.settings.opl_core = core;
+    if (engine.getBackendType() == .Adlib) {
+        engine.restartBackend();
+    }
+}
@@ -0,0 +1,131 @@
+//
+// Copyright (C) 2024 The OpenTitus team
+//
+// Authors:
+// Petr Mrázek
+//
+// "Titus the Fox: To Marrakech and Back" (1992) and
+// "Lagaf': Les Aventures de Moktar - Vol 1: La Zoubida" (1991)
+// was developed by, and is probably copyrighted by Titus Software,
+// which, according to Wikipedia, stopped buisness in 2005.
+//
+// OpenTitus is not affiliated with Titus Software.
+//
+// OpenTitus is  free software; you can redistribute  it and/or modify
+// it under the  terms of the GNU General  Public License as published
+// by the Free  Software Foundation; either version 3  of the License,
+// or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+// MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+// General Public License for more details.
+//
+
+
+// OPL benchmark: renders every AdLib track of both games with each OPL core, as fast as possible,
+// and prints how many samples per second each core manages.
+//
+//   opentitus --opl-benchmark [--seconds N] [--rate N]
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+const Adlib = @import("Adlib.zig");
+const OPL3 = @import("opl3/opl3.zig");
+
+// Some tracks loop forever, so every track is cut off after this long
+const DEFAULT_SECONDS = 60;
+const DEFAULT_RATE = 44100;
+// Frames per fillBuffer call, about what an audio callback asks for
+const BLOCK_FRAMES = 512;
+
+const MusicFile = struct {
+    name: []const u8,
+    bytes: []const u8,
+};
+
+const music_files = [_]MusicFile{
+    .{ .name = "titus.bin", .bytes = Adlib.data_titus },
+    .{ .name = "moktar.bin", .bytes = Adlib.data_moktar },
+};
+
+const Options = struct {
+    seconds: u64 = DEFAULT_SECONDS,
+    rate: u32 = DEFAULT_RATE,
+
+    fn parse(self: *Options, args: []const [:0]const u8) !void {
+        var i: usize = 0;
+        while (i < args.len) : (i += 1) {
+            const arg = args[i];
+            if (i + 1 == args.len) {
+                std.debug.print("Missing value for {s}\n", .{arg});
+                return error.InvalidArguments;
+            }
+            i += 1;
+            const value = args[i];
+            if (std.mem.eql(u8, arg, "--seconds")) {
+                self.seconds = try std.fmt.parseInt(u64, value, 10);
+            } else if (std.mem.eql(u8, arg, "--rate")) {
+                self.rate = try std.fmt.parseInt(u32, value, 10);
+            } else {
+                std.debug.print("Unknown benchmark option: {s}\n", .{arg});
+                return error.InvalidArguments;
+            }
+        }
+    }
+};
+
+// Render until the track ends or max_frames have been rendered, returns the rendered frames
+fn renderTrack(adlib: *Adlib, buffer: []i16, max_frames: u64) u64 {
+    const backend = adlib.backend();
+    var frames: u64 = 0;
+    while (frames < max_frames and backend.isPlayingATrack()) {
+        const count: u32 = @intCast(@min(BLOCK_FRAMES, max_frames - frames));
+        backend.fillBuffer(buffer[0 .. count * 2], count);
+        frames += count;
+    }
+    return frames;
+}
+
+pub fn run(allocator: Allocator, args: []const [:0]const u8) !u8 {
+    var options = Options{};
+    options.parse(args) catch {
+        return 1;
+    };
+
+    // The chips are big, keep them off the stack
+    const adlib = try allocator.create(Adlib);
+    defer allocator.destroy(adlib);
+    adlib.* = .{};
+    const buffer = try allocator.alloc(i16, BLOCK_FRAMES * 2);
+    defer allocator.free(buffer);
+
+    const max_frames = options.seconds * options.rate;
+    for (std.enums.values(OPL3.Core)) |core| {
+        for (music_files) |file| {
+            var frames: u64 = 0;
+            var elapsed_ns: u64 = 0;
+            for (0..Adlib.TrackCount) |track| {
+                adlib.load(file.bytes, core, options.rate) catch |err| {
+                    std.debug.print("Cannot load {s}: {}\n", .{ file.name, err });
+                    return 1;
+                };
+                adlib.playTrackNumber(@intCast(track));
+                var timer = try std.time.Timer.start();
+                frames += renderTrack(adlib, buffer, max_frames);
+                elapsed_ns += timer.read();
+            }
+            const samples_per_second = if (elapsed_ns == 0) 0 else frames * std.time.ns_per_s / elapsed_ns;
+            std.debug.print("{s:<6} {s:<10} {d} samples in {d} ms, {d} samples/s ({d:.1}x realtime)\n", .{
+                core.str(),
+                file.name,
+                frames,
+                elapsed_ns / std.time.ns_per_ms,
+                samples_per_second,
+                @as(f64, @floatFromInt(samples_per_second)) / @as(f64, @floatFromInt(options.rate)),
+            });
+        }
+    }
+    return 0;
+}
@@ -121,3 +121,81 @@ pub extern fn OPL3_Reset(chip: *opl3_chip, samplerate: u32) void;
 pub extern fn OPL3_WriteReg(chip: *opl3_chip, reg: u16, v: u8) void;
 pub extern fn OPL3_WriteRegBuffered(chip: *opl3_chip, reg: u16, v: u8) void;
 pub extern fn OPL3_GenerateStream(chip: *opl3_chip, sndptr: [*c]i16, numsamples: u32) void;
+
+// NOTE: everything below is not from `opl3.h`
+
+const std = @import("std");
+
+const dbopl = @cImport({
+    @cInclude("dbopl.h");
+});
+
+// The OPL emulator cores we can render with. Nuked is cycle accurate, DOSBox is a lot cheaper.
+pub const Core = enum(u8) {
+    Nuked = 0,
+    DOSBox,
+
+    pub const NameTable = [@typeInfo(Core).@"enum".fields.len][]const u8{
+        "Nuked",
+        "DOSBox",
+    };
+
+    pub fn str(self: Core) []const u8 {
+        return NameTable[@intFromEnum(self)];
+    }
+};
+
+// Both cores keep pointers into themselves, so a chip must not be moved after init.
+pub const Chip = union(Core) {
+    Nuked: opl3_chip,
+    DOSBox: dbopl.Chip,
+
+    pub fn init(self: *Chip, core: Core, sample_rate: u32) void {
+        switch (core) {
+            .Nuked => {
+                self.* = .{ .Nuked = undefined };
+                OPL3_Reset(&self.Nuked, sample_rate);
+            },
+            .DOSBox => {
+                self.* = .{ .DOSBox = undefined };
+                dbopl.DBOPL_InitTables();
+                dbopl.Chip__Chip(&self.DOSBox);
+                dbopl.Chip__Setup(&self.DOSBox, sample_rate);
+            },
+        }
+        // Enable waveform select, which the game's instruments rely on and the driver never does
+        self.writeRegister(0x01, 0x20);
+    }
+
+    pub fn writeRegister(self: *Chip, reg: u16, value: u8) void {
+        switch (self.*) {
+            .Nuked => |*chip| OPL3_WriteRegBuffered(chip, reg, value),
+            .DOSBox => |*chip| dbopl.Chip__WriteReg(chip, reg, value),
+        }
+    }
+
+    // Render interleaved stereo frames
+    pub fn generate(self: *Chip, buffer: []i16, frames: u32) void {
+        if (frames == 0) {
+            return;
+        }
+        switch (self.*) {
+            .Nuked => |*chip| OPL3_GenerateStream(chip, buffer.ptr, frames),
+            .DOSBox => |*chip| {
+                // The game only uses the OPL2 part of the chip, which the DOSBox core renders in mono
+                var mono: [512]i32 = undefined;
+                var done: usize = 0;
+                while (done < frames) {
+                    const count = @min(mono.len, frames - done);
+                    dbopl.Chip__GenerateBlock2(chip, count, &mono);
+                    for (mono[0..count], done..) |sample, i| {
+                        const clamped: i16 = @intCast(std.math.clamp(sample, std.math.minInt(i16), std.math.maxInt(i16)));
+                        buffer[i * 2] = clamped;
+                        buffer[i * 2 + 1] = clamped;
+                    }
+                    done += count;
+                }
+            },
+        }
+    }
+};
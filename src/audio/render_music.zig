@@ -0,0 +1,242 @@
+//
+// Copyright (C) 2024 The OpenTitus team
+//
+// Authors:
+// Petr Mrázek
+//
+// "Titus the Fox: To Marrakech and Back" (1992) and
+// "Lagaf': Les Aventures de Moktar - Vol 1: La Zoubida" (1991)
+// was developed by, and is probably copyrighted by Titus Software,
+// which, according to Wikipedia, stopped buisness in 2005.
+//
+// OpenTitus is not affiliated with Titus Software.
+//
+// OpenTitus is  free software; you can redistribute  it and/or modify
+// it under the  terms of the GNU General  Public License as published
+// by the Free  Software Foundation; either version 3  of the License,
+// or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+// MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+// General Public License for more details.
+//
+
+
+// Offline music renderer: renders every track of a backend to WAV files in music/. With
+// prerendered_music set in the settings, the game streams those instead of synthesizing the music.
+// With --compare, the tracks are checked against the files instead, which makes them golden files.
+//
+//   opentitus --render-music [--backend Adlib|Amiga|PCSpeaker] [--core Nuked|DOSBox] [--moktar] [--rate N] [--seconds N] [--compare]
+//
+// Tracks of the AdLib driver (played by the AdLib and PC speaker backends) that loop forever are cut
+// where the driver gets back into a state it was in before, and that point is stored as the loop start.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+const audio = @import("audio.zig");
+const AudioTrack = audio.AudioTrack;
+const BackendType = audio.BackendType;
+const Adlib = @import("Adlib.zig");
+const Backend = @import("Backend.zig");
+const OPL3 = @import("opl3/opl3.zig");
+const TrackCache = @import("TrackCache.zig");
+
+const data = @import("../data.zig");
+const game = @import("../game.zig");
+const Settings = @import("../settings.zig").Settings;
+
+// Longest a track may get, for tracks that loop without the driver ever repeating itself
+const DEFAULT_SECONDS = 300;
+const DEFAULT_RATE = 44100;
+const BLOCK_FRAMES = 512;
+
+const Options = struct {
+    backend: BackendType = .Adlib,
+    core: OPL3.Core = .Nuked,
+    game: data.GameType = .Titus,
+    rate: u32 = DEFAULT_RATE,
+    seconds: u64 = DEFAULT_SECONDS,
+    compare: bool = false,
+
+    fn parse(self: *Options, args: []const [:0]const u8) !void {
+        var i: usize = 0;
+        while (i < args.len) : (i += 1) {
+            const arg = args[i];
+            if (std.mem.eql(u8, arg, "--moktar")) {
+                self.game = .Moktar;
+                continue;
+            }
+            if (std.mem.eql(u8, arg, "--compare")) {
+                self.compare = true;
+                continue;
+            }
+            if (i + 1 == args.len) {
+                std.debug.print("Missing value for {s}\n", .{arg});
+                return error.InvalidArguments;
+            }
+            i += 1;
+            const value = args[i];
+            if (std.mem.eql(u8, arg, "--backend")) {
+                self.backend = std.meta.stringToEnum(BackendType, value) orelse {
+                    std.debug.print("Unknown backend: {s}\n", .{value});
+                    return error.InvalidArguments;
+                };
+            } else if (std.mem.eql(u8, arg, "--core")) {
+                self.core = std.meta.stringToEnum(OPL3.Core, value) orelse {
+                    std.debug.print("Unknown OPL core: {s}\n", .{value});
+                    return error.InvalidArguments;
+                };
+            } else if (std.mem.eql(u8, arg, "--rate")) {
+                self.rate = try std.fmt.parseInt(u32, value, 10);
+            } else if (std.mem.eql(u8, arg, "--seconds")) {
+                self.seconds = try std.fmt.parseInt(u64, value, 10);
+            } else {
+                std.debug.print("Unknown render option: {s}\n", .{arg});
+                return error.InvalidArguments;
+            }
+        }
+    }
+};
+
+// Render a track into out. Returns the frame it loops back to, if it loops.
+fn renderTrack(
+    allocator: Allocator,
+    backend: Backend,
+    driver: ?*Adlib,
+    track: AudioTrack,
+    max_frames: u64,
+    out: *std.ArrayList(i16),
+) !?usize {
+    var seen: std.AutoHashMapUnmanaged(u64, usize) = .empty;
+    defer seen.deinit(allocator);
+    var block: [BLOCK_FRAMES * 2]i16 = undefined;
+
+    backend.playTrack(track);
+    var frames: usize = 0;
+    while (frames < max_frames and backend.isPlayingATrack()) {
+        var count: u32 = @intCast(@min(BLOCK_FRAMES, max_frames - frames));
+        if (driver) |adlib| {
+            if (adlib.frames_to_tick == 0) {
+                // The driver ticks on the next frame. If it was in this state before, it loops.
+                const entry = try seen.getOrPut(allocator, adlib.driverState());
+                if (entry.found_existing) {
+                    return entry.value_ptr.*;
+                }
+                entry.value_ptr.* = frames;
+                count = 1;
+            } else {
+                count = @intCast(@min(count, adlib.frames_to_tick));
+            }
+        }
+        backend.fillBuffer(block[0 .. count * 2], count);
+        try out.appendSlice(allocator, block[0 .. count * 2]);
+        frames += count;
+    }
+    if (frames == max_frames) {
+        std.debug.print("{s} was cut off after {d} frames\n", .{ @tagName(track), frames });
+    }
+    return null;
+}
+
+fn writeTrack(name: []const u8, sample_rate: u32, samples: []const i16, loop_start: ?usize) !void {
+    var file = try std.fs.cwd().createFile(name, .{});
+    defer file.close();
+    var write_buffer: [64 * 1024]u8 = undefined;
+    var file_writer = file.writer(&write_buffer);
+    try TrackCache.writeWav(&file_writer.interface, sample_rate, samples, loop_start);
+    try file_writer.interface.flush();
+}
+
+fn compareTrack(allocator: Allocator, name: []const u8, sample_rate: u32, samples: []const i16, loop_start: ?usize) !bool {
+    const bytes = try std.fs.cwd().readFileAlloc(allocator, name, 256 * 1024 * 1024);
+    defer allocator.free(bytes);
+    var golden = try TrackCache.readWav(allocator, bytes);
+    defer golden.deinit(allocator);
+    if (golden.sample_rate != sample_rate) {
+        std.debug.print("{s}: rendered at {d} Hz, expected {d} Hz\n", .{ name, sample_rate, golden.sample_rate });
+        return false;
+    }
+    if (!std.meta.eql(golden.loop_start, loop_start)) {
+        std.debug.print("{s}: loops at {?d}, expected {?d}\n", .{ name, loop_start, golden.loop_start });
+        return false;
+    }
+    if (std.mem.indexOfDiff(i16, golden.samples, samples)) |index| {
+        std.debug.print("{s}: differs from frame {d} on\n", .{ name, index / 2 });
+        return false;
+    }
+    return true;
+}
+
+pub fn run(allocator: Allocator, args: []const [:0]const u8) !u8 {
+    var options = Options{};
+    options.parse(args) catch {
+        return 1;
+    };
+
+    data.init(options.game);
+    // The backends read these, and there is no settings file to read them from
+    var settings = Settings{
+        .audio_backend = options.backend,
+        .opl_core = options.core,
+    };
+    game.settings = &settings;
+
+    const backend = switch (options.backend) {
+        .Adlib => audio.engine.adlib.backend(),
+        .Amiga => audio.engine.amiga.backend(),
+        .PCSpeaker => audio.engine.pcSpeaker.backend(),
+        else => {
+            std.debug.print("The {s} backend has no music to render\n", .{@tagName(options.backend)});
+            return 1;
+        },
+    };
+    // Both play the music through the AdLib driver, which tells when a track loops
+    const driver: ?*Adlib = switch (options.backend) {
+        .Adlib => &audio.engine.adlib,
+        .PCSpeaker => &audio.engine.pcSpeaker.driver,
+        else => null,
+    };
+    backend.init(&audio.engine, allocator, options.rate) catch |err| {
+        std.debug.print("Cannot start the {s} backend: {}\n", .{ backend.name, err });
+        return 1;
+    };
+    defer backend.deinit();
+
+    if (!options.compare) {
+        try std.fs.cwd().makePath(TrackCache.directory);
+    }
+
+    var samples: std.ArrayList(i16) = .empty;
+    defer samples.deinit(allocator);
+    var failed = false;
+    for (std.enums.values(AudioTrack)) |track| {
+        samples.clearRetainingCapacity();
+        const loop_start = try renderTrack(allocator, backend, driver, track, options.seconds * options.rate, &samples);
+
+        var name_buffer: [256]u8 = undefined;
+        const name = try TrackCache.fileName(&name_buffer, options.backend, options.game, track);
+        if (options.compare) {
+            const same = compareTrack(allocator, name, options.rate, samples.items, loop_start) catch |err| {
+                std.debug.print("{s}: cannot compare: {}\n", .{ name, err });
+                failed = true;
+                continue;
+            };
+            if (!same) {
+                failed = true;
+            }
+        } else {
+            try writeTrack(name, options.rate, samples.items, loop_start);
+            std.debug.print("{s}: {d} frames", .{ name, samples.items.len / 2 });
+            if (loop_start) |start| {
+                std.debug.print(", loops from {d}", .{start});
+            }
+            std.debug.print("\n", .{});
+        }
+    }
+    if (options.compare) {
+        std.debug.print("{s}\n", .{if (failed) "Some tracks differ" else "All tracks match"});
+    }
+    return if (failed) 1 else 0;
+}
@@ -0,0 +1,370 @@
+//
+// Copyright (C) 2008 - 2024 The OpenTitus team
+//
+// Authors:
+// Eirik Stople
+// Petr Mrázek
+//
+// "Titus the Fox: To Marrakech and Back" (1992) and
+// "Lagaf': Les Aventures de Moktar - Vol 1: La Zoubida" (1991)
+// was developed by, and is probably copyrighted by Titus Software,
+// which, according to Wikipedia, stopped buisness in 2005.
+//
+// OpenTitus is not affiliated with Titus Software.
+//
+// OpenTitus is  free software; you can redistribute  it and/or modify
+// it under the  terms of the GNU General  Public License as published
+// by the Free  Software Foundation; either version 3  of the License,
+// or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+// MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+// General Public License for more details.
+//
+
+
+// Batch mode: runs levels headless, as fast as the machine allows, on a pool of threads.
+// Every run plays one level with an input script, either read from a file or made up from a seed,
+// and the results are summed up per level.
+//
+//   opentitus --batch [--level N]... [--runs N] [--ticks N] [--seed N] [--threads N] [--script FILE]... [--moktar]
+//
+// A script file has one byte per tick, see ScriptInput.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+const data = @import("data.zig");
+const engine = @import("engine.zig");
+const lvl = @import("level.zig");
+const render = @import("render.zig");
+const reset = @import("reset.zig");
+const scroll = @import("scroll.zig");
+const sprites = @import("sprites.zig");
+const sqz = @import("sqz.zig");
+
+const DEFAULT_RUNS = 16;
+// Ten minutes of play
+const DEFAULT_TICKS = 10 * 60 * 34;
+const MAX_SCRIPT_SIZE = 16 * 1024 * 1024;
+
+// Player input for one tick, the fields go from the lowest bit up
+pub const ScriptInput = packed struct(u8) {
+    left: bool = false,
+    right: bool = false,
+    up: bool = false,
+    down: bool = false,
+    action: bool = false,
+    jump: bool = false,
+    crouch: bool = false,
+    aim_up: bool = false,
+
+    fn apply(self: ScriptInput, player: *lvl.Player) void {
+        player.x_axis = @as(i8, @intFromBool(self.right)) - @intFromBool(self.left);
+        player.y_axis = @as(i8, @intFromBool(self.down)) - @intFromBool(self.up);
+        player.action_pressed = self.action;
+        player.jump_pressed = self.jump;
+        player.crouch_pressed = self.crouch;
+        player.aim_direction = if (self.aim_up) .Up else .Forward;
+    }
+};
+
+const Script = union(enum) {
+    file: []const u8,
+    seed: u64,
+};
+
+// Made up input, held for a while like a player would
+const RandomScript = struct {
+    prng: std.Random.DefaultPrng,
+    input: ScriptInput = .{},
+    hold: usize = 0,
+
+    fn next(self: *RandomScript) ScriptInput {
+        if (self.hold == 0) {
+            const random = self.prng.random();
+            self.input = @bitCast(random.int(u8));
+            self.hold = random.intRangeAtMost(usize, 4, 40);
+        }
+        self.hold -= 1;
+        return self.input;
+    }
+};
+
+const Result = struct {
+    failed: bool = false,
+    completed: bool = false,
+    tickcount: usize = 0,
+    bonuscollected: usize = 0,
+    deaths: usize = 0,
+};
+
+const Job = struct {
+    original: *const lvl.Level,
+    script: Script,
+    ticks: usize,
+    allocator: Allocator,
+    result: Result = .{},
+};
+
+fn runJob(job: *Job) void {
+    var level: lvl.Level = undefined;
+    lvl.copylevel(&level, job.original, job.allocator) catch {
+        job.result.failed = true;
+        return;
+    };
+    defer lvl.freecopy(&level, job.allocator);
+
+    // Nothing is drawn, CROSSING_GATE only needs something to pass along
+    var context = render.ScreenContext{};
+
+    var random: RandomScript = undefined;
+    var ticks = job.ticks;
+    switch (job.script) {
+        .file => |bytes| {
+            ticks = @min(ticks, bytes.len);
+        },
+        .seed => |seed| {
+            random = .{ .prng = .init(seed) };
+        },
+    }
+
+    var result = Result{};
+    reset.CLEAR_DATA(&level);
+    scroll.scrollToPlayer(&level);
+    while (level.state.tickcount < ticks) {
+        const input: ScriptInput = switch (job.script) {
+            .file => |bytes| @bitCast(bytes[level.state.tickcount]),
+            .seed => random.next(),
+        };
+        input.apply(&level.state.player);
+        engine.simulate(&context, &level);
+
+        if (level.state.sim.NEWLEVEL_FLAG) {
+            result.completed = true;
+            break;
+        }
+        if (level.state.sim.GAMEOVER_FLAG) {
+            result.deaths += 1;
+            break;
+        }
+        if (level.state.sim.RESETLEVEL_FLAG == 1) {
+            // Lives are not taken, the run goes on until the script or the time runs out
+            result.deaths += 1;
+            reset.CLEAR_DATA(&level);
+            scroll.scrollToPlayer(&level);
+        }
+    }
+    result.tickcount = level.state.tickcount;
+    result.bonuscollected = level.state.bonuscollected;
+    job.result = result;
+}
+
+const Options = struct {
+    levels: std.ArrayList(u16) = .empty,
+    scripts: std.ArrayList([]const u8) = .empty,
+    runs: ?usize = null,
+    ticks: usize = DEFAULT_TICKS,
+    seed: ?u64 = null,
+    threads: ?usize = null,
+    game: data.GameType = .Titus,
+
+    fn parse(self: *Options, allocator: Allocator, args: []const [:0]const u8) !void {
+        var i: usize = 0;
+        while (i < args.len) : (i += 1) {
+            const arg = args[i];
+            if (std.mem.eql(u8, arg, "--moktar")) {
+                self.game = .Moktar;
+                continue;
+            }
+            if (i + 1 == args.len) {
+                std.debug.print("Missing value for {s}\n", .{arg});
+                return error.InvalidArguments;
+            }
+            i += 1;
+            const value = args[i];
+            if (std.mem.eql(u8, arg, "--level")) {
+                try self.levels.append(allocator, try std.fmt.parseInt(u16, value, 10));
+            } else if (std.mem.eql(u8, arg, "--script")) {
+                try self.scripts.append(allocator, value);
+            } else if (std.mem.eql(u8, arg, "--runs")) {
+                self.runs = try std.fmt.parseInt(usize, value, 10);
+            } else if (std.mem.eql(u8, arg, "--ticks")) {
+                self.ticks = try std.fmt.parseInt(usize, value, 10);
+            } else if (std.mem.eql(u8, arg, "--seed")) {
+                self.seed = try std.fmt.parseInt(u64, value, 10);
+            } else if (std.mem.eql(u8, arg, "--threads")) {
+                self.threads = try std.fmt.parseInt(usize, value, 10);
+            } else {
+                std.debug.print("Unknown batch option: {s}\n", .{arg});
+                return error.InvalidArguments;
+            }
+        }
+    }
+
+    fn deinit(self: *Options, allocator: Allocator) void {
+        self.levels.deinit(allocator);
+        self.scripts.deinit(allocator);
+    }
+};
+
+fn loadLevel(level: *lvl.Level, levelnumber: u16, allocator: Allocator) !void {
+    const constants = &data.constants.levelfiles[levelnumber];
+    level.levelnumber = levelnumber;
+    level.is_finish = constants.is_finish;
+    level.has_cage = constants.has_cage;
+    level.boss_power = constants.boss_power;
+    level.music = constants.music;
+    level.headless = true;
+    level.state.sim = .{};
+    level.state.lives = 2;
+    level.state.extrabonus = 0;
+
+    const leveldata = try sqz.unSQZ(constants.filename, allocator);
+    defer allocator.free(leveldata);
+    if (try lvl.loadlevel(level, allocator, leveldata, &data.object_data, @constCast(&constants.color)) < 0) {
+        return error.CannotLoadLevel;
+    }
+}
+
+pub fn run(allocator: Allocator, args: []const [:0]const u8) !u8 {
+    var options = Options{};
+    defer options.deinit(allocator);
+    options.parse(allocator, args) catch {
+        return 1;
+    };
+
+    const available_games = data.probeGameFiles();
+    if (options.game == .Titus and !available_games.titus and available_games.moktar) {
+        options.game = .Moktar;
+    }
+    if ((options.game == .Titus and !available_games.titus) or (options.game == .Moktar and !available_games.moktar)) {
+        std.debug.print("Game data not available\n", .{});
+        return 1;
+    }
+    data.init(options.game);
+    sprites.sprites.initDefinitions();
+
+    const levelfiles = data.constants.levelfiles;
+    if (options.levels.items.len == 0) {
+        for (0..levelfiles.len) |i| {
+            try options.levels.append(allocator, @intCast(i));
+        }
+    }
+    for (options.levels.items) |levelnumber| {
+        if (levelnumber >= levelfiles.len) {
+            std.debug.print("There is no level {d}\n", .{levelnumber});
+            return 1;
+        }
+    }
+
+    var scripts: std.ArrayList([]const u8) = .empty;
+    defer {
+        for (scripts.items) |script| {
+            allocator.free(script);
+        }
+        scripts.deinit(allocator);
+    }
+    for (options.scripts.items) |path| {
+        const script = std.fs.cwd().readFileAlloc(allocator, path, MAX_SCRIPT_SIZE) catch |err| {
+            std.debug.print("Cannot read script {s}: {}\n", .{ path, err });
+            return 1;
+        };
+        try scripts.append(allocator, script);
+    }
+    const runs = options.runs orelse if (scripts.items.len == 0) DEFAULT_RUNS else 0;
+    const seed = options.seed orelse blk: {
+        var random_seed: u64 = undefined;
+        try std.posix.getrandom(std.mem.asBytes(&random_seed));
+        break :blk random_seed;
+    };
+
+    // Every level is loaded once, the runs share its definition
+    const originals = try allocator.alloc(lvl.Level, options.levels.items.len);
+    defer allocator.free(originals);
+    var loaded: usize = 0;
+    defer {
+        for (originals[0..loaded]) |*original| {
+            lvl.freelevel(original, allocator);
+        }
+    }
+    for (options.levels.items, originals) |levelnumber, *original| {
+        loadLevel(original, levelnumber, allocator) catch |err| {
+            std.debug.print("Failed to load level {d}: {}\n", .{ levelnumber, err });
+            return 1;
+        };
+        loaded += 1;
+    }
+
+    var jobs: std.ArrayList(Job) = .empty;
+    defer jobs.deinit(allocator);
+    for (originals) |*original| {
+        // The final level is a cutscene
+        if (original.is_finish) {
+            continue;
+        }
+        for (scripts.items) |script| {
+            try jobs.append(allocator, .{ .original = original, .script = .{ .file = script }, .ticks = options.ticks, .allocator = allocator });
+        }
+        for (0..runs) |i| {
+            try jobs.append(allocator, .{ .original = original, .script = .{ .seed = seed +% i }, .ticks = options.ticks, .allocator = allocator });
+        }
+    }
+
+    const threads = options.threads orelse (std.Thread.getCpuCount() catch 1);
+    std.debug.print("Running {d} jobs on {d} threads, seed {d}\n", .{ jobs.items.len, threads, seed });
+
+    var timer = try std.time.Timer.start();
+    {
+        var pool: std.Thread.Pool = undefined;
+        try pool.init(.{ .allocator = allocator, .n_jobs = threads });
+        defer pool.deinit();
+
+        var wait_group: std.Thread.WaitGroup = .{};
+        for (jobs.items) |*job| {
+            pool.spawnWg(&wait_group, runJob, .{job});
+        }
+        pool.waitAndWork(&wait_group);
+    }
+    const elapsed_ms = timer.read() / std.time.ns_per_ms;
+
+    var failed = false;
+    for (originals) |*original| {
+        var count: usize = 0;
+        var completed: usize = 0;
+        var deaths: usize = 0;
+        var bonus: usize = 0;
+        var ticks_min: usize = std.math.maxInt(usize);
+        var ticks_max: usize = 0;
+        var ticks_sum: usize = 0;
+        for (jobs.items) |*job| {
+            if (job.original != original) {
+                continue;
+            }
+            if (job.result.failed) {
+                failed = true;
+                continue;
+            }
+            count += 1;
+            deaths += job.result.deaths;
+            bonus += job.result.bonuscollected;
+            if (job.result.completed) {
+                completed += 1;
+                ticks_min = @min(ticks_min, job.result.tickcount);
+                ticks_max = @max(ticks_max, job.result.tickcount);
+                ticks_sum += job.result.tickcount;
+            }
+        }
+        if (count == 0) {
+            continue;
+        }
+        std.debug.print("Level {d:>2}: {d} runs, {d} completed", .{ original.levelnumber + 1, count, completed });
+        if (completed > 0) {
+            std.debug.print(" in {d}/{d}/{d} ticks (min/avg/max)", .{ ticks_min, ticks_sum / completed, ticks_max });
+        }
+        std.debug.print(", {d} bonus, {d} deaths\n", .{ bonus, deaths });
+    }
+    std.debug.print("Done in {d} ms\n", .{elapsed_ms});
+    return if (failed) 1 else 0;
+}
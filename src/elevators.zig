@@ -29,11 +29,7 @@ const globals = @import("globals.zig");
 const lvl = @import("level.zig");
 
 pub fn move(level: *lvl.Level) void {
-    for (&level.elevator) |*elevator| {
-        if (!elevator.enabled) {
-            continue;
-        }
-
+    for (level.elevator) |*elevator| {
         // move all elevators
         elevator.sprite.x += elevator.sprite.speed_x;
         elevator.sprite.y += elevator.sprite.speed_y;
@@ -45,10 +41,10 @@ pub fn move(level: *lvl.Level) void {
         }
 
         // if elevators are out of the screen space, turn them invisible
-        if (((elevator.sprite.x + 16 - (globals.BITMAP_X * 16)) >= 0) and // +16: closer to center
-            ((elevator.sprite.x - 16 - (globals.BITMAP_X * 16)) <= globals.screen_width * 16) and // -16: closer to center
-            ((elevator.sprite.y - (globals.BITMAP_Y * 16)) >= 0) and
-            ((elevator.sprite.y - (globals.BITMAP_Y * 16)) - 16 <= globals.screen_height * 16))
+        if (((elevator.sprite.x + 16 - (level.state.sim.BITMAP_X * 16)) >= 0) and // +16: closer to center
+            ((elevator.sprite.x - 16 - (level.state.sim.BITMAP_X * 16)) <= globals.screen_width * 16) and // -16: closer to center
+            ((elevator.sprite.y - (level.state.sim.BITMAP_Y * 16)) >= 0) and
+            ((elevator.sprite.y - (level.state.sim.BITMAP_Y * 16)) - 16 <= globals.screen_height * 16))
         {
             elevator.sprite.invisible = false;
         } else {
@@ -33,14 +33,16 @@
 
 // TODO: side-by-side cleanup with enemies.c
 
+const std = @import("std");
+
 const common = @import("common.zig");
 const objects = @import("objects.zig");
 const sprites = @import("sprites.zig");
 const player = @import("player.zig");
 const globals = @import("globals.zig");
 const lvl = @import("level.zig");
+const spatial = @import("spatial.zig");
 const audio = @import("audio/audio.zig");
-const events = @import("events.zig");
 
 // FIXME: zig changes the type of the result when you call @abs. That's probably correct, but it's annoying. This keeps the type the same.
 pub inline fn abs(a: anytype) @TypeOf(a) {
@@ -94,7 +96,7 @@ fn ai_shoot(level: *lvl.Level, enemy: *lvl.Enemy) void {
     }
     if (enemy.direction == 0) {
         enemySprite.speed_x = 0;
-        if (enemySprite.x < level.player.sprite.x) {
+        if (enemySprite.x < level.state.player.sprite.x) {
             enemySprite.speed_x = -1;
         }
     } else if (enemy.direction == 2) {
@@ -110,23 +112,23 @@ fn ai_shoot(level: *lvl.Level, enemy: *lvl.Enemy) void {
             if (enemy.counter != 0) {
                 return;
             }
-            if (abs(level.player.sprite.y - enemySprite.y) > 24) {
+            if (abs(level.state.player.sprite.y - enemySprite.y) > 24) {
                 return;
             }
             // if too far apart
-            if (enemy.range_x < abs(level.player.sprite.x - enemySprite.x)) {
+            if (enemy.range_x < abs(level.state.player.sprite.x - enemySprite.x)) {
                 return;
             }
             if (enemy.direction != 0) {
                 // Skip shooting if player is in the opposite direction
                 if (enemy.direction == 2) {
                     // Right only
-                    if (enemySprite.x > level.player.sprite.x) {
+                    if (enemySprite.x > level.state.player.sprite.x) {
                         return;
                     }
                 } else {
                     // Left only
-                    if (level.player.sprite.x > enemySprite.x) {
+                    if (level.state.player.sprite.x > enemySprite.x) {
                         return;
                     }
                 }
@@ -173,15 +175,15 @@ fn ai_jumping_fish(level: *lvl.Level, enemy: *lvl.Enemy) void {
                 return;
             }
             // Skip if player is below or >= 256 pixels above
-            if (enemySprite.y < level.player.sprite.y or enemySprite.y >= level.player.sprite.y + 256) {
+            if (enemySprite.y < level.state.player.sprite.y or enemySprite.y >= level.state.player.sprite.y + 256) {
                 return;
             }
             // Skip if player is above jump limit
-            if (enemy.range_y < enemySprite.y - level.player.sprite.y) {
+            if (enemy.range_y < enemySprite.y - level.state.player.sprite.y) {
                 return;
             }
             // see if the hero is in the direction of movement of fish
-            if (enemySprite.x > level.player.sprite.x) {
+            if (enemySprite.x > level.state.player.sprite.x) {
                 // The enemy is right for the player
                 if (enemySprite.flipped) {
                     // The enemy looks right, skip
@@ -195,11 +197,11 @@ fn ai_jumping_fish(level: *lvl.Level, enemy: *lvl.Enemy) void {
                 }
             }
             // Fast calculation
-            if (abs(enemySprite.x - level.player.sprite.x) >= 48) {
+            if (abs(enemySprite.x - level.state.player.sprite.x) >= 48) {
                 return;
             }
             // See if the hero is outside the area of fish
-            if (abs(level.player.sprite.x - enemy.center_x) > enemy.range_x) {
+            if (abs(level.state.player.sprite.x - enemy.center_x) > enemy.range_x) {
                 return;
             }
             enemy.phase = 1; // Change state
@@ -210,7 +212,7 @@ fn ai_jumping_fish(level: *lvl.Level, enemy: *lvl.Enemy) void {
             while (true) {
                 enemySprite.speed_y += 1;
                 j += enemySprite.speed_y;
-                if ((enemySprite.y - level.player.sprite.y) <= j)
+                if ((enemySprite.y - level.state.player.sprite.y) <= j)
                     break;
             }
             // Init speed must be negative
@@ -286,14 +288,14 @@ fn ai_swooping_fly(level: *lvl.Level, enemy: *lvl.Enemy) void {
     switch (enemy.phase) {
         0 => {
             // Forward
-            if (abs(enemySprite.y - level.player.sprite.y) > enemy.range_y) { // Too far away
+            if (abs(enemySprite.y - level.state.player.sprite.y) > enemy.range_y) { // Too far away
                 return;
             }
-            if (abs(enemySprite.x - level.player.sprite.x) > 40) { // Too far away
+            if (abs(enemySprite.x - level.state.player.sprite.x) > 40) { // Too far away
                 return;
             }
             enemy.saved_y = enemySprite.y;
-            if (enemySprite.y < level.player.sprite.y) { // Player is below the enemy
+            if (enemySprite.y < level.state.player.sprite.y) { // Player is below the enemy
                 enemySprite.speed_y = 2;
             } else { // Player is above the enemy
                 enemySprite.speed_y = @as(i16, @bitCast(@as(c_short, @truncate(-2))));
@@ -326,7 +328,7 @@ fn ai_swooping_fly(level: *lvl.Level, enemy: *lvl.Enemy) void {
 }
 
 pub fn moveEnemies(level: *lvl.Level) void {
-    for (&level.enemy) |*enemy| {
+    for (level.enemy) |*enemy| {
         const enemySprite = &enemy.sprite;
         if (!enemySprite.enabled) {
             continue;
@@ -345,18 +347,18 @@ pub fn moveEnemies(level: *lvl.Level) void {
                 }
                 switch (enemy.phase) {
                     0 => {
-                        if (@as(c_int, @bitCast(@as(c_int, enemySprite.y))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.y)))) {
+                        if (@as(c_int, @bitCast(@as(c_int, enemySprite.y))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y)))) {
                             continue;
                         }
-                        if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, enemySprite.x))) - @as(c_int, @bitCast(@as(c_int, level.player.sprite.x))))))) {
+                        if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, enemySprite.x))) - @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))))))) {
                             continue;
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, enemySprite.y))) - @as(c_int, @bitCast(@as(c_int, level.player.sprite.y)))) > 200) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, enemySprite.y))) - @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y)))) > 200) {
                             continue;
                         }
                         enemy.phase = 1;
                         UP_ANIMATION(enemySprite);
-                        if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                        if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                         } else {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
@@ -371,7 +373,7 @@ pub fn moveEnemies(level: *lvl.Level) void {
                             continue;
                         }
                         if (@as(c_int, @bitCast(@as(c_int, enemySprite.speed_y))) != 0) {
-                            if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                            if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                                 enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                             } else {
                                 enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
@@ -393,25 +395,25 @@ pub fn moveEnemies(level: *lvl.Level) void {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_int, enemySprite.speed_x)))))));
                             enemySprite.x -= @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, enemySprite.speed_x)))))));
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) > (320 * 2)) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) > (320 * 2)) {
                             enemy.phase = 2;
                             continue;
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) >= (200 * 2)) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) >= (200 * 2)) {
                             enemy.phase = 2;
                             continue;
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) > (@as(c_int, @bitCast(@as(c_uint, enemySprite.spritedata.?.width))) + 6)) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) > (@as(c_int, @bitCast(@as(c_uint, enemySprite.spritedata.?.width))) + 6)) {
                             continue;
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) > 8) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) > 8) {
                             continue;
                         }
                         enemy.phase = 3;
                         UP_ANIMATION(enemySprite);
                     },
                     2 => {
-                        if ((((((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_Y)))) <= 13) and (((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_Y)))) >= 0)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_X)))) < 21)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_X)))) >= 0)) {
+                        if ((((((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_Y)))) <= 13) and (((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_Y)))) >= 0)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_X)))) < 21)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_X)))) >= 0)) {
                             continue;
                         }
                         enemySprite.y = @as(i16, @bitCast(@as(c_short, @truncate(enemy.init_y))));
@@ -434,7 +436,7 @@ pub fn moveEnemies(level: *lvl.Level) void {
                             continue;
                         }
                         if (@as(c_int, @bitCast(@as(c_int, enemySprite.speed_y))) != 0) {
-                            if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                            if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                                 enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                             } else {
                                 enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
@@ -456,11 +458,11 @@ pub fn moveEnemies(level: *lvl.Level) void {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_int, enemySprite.speed_x)))))));
                             enemySprite.x -= @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, enemySprite.speed_x)))))));
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) > (320 * 2)) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) > (320 * 2)) {
                             enemy.phase = 2;
                             continue;
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) >= (200 * 2)) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) >= (200 * 2)) {
                             enemy.phase = 2;
                             continue;
                         }
@@ -479,10 +481,10 @@ pub fn moveEnemies(level: *lvl.Level) void {
                 }
                 switch (@as(c_int, @bitCast(@as(c_uint, enemy.phase)))) {
                     0 => {
-                        if ((abs(@as(c_int, @bitCast(@as(c_int, enemySprite.x))) - @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) > 340) or (abs(@as(c_int, @bitCast(@as(c_int, enemySprite.y))) - @as(c_int, @bitCast(@as(c_int, level.player.sprite.y)))) >= 230)) {
+                        if ((abs(@as(c_int, @bitCast(@as(c_int, enemySprite.x))) - @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) > 340) or (abs(@as(c_int, @bitCast(@as(c_int, enemySprite.y))) - @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y)))) >= 230)) {
                             enemy.phase = 1;
                             UP_ANIMATION(enemySprite);
-                            if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                            if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                                 enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                             } else {
                                 enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
@@ -498,7 +500,7 @@ pub fn moveEnemies(level: *lvl.Level) void {
                             continue;
                         }
                         if (@as(c_int, @bitCast(@as(c_int, enemySprite.speed_y))) != 0) {
-                            if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                            if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                                 enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                             } else {
                                 enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
@@ -521,13 +523,13 @@ pub fn moveEnemies(level: *lvl.Level) void {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_int, enemySprite.speed_x)))))));
                             enemySprite.x -= @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, enemySprite.speed_x)))))));
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) < (320 * 2)) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) < (320 * 2)) {
                             continue;
                         }
                         enemy.phase = 2;
                     },
                     2 => {
-                        if ((((((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_Y)))) < 12) and (((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_Y)))) >= 0)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_X)))) < 19)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_X)))) >= 0)) {
+                        if ((((((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_Y)))) < 12) and (((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_Y)))) >= 0)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_X)))) < 19)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_X)))) >= 0)) {
                             continue;
                         }
                         enemySprite.y = @as(i16, @bitCast(@as(c_short, @truncate(enemy.init_y))));
@@ -546,40 +548,40 @@ pub fn moveEnemies(level: *lvl.Level) void {
                 }
                 switch (@as(c_int, @bitCast(@as(c_uint, enemy.phase)))) {
                     0 => {
-                        if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) {
+                        if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) {
                             continue;
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) > 60) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) > 60) {
                             continue;
                         }
                         enemy.phase = 1;
                         UP_ANIMATION(enemySprite);
-                        if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                        if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                         } else {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
                         }
                     },
                     1 => {
-                        globals.TAUPE_FLAG +%= 1;
-                        if (((@as(c_int, @bitCast(@as(c_uint, globals.TAUPE_FLAG))) & 4) == 0) and ((@as(c_int, @bitCast(@as(c_uint, globals.IMAGE_COUNTER))) & 511) == 0)) {
+                        level.state.sim.TAUPE_FLAG +%= 1;
+                        if (((@as(c_int, @bitCast(@as(c_uint, level.state.sim.TAUPE_FLAG))) & 4) == 0) and ((@as(c_int, @bitCast(@as(c_uint, level.state.sim.IMAGE_COUNTER))) & 511) == 0)) {
                             UP_ANIMATION(enemySprite);
                         }
-                        if ((@as(c_int, @bitCast(@as(c_uint, globals.IMAGE_COUNTER))) & 127) == 0) {
+                        if ((@as(c_int, @bitCast(@as(c_uint, level.state.sim.IMAGE_COUNTER))) & 127) == 0) {
                             enemy.phase = 3;
                             UP_ANIMATION(enemySprite);
                             if (!enemy.visible) {
                                 UP_ANIMATION(enemySprite);
                                 enemySprite.animation -= 1;
                                 GAL_FORM(level, enemy);
-                                if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                                if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                                     enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                                 } else {
                                     enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
                                 }
                                 enemy.phase = 1;
                             } else if (enemy.trigger) {
-                                if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                                if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                                     enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                                 } else {
                                     enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
@@ -610,13 +612,13 @@ pub fn moveEnemies(level: *lvl.Level) void {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_int, enemySprite.speed_x)))))));
                             enemySprite.x -= @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, enemySprite.speed_x)))))));
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) < (320 * 4)) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) < (320 * 4)) {
                             continue;
                         }
                         enemy.phase = 2;
                     },
                     2 => {
-                        if ((((((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_Y)))) <= 12) and (((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_Y)))) >= 0)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_X)))) < 25)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_X)))) >= 0)) {
+                        if ((((((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_Y)))) <= 12) and (((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_Y)))) >= 0)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_X)))) < 25)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_X)))) >= 0)) {
                             continue;
                         }
                         enemySprite.y = @as(i16, @bitCast(@as(c_short, @truncate(enemy.init_y))));
@@ -629,14 +631,14 @@ pub fn moveEnemies(level: *lvl.Level) void {
                             UP_ANIMATION(enemySprite);
                             enemySprite.animation -= 1;
                             GAL_FORM(level, enemy);
-                            if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                            if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                                 enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                             } else {
                                 enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
                             }
                             enemy.phase = 1;
                         } else if (enemy.trigger) {
-                            if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                            if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                                 enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                             } else {
                                 enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
@@ -655,46 +657,46 @@ pub fn moveEnemies(level: *lvl.Level) void {
                 }
                 switch (@as(c_int, @bitCast(@as(c_uint, enemy.phase)))) {
                     0 => {
-                        if (@as(c_int, @bitCast(@as(c_uint, globals.FURTIF_FLAG))) != 0) {
+                        if (@as(c_int, @bitCast(@as(c_uint, level.state.sim.FURTIF_FLAG))) != 0) {
                             continue;
                         }
-                        if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) {
+                        if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) {
                             continue;
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) > 26) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) > 26) {
                             continue;
                         }
                         enemy.phase = 1;
                         UP_ANIMATION(enemySprite);
-                        if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                        if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                         } else {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
                         }
-                        if (@as(c_int, @bitCast(@as(c_uint, globals.FURTIF_FLAG))) != 0) {
+                        if (@as(c_int, @bitCast(@as(c_uint, level.state.sim.FURTIF_FLAG))) != 0) {
                             continue;
                         }
-                        if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) {
+                        if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) {
                             DOWN_ANIMATION(enemySprite);
                             enemy.phase = 0;
                             continue;
                         }
-                        if (((enemy.range_x -% @as(c_uint, 50)) >= @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) and (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) <= 60)) {
+                        if (((enemy.range_x -% @as(c_uint, 50)) >= @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) and (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) <= 60)) {
                             enemy.phase = 2;
                             UP_ANIMATION(enemySprite);
                         }
                     },
                     1 => {
                         // wait
-                        if (@as(c_int, @bitCast(@as(c_uint, globals.FURTIF_FLAG))) != 0) {
+                        if (@as(c_int, @bitCast(@as(c_uint, level.state.sim.FURTIF_FLAG))) != 0) {
                             continue;
                         }
-                        if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) {
+                        if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) {
                             DOWN_ANIMATION(enemySprite);
                             enemy.phase = 0;
                             continue;
                         }
-                        if (((enemy.range_x -% @as(c_uint, 50)) >= @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) and (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) <= 60)) {
+                        if (((enemy.range_x -% @as(c_uint, 50)) >= @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) and (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) <= 60)) {
                             enemy.phase = 2;
                             UP_ANIMATION(enemySprite);
                         }
@@ -726,12 +728,12 @@ pub fn moveEnemies(level: *lvl.Level) void {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_int, enemySprite.speed_x)))))));
                             enemySprite.x -= @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, enemySprite.speed_x)))))));
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) >= (320 * 2)) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) >= (320 * 2)) {
                             enemy.phase = 3;
                         }
                     },
                     3 => {
-                        if ((((((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_Y)))) <= 13) and (((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_Y)))) >= 0)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_X)))) < 21)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_X)))) >= 0)) {
+                        if ((((((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_Y)))) <= 13) and (((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_Y)))) >= 0)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_X)))) < 21)) and (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_X)))) >= 0)) {
                             continue;
                         }
                         enemySprite.y = @as(i16, @bitCast(@as(c_short, @truncate(enemy.init_y))));
@@ -751,15 +753,15 @@ pub fn moveEnemies(level: *lvl.Level) void {
                 }
                 switch (@as(c_int, @bitCast(@as(c_uint, enemy.phase)))) {
                     0 => {
-                        if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) {
+                        if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x))))))) {
                             continue;
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) > 26) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) > 26) {
                             continue;
                         }
                         enemy.phase = 1;
                         UP_ANIMATION(enemySprite);
-                        if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                        if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                         } else {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
@@ -782,20 +784,20 @@ pub fn moveEnemies(level: *lvl.Level) void {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_int, enemySprite.speed_x)))))));
                             enemySprite.x -= @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, enemySprite.speed_x)))))));
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) >= (320 * 2)) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) >= (320 * 2)) {
                             enemy.phase = 2;
                         }
                         common.subto0(&enemy.counter);
                         if (@as(c_int, @bitCast(@as(c_uint, enemy.counter))) != 0) {
                             continue;
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) > 64) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) > 64) {
                             continue;
                         }
-                        if (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) > 20) {
+                        if (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) > 20) {
                             continue;
                         }
-                        if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.player.sprite.x)))) {
+                        if (@as(c_int, @bitCast(@as(c_int, enemySprite.x))) > @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x)))) {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_ushort, enemy.walkspeed_x)));
                         } else {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_uint, enemy.walkspeed_x)))))));
@@ -805,7 +807,7 @@ pub fn moveEnemies(level: *lvl.Level) void {
                         enemy.counter = 20;
                     },
                     2 => {
-                        if ((((((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_Y)))) > 13) or (((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_Y)))) < 0)) or (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_X)))) >= 21)) or (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, globals.BITMAP_X)))) < 0)) {
+                        if ((((((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_Y)))) > 13) or (((enemy.init_y >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_Y)))) < 0)) or (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_X)))) >= 21)) or (((enemy.init_x >> @intCast(4)) - @as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_X)))) < 0)) {
                             enemySprite.x = @as(i16, @bitCast(@as(c_short, @truncate(enemy.init_x))));
                             enemySprite.y = @as(i16, @bitCast(@as(c_short, @truncate(enemy.init_y))));
                             DOWN_ANIMATION(enemySprite);
@@ -870,12 +872,12 @@ pub fn moveEnemies(level: *lvl.Level) void {
                 }
                 switch (@as(c_int, @bitCast(@as(c_uint, enemy.phase)))) {
                     0 => {
-                        if (@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) >= @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) {
+                        if (@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) >= @as(c_int, @bitCast(@as(c_int, enemySprite.x)))) {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - abs(@as(c_int, @bitCast(@as(c_int, enemySprite.speed_x))))))));
                         } else {
                             enemySprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(abs(@as(c_int, @bitCast(@as(c_int, enemySprite.speed_x))))))));
                         }
-                        if ((@as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))))) <= enemy.range_x) and (abs(@as(c_int, @bitCast(@as(c_int, level.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) <= 40)) {
+                        if ((@as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))) - @as(c_int, @bitCast(@as(c_int, enemySprite.x)))))) <= enemy.range_x) and (abs(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))) <= 40)) {
                             UP_ANIMATION(enemySprite);
                             enemy.phase = 1;
                             enemySprite.speed_y = 10;
@@ -930,31 +932,29 @@ pub fn moveEnemies(level: *lvl.Level) void {
                     enemy.counter +%= 1;
                     continue;
                 }
-                if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, enemySprite.x))) - @as(c_int, @bitCast(@as(c_int, level.player.sprite.x))))))) {
+                if (enemy.range_x < @as(c_uint, @bitCast(abs(@as(c_int, @bitCast(@as(c_int, enemySprite.x))) - @as(c_int, @bitCast(@as(c_int, level.state.player.sprite.x))))))) {
                     enemy.counter = 0;
                     continue;
                 }
-                if (enemy.range_y < @as(c_uint, @bitCast(@as(c_int, @bitCast(@as(c_int, level.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))))) {
+                if (enemy.range_y < @as(c_uint, @bitCast(@as(c_int, @bitCast(@as(c_int, level.state.player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, enemySprite.y)))))) {
                     continue;
                 }
-                var j: c_uint = 0;
-                while (true) {
-                    j += 1;
-                    if (j > 40) {
-                        enemy.counter = 0;
-                        continue;
-                    }
-                    if (!(@as(c_int, @intFromBool(level.object[@as(c_uint, @intCast(j))].sprite.enabled)) == 1)) break;
-                }
+                // Drop into a free object slot, the first one is never used for this
+                const dropped_index = level.state.object.claim(1) orelse {
+                    enemy.counter = 0;
+                    continue;
+                };
+                const dropped = &level.object[dropped_index];
                 UP_ANIMATION(enemySprite);
-                objects.updateobjectsprite(level, &level.object[@as(c_uint, @intCast(j))], @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, enemySprite.animation.*))) & 0x1FFF)))), true);
-                level.object[@as(c_uint, @intCast(j))].sprite.flipped = true;
-                level.object[@as(c_uint, @intCast(j))].sprite.x = enemySprite.x;
-                level.object[@as(c_uint, @intCast(j))].sprite.y = enemySprite.y;
-                level.object[@as(c_uint, @intCast(j))].sprite.droptobottom = true;
-                level.object[@as(c_uint, @intCast(j))].sprite.killing = true;
-                level.object[@as(c_uint, @intCast(j))].sprite.speed_y = 0;
-                globals.GRAVITY_FLAG = 4;
+                objects.updateobjectsprite(level, dropped, @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, enemySprite.animation.*))) & 0x1FFF)))), true);
+                dropped.sprite.flipped = true;
+                dropped.sprite.x = enemySprite.x;
+                dropped.sprite.y = enemySprite.y;
+                dropped.sprite.droptobottom = true;
+                dropped.sprite.killing = true;
+                dropped.sprite.speed_y = 0;
+                spatial.grid.update(.{ .kind = .Object, .index = dropped_index }, &dropped.sprite);
+                level.state.sim.GRAVITY_FLAG = 4;
                 DOWN_ANIMATION(enemySprite);
                 enemy.counter = 0;
             },
@@ -964,8 +964,8 @@ pub fn moveEnemies(level: *lvl.Level) void {
                     DEAD1(level, enemy);
                     continue;
                 }
-                if (abs(enemy.init_x - level.player.sprite.x) > enemy.range_x or
-                    abs(enemy.init_y - level.player.sprite.y) > enemy.range_y)
+                if (abs(enemy.init_x - level.state.player.sprite.x) > enemy.range_x or
+                    abs(enemy.init_y - level.state.player.sprite.y) > enemy.range_y)
                 {
                     // The player is too far away, move enemy to center
                     if (enemy.init_x != enemySprite.x) {
@@ -984,15 +984,15 @@ pub fn moveEnemies(level: *lvl.Level) void {
                     }
                 } else {
                     // The player is inside the guarded area, move enemy to player
-                    if (level.player.sprite.x != enemySprite.x) {
+                    if (level.state.player.sprite.x != enemySprite.x) {
                         enemySprite.speed_x = abs(enemySprite.speed_x);
-                        if (level.player.sprite.x > enemySprite.x) {
+                        if (level.state.player.sprite.x > enemySprite.x) {
                             enemySprite.speed_x = 0 - enemySprite.speed_x;
                         }
                         enemySprite.x -= enemySprite.speed_x;
                     }
-                    if (level.player.sprite.y != enemySprite.y) {
-                        if (level.player.sprite.y > enemySprite.y) {
+                    if (level.state.player.sprite.y != enemySprite.y) {
+                        if (level.state.player.sprite.y > enemySprite.y) {
                             enemySprite.y += enemySprite.speed_y;
                         } else {
                             enemySprite.y -= enemySprite.speed_y;
@@ -1014,8 +1014,8 @@ fn DEAD1(level: *lvl.Level, enemy: *lvl.Enemy) void {
         }
         if (enemy.phase != 0xFF) {
             enemy.sprite.y += enemy.sprite.speed_y;
-            if (globals.SEECHOC_FLAG != 0) {
-                level.player.sprite2.y += enemy.sprite.speed_y;
+            if (level.state.sim.SEECHOC_FLAG != 0) {
+                level.state.player.sprite2.y += enemy.sprite.speed_y;
             }
             if (enemy.sprite.speed_y < globals.MAX_SPEED_DEAD) {
                 enemy.sprite.speed_y += 1;
@@ -1090,14 +1090,22 @@ pub fn SET_NMI(level: *lvl.Level) void {
     _ = &k;
     var hit: i16 = undefined;
     _ = &hit;
-    for (&level.enemy) |*enemy| {
+    var moving_buffer: [lvl.OBJECT_CAPACITY]u8 = undefined;
+    const moving = movingObjects(level.object, &moving_buffer);
+    // Enemies far away from the screen are never on it, they only need to be looked at when they leave it
+    var iter = spatial.visible_sprites.iterator(.reverse);
+    while (iter.next()) |ref| {
+        if (ref.kind != .Enemy) {
+            continue;
+        }
+        const enemy = &level.enemy[ref.index];
         // Skip unused enemies
         if (!enemy.sprite.enabled)
             continue;
         enemy.visible = false;
 
         // Is the enemy on the screen?
-        if (((((@as(c_int, @bitCast(@as(c_int, enemy.sprite.x))) + 32) < (@as(c_int, @bitCast(@as(c_int, globals.BITMAP_X))) << @intCast(4))) or ((@as(c_int, @bitCast(@as(c_int, enemy.sprite.x))) - 32) > ((@as(c_int, @bitCast(@as(c_int, globals.BITMAP_X))) << @intCast(4)) + (20 * 16)))) or (@as(c_int, @bitCast(@as(c_int, enemy.sprite.y))) < (@as(c_int, @bitCast(@as(c_int, globals.BITMAP_Y))) << @intCast(4)))) or ((@as(c_int, @bitCast(@as(c_int, enemy.sprite.y))) - 32) > ((@as(c_int, @bitCast(@as(c_int, globals.BITMAP_Y))) << @intCast(4)) + (12 * 16)))) {
+        if (((((@as(c_int, @bitCast(@as(c_int, enemy.sprite.x))) + 32) < (@as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_X))) << @intCast(4))) or ((@as(c_int, @bitCast(@as(c_int, enemy.sprite.x))) - 32) > ((@as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_X))) << @intCast(4)) + (20 * 16)))) or (@as(c_int, @bitCast(@as(c_int, enemy.sprite.y))) < (@as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_Y))) << @intCast(4)))) or ((@as(c_int, @bitCast(@as(c_int, enemy.sprite.y))) - 32) > ((@as(c_int, @bitCast(@as(c_int, level.state.sim.BITMAP_Y))) << @intCast(4)) + (12 * 16)))) {
             if ((enemy.dying & 3) != 0) {
                 enemy.sprite.enabled = false;
             }
@@ -1110,37 +1118,23 @@ pub fn SET_NMI(level: *lvl.Level) void {
             // If the enemy is dying or dead and not on the screen, remove from the list!
             continue;
         }
-        if (globals.KICK_FLAG == 0 and level.player.sprite.invincibility_frames == 0 and !globals.GODMODE) {
+        if (level.state.sim.KICK_FLAG == 0 and level.state.player.sprite.invincibility_frames == 0 and !globals.GODMODE) {
             if (enemy.sprite.invisible) {
                 continue;
             }
             ACTIONC_NMI(level, enemy);
         }
         hit = 0;
-        if (globals.GRAVITY_FLAG != 0) {
-            k = 0;
-            while (@as(c_int, @bitCast(@as(c_int, k))) < lvl.OBJECT_CAPACITY) : (k += 1) {
-                if (@as(c_int, @bitCast(@as(c_int, level.object[@as(c_ushort, @intCast(k))].sprite.speed_x))) == 0) {
-                    if (@as(c_int, @bitCast(@as(c_int, level.object[@as(c_ushort, @intCast(k))].sprite.speed_y))) == 0) {
-                        continue;
-                    }
-                    if (@as(c_int, @bitCast(@as(c_uint, level.object[@as(c_ushort, @intCast(k))].momentum))) < 10) {
-                        continue;
-                    }
-                }
-                if (level.object[@as(c_ushort, @intCast(k))].objectdata.no_damage) {
-                    continue;
-                }
-                if (NMI_VS_DROP(&enemy.sprite, &level.object[@as(c_ushort, @intCast(k))].sprite)) {
-                    hit = 1;
-                    break;
-                }
+        if (level.state.sim.GRAVITY_FLAG != 0) {
+            if (hittingObject(&enemy.sprite, level.object, moving)) |index| {
+                k = index;
+                hit = 1;
             }
         }
-        if ((((@as(c_int, @bitCast(@as(c_int, hit))) == 0) and (@as(c_int, @intFromBool(globals.DROP_FLAG)) != 0)) and (@as(c_int, @intFromBool(globals.CARRY_FLAG)) == 0)) and (@as(c_int, @intFromBool(level.player.sprite2.enabled)) != 0)) {
-            if (NMI_VS_DROP(&enemy.sprite, &level.player.sprite2)) {
-                globals.INVULNERABLE_FLAG = 0;
-                level.player.sprite2.enabled = false;
+        if ((((@as(c_int, @bitCast(@as(c_int, hit))) == 0) and (@as(c_int, @intFromBool(level.state.sim.DROP_FLAG)) != 0)) and (@as(c_int, @intFromBool(level.state.sim.CARRY_FLAG)) == 0)) and (@as(c_int, @intFromBool(level.state.player.sprite2.enabled)) != 0)) {
+            if (NMI_VS_DROP(&enemy.sprite, &level.state.player.sprite2)) {
+                level.state.sim.INVULNERABLE_FLAG = 0;
+                level.state.player.sprite2.enabled = false;
                 SEE_CHOC(level);
                 hit = 2;
             }
@@ -1151,19 +1145,19 @@ pub fn SET_NMI(level: *lvl.Level) void {
                     level.object[@as(c_ushort, @intCast(k))].sprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(0 - @as(c_int, @bitCast(@as(c_int, level.object[@as(c_ushort, @intCast(k))].sprite.speed_x)))))));
                 }
             }
-            events.triggerEvent(.HitEnemy);
-            globals.DROP_FLAG = false;
+            level.triggerEvent(.HitEnemy);
+            level.state.sim.DROP_FLAG = false;
             if (enemy.boss) {
-                if (@as(c_int, @bitCast(@as(c_uint, globals.INVULNERABLE_FLAG))) != 0) {
+                if (@as(c_int, @bitCast(@as(c_uint, level.state.sim.INVULNERABLE_FLAG))) != 0) {
                     continue;
                 }
-                globals.INVULNERABLE_FLAG = 10;
+                level.state.sim.INVULNERABLE_FLAG = 10;
                 enemy.sprite.flash = true;
-                globals.boss_lives -%= 1;
-                if (@as(c_int, @bitCast(@as(c_uint, globals.boss_lives))) != 0) {
+                level.state.sim.boss_lives -%= 1;
+                if (@as(c_int, @bitCast(@as(c_uint, level.state.sim.boss_lives))) != 0) {
                     continue;
                 }
-                globals.boss_alive = false;
+                level.state.sim.boss_alive = false;
             }
             enemy.dying = @as(u8, @bitCast(@as(i8, @truncate(@as(c_int, @bitCast(@as(c_uint, enemy.dying))) | 2))));
         }
@@ -1202,7 +1196,7 @@ fn GAL_FORM(level: *lvl.Level, enemy: *lvl.Enemy) void {
 fn ACTIONC_NMI(level: *lvl.Level, enemy: *lvl.Enemy) void {
     switch (enemy.type) {
         0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 18 => {
-            if (NMI_VS_DROP(&enemy.sprite, &level.player.sprite)) {
+            if (NMI_VS_DROP(&enemy.sprite, &level.state.player.sprite)) {
                 if (enemy.type != 11) { // Walk and shoot
                     if (enemy.sprite.number != 178) { // Periscope
                         enemy.sprite.speed_x = -enemy.sprite.speed_x;
@@ -1211,7 +1205,7 @@ fn ACTIONC_NMI(level: *lvl.Level, enemy: *lvl.Enemy) void {
 
                 // Fireball
                 if (enemy.sprite.number >= (globals.FIRST_NMI + 53) and enemy.sprite.number <= (globals.FIRST_NMI + 55)) {
-                    globals.GRANDBRULE_FLAG = true;
+                    level.state.sim.GRANDBRULE_FLAG = true;
                 }
                 if (enemy.power != 0) {
                     KICK_ASH(level, &enemy.sprite, enemy.power);
@@ -1223,17 +1217,17 @@ fn ACTIONC_NMI(level: *lvl.Level, enemy: *lvl.Enemy) void {
 }
 
 fn KICK_ASH(level: *lvl.Level, enemysprite: *lvl.Sprite, power: i16) void {
-    events.triggerEvent(.HitPlayer);
-    const p_sprite = &level.player.sprite;
+    level.triggerEvent(.HitPlayer);
+    const p_sprite = &level.state.player.sprite;
 
     // about 2 seconds worth of invulnereability frames
     p_sprite.invincibility_frames = 69;
 
     player.DEC_ENERGY(level);
     player.DEC_ENERGY(level);
-    globals.KICK_FLAG = 24;
-    globals.CHOC_FLAG = 0;
-    globals.LAST_ORDER = .Rest;
+    level.state.sim.KICK_FLAG = 24;
+    level.state.sim.CHOC_FLAG = 0;
+    level.state.sim.LAST_ORDER = .Rest;
     p_sprite.speed_x = power;
 
     if (@as(c_int, @bitCast(@as(c_int, p_sprite.x))) <= @as(c_int, @bitCast(@as(c_int, enemysprite.x)))) {
@@ -1243,6 +1237,69 @@ fn KICK_ASH(level: *lvl.Level, enemysprite: *lvl.Sprite, power: i16) void {
     _ = player.player_drop_carried(level);
 }
 
+// Objects that can hurt an enemy, in slot order. Like the original, every slot is looked at, also the
+// disabled ones and the ones thrown earlier in this tick, so this does not come from the sprite grid.
+fn movingObjects(object_list: []const lvl.Object, out: *[lvl.OBJECT_CAPACITY]u8) []const u8 {
+    var count: usize = 0;
+    for (object_list, 0..) |*object, i| {
+        if (object.sprite.speed_x == 0) {
+            if (object.sprite.speed_y == 0 or object.momentum < 10) {
+                continue;
+            }
+        }
+        if (object.objectdata.no_damage) {
+            continue;
+        }
+        out[count] = @intCast(i);
+        count += 1;
+    }
+    return out[0..count];
+}
+
+// The first of the moving objects that hits the enemy
+fn hittingObject(enemysprite: *lvl.Sprite, object_list: []lvl.Object, moving: []const u8) ?u8 {
+    for (moving) |index| {
+        if (NMI_VS_DROP(enemysprite, &object_list[index].sprite)) {
+            return index;
+        }
+    }
+    return null;
+}
+
+test "a thrown object hits an enemy in the tick it is thrown" {
+    const spritedata: lvl.SpriteData = .{ .height = 16, .width = 16, .collheight = 16, .collwidth = 16, .refheight = 16, .refwidth = 8 };
+    var objectdata: lvl.ObjectData = .{};
+    var objects_list: [2]lvl.Object = undefined;
+    for (&objects_list) |*object| {
+        object.* = .{
+            .sprite = .{},
+            .momentum = 0,
+            .init_enabled = false,
+            .init_sprite = 0,
+            .init_flash = false,
+            .init_visible = false,
+            .init_flipped = false,
+            .init_x = 0,
+            .init_y = 0,
+            .objectdata = &objectdata,
+        };
+    }
+    var enemy_sprite: lvl.Sprite = .{ .x = 100, .y = 100, .enabled = true, .spritedata = &spritedata };
+    var buffer: [lvl.OBJECT_CAPACITY]u8 = undefined;
+    try std.testing.expect(hittingObject(&enemy_sprite, &objects_list, movingObjects(&objects_list, &buffer)) == null);
+
+    // Dropped into a free slot and thrown after the sprite grid was built for this tick
+    objects_list[1].sprite = .{ .x = 104, .y = 100, .speed_x = 3 * 16, .enabled = true, .spritedata = &spritedata };
+    try std.testing.expectEqual(@as(?u8, 1), hittingObject(&enemy_sprite, &objects_list, movingObjects(&objects_list, &buffer)));
+
+    // Falling objects only hurt once they are fast enough
+    objects_list[1].sprite.speed_x = 0;
+    objects_list[1].sprite.speed_y = 4 * 16;
+    try std.testing.expect(hittingObject(&enemy_sprite, &objects_list, movingObjects(&objects_list, &buffer)) == null);
+    objects_list[1].momentum = 10;
+    try std.testing.expectEqual(@as(?u8, 1), hittingObject(&enemy_sprite, &objects_list, movingObjects(&objects_list, &buffer)));
+}
+
 fn NMI_VS_DROP(enemysprite: *lvl.Sprite, sprite: *lvl.Sprite) bool {
     if (abs(sprite.x - enemysprite.x) >= 64) {
         return false;
@@ -1275,19 +1332,19 @@ fn NMI_VS_DROP(enemysprite: *lvl.Sprite, sprite: *lvl.Sprite) bool {
 }
 
 pub fn SEE_CHOC(level: *lvl.Level) void {
-    sprites.updatesprite(level, &level.player.sprite2, globals.FIRST_OBJET + 15, true); // Hit (a throw hits an enemy)
-    level.player.sprite2.speed_x = 0;
-    level.player.sprite2.speed_y = 0;
-    globals.SEECHOC_FLAG = 5;
+    sprites.updatesprite(level, &level.state.player.sprite2, globals.FIRST_OBJET + 15, true); // Hit (a throw hits an enemy)
+    level.state.player.sprite2.speed_x = 0;
+    level.state.player.sprite2.speed_y = 0;
+    level.state.sim.SEECHOC_FLAG = 5;
 }
 
 pub fn moveTrash(level: *lvl.Level) void {
-    for (&level.trash) |*trash| {
+    for (&level.state.trash) |*trash| {
         if (!trash.enabled)
             continue;
         if (trash.speed_x != 0) {
             trash.x += trash.speed_x >> 4;
-            const trash_screen_x = (trash.x >> 4) - globals.BITMAP_X;
+            const trash_screen_x = (trash.x >> 4) - level.state.sim.BITMAP_X;
             if (trash_screen_x < 0 or trash_screen_x > globals.screen_width) {
                 trash.enabled = false;
                 continue;
@@ -1297,7 +1354,7 @@ pub fn moveTrash(level: *lvl.Level) void {
             // But it might just be how the game is 'supposed to' work.
             if (trash_screen_x != 0) { // Bug in the code
                 trash.y += trash.speed_y >> 4;
-                const trash_screen_y = (trash.y >> 4) - globals.BITMAP_Y;
+                const trash_screen_y = (trash.y >> 4) - level.state.sim.BITMAP_Y;
                 if (trash_screen_y < 0 or trash_screen_y > globals.screen_height * 16) { // Bug?
                     trash.enabled = false;
                     continue;
@@ -1306,7 +1363,7 @@ pub fn moveTrash(level: *lvl.Level) void {
         }
 
         // Trash vs player
-        if (!globals.GODMODE and level.player.sprite.invincibility_frames == 0 and NMI_VS_DROP(trash, &level.player.sprite)) {
+        if (!globals.GODMODE and level.state.player.sprite.invincibility_frames == 0 and NMI_VS_DROP(trash, &level.state.player.sprite)) {
             trash.x -= trash.speed_x;
             KICK_ASH(level, trash, 70);
             trash.enabled = false;
@@ -1316,7 +1373,7 @@ pub fn moveTrash(level: *lvl.Level) void {
 }
 
 fn FIND_TRASH(level: *lvl.Level) ?*lvl.Sprite {
-    for (&level.trash) |*trash| {
+    for (&level.state.trash) |*trash| {
         if (!trash.enabled) {
             return trash;
         }
@@ -1328,7 +1385,7 @@ fn PUT_BULLET(level: *lvl.Level, enemy: *lvl.Enemy, bullet: *lvl.Sprite) void {
     bullet.x = enemy.sprite.x;
     bullet.y = enemy.sprite.y - ((enemy.sprite.animation - 1).* & 0x00FF);
     sprites.updatesprite(level, bullet, ((enemy.sprite.animation - 2).* & 0x1FFF) + globals.FIRST_OBJET, true);
-    if (enemy.sprite.x < level.player.sprite.x) {
+    if (enemy.sprite.x < level.state.player.sprite.x) {
         bullet.speed_x = 16 * 11;
         bullet.flipped = true;
     } else {
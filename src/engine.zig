@@ -44,6 +44,8 @@ const reset = @import("reset.zig");
 const gates = @import("gates.zig");
 const lvl = @import("level.zig");
 const player = @import("player.zig");
+const rewind = @import("rewind.zig");
+const spatial = @import("spatial.zig");
 
 const input = @import("input.zig");
 
@@ -57,10 +59,12 @@ pub fn playtitus(firstlevel: u16, allocator: std.mem.Allocator) !c_int {
     var retval: c_int = 0;
 
     var level: lvl.Level = undefined;
+    level.headless = false;
+    level.state.sim = .{};
 
     // FIXME: this is persistent between levels... do not store it in the level
-    level.lives = 2;
-    level.extrabonus = 0;
+    level.state.lives = 2;
+    level.state.extrabonus = 0;
 
     const spritedata = sqz.unSQZ(data.constants.*.sprites, allocator) catch {
         std.debug.print("Failed to uncompress sprites file: {s}\n", .{data.constants.*.sprites});
@@ -84,6 +88,18 @@ pub fn playtitus(firstlevel: u16, allocator: std.mem.Allocator) !c_int {
     };
     defer sprites.sprite_cache.deinit();
 
+    render.tile_cache.init(pixelformat) catch |err| {
+        std.debug.print("Failed to initialize tile cache: {}\n", .{err});
+        return -1;
+    };
+    defer render.tile_cache.deinit();
+
+    rewind.history.init(allocator) catch |err| {
+        std.debug.print("Failed to allocate rewind history: {}\n", .{err});
+        return -1;
+    };
+    defer rewind.history.deinit();
+
     level.levelnumber = firstlevel;
     while (level.levelnumber < data.constants.*.levelfiles.len) : (level.levelnumber += 1) {
         const current_constants = data.constants.levelfiles[level.levelnumber];
@@ -150,31 +166,31 @@ pub fn playtitus(firstlevel: u16, allocator: std.mem.Allocator) !c_int {
                 return retval;
             }
 
-            if (globals.NEWLEVEL_FLAG) {
-                if (!globals.SKIPLEVEL_FLAG) {
+            if (level.state.sim.NEWLEVEL_FLAG) {
+                if (!level.state.sim.SKIPLEVEL_FLAG) {
                     game_state.record_completion(
                         allocator,
                         level.levelnumber,
-                        level.bonuscollected,
-                        level.tickcount,
+                        level.state.bonuscollected,
+                        level.state.tickcount,
                     ) catch |err| {
                         std.log.err("Could not record level completion: {}", .{err});
                     };
                 }
                 break;
             }
-            if (globals.LOSELIFE_FLAG) {
-                if (level.lives == 0) {
-                    globals.GAMEOVER_FLAG = true;
+            if (level.state.sim.LOSELIFE_FLAG) {
+                if (level.state.lives == 0) {
+                    level.state.sim.GAMEOVER_FLAG = true;
                 } else {
-                    level.lives -= 1;
+                    level.state.lives -= 1;
                     death(&context, &level);
                 }
-            } else if (globals.RESETLEVEL_FLAG == 1) {
+            } else if (level.state.sim.RESETLEVEL_FLAG == 1) {
                 death(&context, &level);
             }
 
-            if (globals.GAMEOVER_FLAG) {
+            if (level.state.sim.GAMEOVER_FLAG) {
                 gameover(&context, &level);
                 return 0;
             }
@@ -205,13 +221,13 @@ pub fn playtitus(firstlevel: u16, allocator: std.mem.Allocator) !c_int {
 
 // FIXME: most of the different return values are meaningless and unused
 fn resetLevel(context: *ScreenContext, level: *lvl.Level) c_int {
-    if (globals.NEWLEVEL_FLAG) {
+    if (level.state.sim.NEWLEVEL_FLAG) {
         return 1;
     }
-    if (globals.GAMEOVER_FLAG) {
+    if (level.state.sim.GAMEOVER_FLAG) {
         return 2;
     }
-    if (globals.RESETLEVEL_FLAG == 1) {
+    if (level.state.sim.RESETLEVEL_FLAG == 1) {
         return 3;
     }
     if (level.is_finish) {
@@ -220,16 +236,35 @@ fn resetLevel(context: *ScreenContext, level: *lvl.Level) c_int {
         if (retval < 0) {
             return retval;
         }
-        globals.NEWLEVEL_FLAG = true;
+        level.state.sim.NEWLEVEL_FLAG = true;
         return 3;
     }
     return 0;
 }
 
+// One tick of the level, with the player input already in place. Nothing here reads the input or draws.
+pub fn simulate(context: *ScreenContext, level: *lvl.Level) void {
+    level.state.sim.IMAGE_COUNTER = (level.state.sim.IMAGE_COUNTER + 1) & 0x0FFF; //Cycle from 0 to 0x0FFF
+    elevators.move(level);
+    spatial.grid.build(level); //Sort the sprites for collision checks
+    objects.move_objects(level); //Object gravity
+    player.move_player(level); //Update and move player, handle carried object and decrease timers
+    enemies.moveEnemies(level); //Move enemies
+    enemies.moveTrash(level); //Move enemy throwed objects
+    spatial.visible_sprites.update(level); //Find the sprites on and around the screen
+    enemies.SET_NMI(level); //Handle enemies on the screen
+    gates.CROSSING_GATE(context, level); //Check and handle level completion, and if the player does a kneestand on a secret entrance
+    sprites.animateSprites(level); //Animate player and objects
+    scroll.scroll(level); //X- and Y-scrolling
+    sprites.updateVisibility(level); //Find out what ends up on the screen
+    level.state.tickcount += 1;
+}
+
 fn playlevel(context: *ScreenContext, level: *lvl.Level) c_int {
     var retval: c_int = 0;
     var firstrun = true;
 
+    rewind.history.reset(level);
     while (true) {
         if (!firstrun) {
             render.render_health_bars(level);
@@ -237,22 +272,28 @@ fn playlevel(context: *ScreenContext, level: *lvl.Level) c_int {
             render.flip_screen(context, true);
         }
         firstrun = false;
-        globals.IMAGE_COUNTER = (globals.IMAGE_COUNTER + 1) & 0x0FFF; //Cycle from 0 to 0x0FFF
-        elevators.move(level);
-        objects.move_objects(level); //Object gravity
-        retval = player.move_player(context, level); //Key input, update and move player, handle carried object and decrease timers
+        if (input.rewindHeld()) {
+            // Step back through the history instead of simulating while rewind is held
+            const input_state = input.processEvents();
+            if (input_state.action == .Quit) {
+                return -1;
+            }
+            if (input_state.rewind_pressed) {
+                // With the history used up, hold still until rewind is let go
+                _ = rewind.history.rewind(level);
+                render.render_tiles(level);
+                render.render_sprites(level);
+                continue;
+            }
+        }
+        retval = player.read_input(context, level); //Key input
         if (retval == -1) { //c.TITUS_ERROR_QUIT) {
             return retval;
         }
-        enemies.moveEnemies(level); //Move enemies
-        enemies.moveTrash(level); //Move enemy throwed objects
-        enemies.SET_NMI(level); //Handle enemies on the screen
-        gates.CROSSING_GATE(context, level); //Check and handle level completion, and if the player does a kneestand on a secret entrance
-        sprites.animateSprites(level); //Animate player and objects
-        scroll.scroll(level); //X- and Y-scrolling
+        simulate(context, level);
         render.render_tiles(level);
         render.render_sprites(level);
-        level.tickcount += 1;
+        rewind.history.record(level); //Remember the tick so it can be rewound
         retval = resetLevel(context, level); //Check terminate flags (finishlevel, gameover, death or theend)
         if (retval < 0) {
             return retval;
@@ -265,7 +306,7 @@ fn playlevel(context: *ScreenContext, level: *lvl.Level) c_int {
 }
 
 fn death(context: *ScreenContext, level: *lvl.Level) void {
-    var plr = &(level.player);
+    var plr = &(level.state.player);
 
     audio.playTrack(.Death);
     _ = player.player_drop_carried(level);
@@ -289,17 +330,17 @@ fn death(context: *ScreenContext, level: *lvl.Level) void {
 }
 
 fn gameover(context: *ScreenContext, level: *lvl.Level) void {
-    var plr = &(level.player);
+    var plr = &(level.state.player);
 
     audio.playTrack(.GameOver);
     sprites.updatesprite(level, &(plr.sprite), 13, true); //Death
     sprites.updatesprite(level, &(plr.sprite2), 333, true); //Game
-    plr.sprite2.x = @as(i16, globals.BITMAP_X << 4) - (120 - 2);
-    plr.sprite2.y = @as(i16, globals.BITMAP_Y << 4) + 100;
+    plr.sprite2.x = @as(i16, level.state.sim.BITMAP_X << 4) - (120 - 2);
+    plr.sprite2.y = @as(i16, level.state.sim.BITMAP_Y << 4) + 100;
     //over
     sprites.updatesprite(level, &(plr.sprite3), 334, true); //Over
-    plr.sprite3.x = @as(i16, globals.BITMAP_X << 4) + (window.game_width + 120 - 2);
-    plr.sprite3.y = @as(i16, globals.BITMAP_Y << 4) + 100;
+    plr.sprite3.x = @as(i16, level.state.sim.BITMAP_X << 4) + (window.game_width + 120 - 2);
+    plr.sprite3.y = @as(i16, level.state.sim.BITMAP_Y << 4) + 100;
     for (0..31) |_| {
         render.render_tiles(level);
         render.render_sprites(level);
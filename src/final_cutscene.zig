@@ -49,9 +49,9 @@ fn advanceAnimation(level: *lvl.Level, spr: *lvl.Sprite) void {
 }
 
 pub fn play(context: *ScreenContext, level: *lvl.Level) c_int {
-    var player = &level.player;
-    globals.BITMAP_X = 0;
-    globals.NOSCROLL_FLAG = true;
+    var player = &level.state.player;
+    level.state.sim.BITMAP_X = 0;
+    level.state.sim.NOSCROLL_FLAG = true;
 
     // Prepare Titus/Moktar
     sprites.updatesprite(level, &(player.sprite), 343, true);
@@ -129,12 +129,12 @@ pub fn play(context: *ScreenContext, level: *lvl.Level) c_int {
     // Display THE END
     // THE
     sprites.updatesprite(level, &(player.sprite), 335, true);
-    player.sprite.x = (globals.BITMAP_X << 4) - (120 - 2);
-    player.sprite.y = (globals.BITMAP_Y << 4) + 100;
+    player.sprite.x = (level.state.sim.BITMAP_X << 4) - (120 - 2);
+    player.sprite.y = (level.state.sim.BITMAP_Y << 4) + 100;
     // END
     sprites.updatesprite(level, &(player.sprite3), 336, true);
-    player.sprite3.x = (globals.BITMAP_X << 4) + (320 + 120 - 2);
-    player.sprite3.y = (globals.BITMAP_Y << 4) + 100;
+    player.sprite3.x = (level.state.sim.BITMAP_X << 4) + (320 + 120 - 2);
+    player.sprite3.y = (level.state.sim.BITMAP_Y << 4) + 100;
     for (0..31) |_| {
         render.render_tiles(level);
         render.render_sprites(level);
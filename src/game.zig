@@ -61,6 +61,9 @@ const audio = @import("audio/audio.zig");
 const data = @import("data.zig");
 const globals = @import("globals.zig");
 const engine = @import("engine.zig");
+const batch = @import("batch.zig");
+const opl_benchmark = @import("audio/benchmark.zig");
+const render_music = @import("audio/render_music.zig");
 const window = @import("window.zig");
 
 const json = @import("json.zig");
@@ -96,6 +99,18 @@ pub fn run() !u8 {
     //        so we need a global to pass the allocator around.
     allocator = gpa.allocator();
 
+    const args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, args);
+    if (args.len > 1 and std.mem.eql(u8, args[1], "--batch")) {
+        return batch.run(allocator, args[2..]);
+    }
+    if (args.len > 1 and std.mem.eql(u8, args[1], "--opl-benchmark")) {
+        return opl_benchmark.run(allocator, args[2..]);
+    }
+    if (args.len > 1 and std.mem.eql(u8, args[1], "--render-music")) {
+        return render_music.run(allocator, args[2..]);
+    }
+
     settings_mem = try Settings.read(allocator);
     settings = &settings_mem.value;
     defer
@@ -121,7 +136,7 @@ pub fn run() !u8 {
     try window.window_init();
     defer window.window_deinit();
 
-    try fonts.fonts_load();
+    try fonts.fonts_load(allocator);
     defer fonts.fonts_free();
 
     // View the menu when the main loop starts
@@ -27,78 +27,69 @@ const std = @import("std");
 const SDL = @import("SDL.zig");
 const globals = @import("globals.zig");
 const window = @import("window.zig");
-const scroll = @import("scroll.zig");
 const render = @import("render.zig");
 const audio = @import("audio/audio.zig");
 const lvl = @import("level.zig");
 
 fn check_finish(context: *render.ScreenContext, level: *lvl.Level) void {
-    const player = &level.player;
-    if (globals.boss_alive) { //There is still a boss that needs to be killed!
+    const player = &level.state.player;
+    if (level.state.sim.boss_alive) { //There is still a boss that needs to be killed!
         return;
     }
     if (level.has_cage) {
-        if ((level.player.sprite2.number != globals.FIRST_OBJET + 26) and
-            (level.player.sprite2.number != globals.FIRST_OBJET + 27))
+        if ((level.state.player.sprite2.number != globals.FIRST_OBJET + 26) and
+            (level.state.player.sprite2.number != globals.FIRST_OBJET + 27))
         {
             return;
         }
     }
-    if (((player.sprite.x & 0x7FF0) != level.finishX) and
-        ((player.sprite.x & 0x7FF0) - 16 != level.finishX))
+    if (((player.sprite.x & 0x7FF0) != level.definition.finishX) and
+        ((player.sprite.x & 0x7FF0) - 16 != level.definition.finishX))
     {
         return;
     }
-    if (((player.sprite.y & 0x7FF0) != level.finishY) and
-        ((player.sprite.y & 0x7FF0) - 16 != level.finishY))
+    if (((player.sprite.y & 0x7FF0) != level.definition.finishY) and
+        ((player.sprite.y & 0x7FF0) - 16 != level.definition.finishY))
     {
         return;
     }
-    audio.playTrack(.LevelEnd);
-    audio.music_wait_to_finish();
-    CLOSE_SCREEN(context);
-    globals.NEWLEVEL_FLAG = true;
+    if (!level.headless) {
+        audio.playTrack(.LevelEnd);
+        audio.music_wait_to_finish();
+        CLOSE_SCREEN(context);
+    }
+    level.state.sim.NEWLEVEL_FLAG = true;
 }
 
 fn check_gates(context: *render.ScreenContext, level: *lvl.Level) void {
-    var player = &level.player;
-    if ((globals.CROSS_FLAG == 0) or //not kneestanding
-        (globals.NEWLEVEL_FLAG))
+    var player = &level.state.player;
+    if ((level.state.sim.CROSS_FLAG == 0) or //not kneestanding
+        (level.state.sim.NEWLEVEL_FLAG))
     { //the player has finished the level
         return;
     }
-    for (0..lvl.GATE_CAPACITY) |i| {
-        if ((level.gate[i].exists) and
-            (level.gate[i].entranceX == (player.sprite.x >> 4)) and
-            (level.gate[i].entranceY == (player.sprite.y >> 4)))
-        {
-            player.sprite.speed_x = 0;
-            player.sprite.speed_y = 0;
-            CLOSE_SCREEN(context);
-            defer OPEN_SCREEN(context, level);
-            const orig_xlimit = globals.XLIMIT;
-            defer globals.XLIMIT = orig_xlimit;
-            const orig_xlimit_breached = globals.XLIMIT_BREACHED;
-            defer globals.XLIMIT_BREACHED = orig_xlimit_breached;
-
-            globals.XLIMIT = @as(i16, @intCast(level.width)) - globals.screen_width;
-            player.sprite.x = @intCast(level.gate[i].exitX * 16);
-            player.sprite.y = @intCast(level.gate[i].exitY * 16);
-            while (globals.BITMAP_Y < level.gate[i].screenY) {
-                _ = scroll.scroll_down(level);
-            }
-            while (globals.BITMAP_Y > level.gate[i].screenY) {
-                _ = scroll.scroll_up(level);
-            }
-            while (globals.BITMAP_X < level.gate[i].screenX) {
-                _ = scroll.scroll_right(level);
-            }
-            while (globals.BITMAP_X > level.gate[i].screenX) {
-                _ = scroll.scroll_left(level);
-            }
-            globals.NOSCROLL_FLAG = level.gate[i].noscroll;
+    const gate = &level.definition.gate[level.findGate(player.sprite.x >> 4, player.sprite.y >> 4) orelse return];
+    player.sprite.speed_x = 0;
+    player.sprite.speed_y = 0;
+    if (!level.headless) {
+        CLOSE_SCREEN(context);
+    }
+    defer {
+        if (!level.headless) {
+            OPEN_SCREEN(context, level);
         }
     }
+
+    player.sprite.x = @intCast(gate.exitX * 16);
+    player.sprite.y = @intCast(gate.exitY * 16);
+    // Jump straight to the gate's screen, kept inside the map like scrolling there would
+    const maxX: globals.TileCoord = @as(i16, @intCast(level.definition.width)) - globals.screen_width;
+    const maxY: globals.TileCoord = @as(i16, @intCast(level.definition.height)) - globals.screen_height;
+    level.state.sim.BITMAP_X = @min(@as(globals.TileCoord, @intCast(gate.screenX)), maxX);
+    level.state.sim.BITMAP_Y = @min(@as(globals.TileCoord, @intCast(gate.screenY)), maxY);
+    level.state.sim.g_scroll_py_offset = 0;
+    level.state.sim.g_scroll_py_start = 0;
+    level.state.sim.NOSCROLL_FLAG = gate.noscroll;
 }
 
 //Check and handle level completion, and if the player does a kneestand on a secret entrance
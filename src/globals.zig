@@ -44,133 +44,148 @@ pub const MAX_SPEED_DEAD = 20;
 pub const TileCoord = i16;
 pub const PixelCoord = i16;
 
-pub var RESETLEVEL_FLAG: u8 = 0;
-pub var LOSELIFE_FLAG: bool = false;
+// The mutable state of one running simulation. It lives in the level state, so anything that has the
+// level has its simulation, snapshots copy it along with the rest, and separate levels don't share it.
+pub const SimulationContext = struct {
+    RESETLEVEL_FLAG: u8 = 0,
+    LOSELIFE_FLAG: bool = false,
 
-// triggers a game over
-pub var GAMEOVER_FLAG: bool = false;
+    // triggers a game over
+    GAMEOVER_FLAG: bool = false,
 
-// timer for health bar
-pub var BAR_FLAG: u8 = 0;
+    // timer for health bar
+    BAR_FLAG: u8 = 0,
 
-// headache timer
-pub var CHOC_FLAG: u8 = 0;
+    // headache timer
+    CHOC_FLAG: u8 = 0,
 
-// hit/burn timer
-pub var KICK_FLAG: u8 = 0;
+    // hit/burn timer
+    KICK_FLAG: u8 = 0,
 
-// If set, player will be "burned" when hit (fireballs)
-pub var GRANDBRULE_FLAG: bool = false;
+    // If set, player will be "burned" when hit (fireballs)
+    GRANDBRULE_FLAG: bool = false,
 
-// True if on a ladder
-pub var LADDER_FLAG: bool = false;
+    // True if on a ladder
+    LADDER_FLAG: bool = false,
 
-//True if player is forced into kneestanding because of low ceiling
-pub var low_ceiling: bool = false;
+    //True if player is forced into kneestanding because of low ceiling
+    low_ceiling: bool = false,
 
-// 6 if free fall or in the middle of a jump, decremented if on solid surface. Must be 0 to initiate a jump.
-pub var jump_timer: u8 = 0;
+    // 6 if free fall or in the middle of a jump, decremented if on solid surface. Must be 0 to initiate a jump.
+    jump_timer: u8 = 0,
 
-// Incremented from 0 to 3 when accelerating while jumping, stop acceleration upwards if >= 3
-pub var jump_acceleration_counter: u8 = 0;
+    // Incremented from 0 to 3 when accelerating while jumping, stop acceleration upwards if >= 3
+    jump_acceleration_counter: u8 = 0,
 
-// Player is falling? (0 = no, 1 = yes, 2 = )
-pub var YFALL: u8 = 0;
+    // Player is falling? (0 = no, 1 = yes, 2 = )
+    YFALL: u8 = 0,
 
-//Last action (kneestand + jump = silent walk)
-pub var LAST_ORDER: player.PlayerAction = .Rest;
+    //Last action (kneestand + jump = silent walk)
+    LAST_ORDER: player.PlayerAction = .Rest,
 
-//Silent walk timer
-pub var FURTIF_FLAG: u8 = 0;
+    //Silent walk timer
+    FURTIF_FLAG: u8 = 0,
 
-//True if an object is throwed forward
-pub var DROP_FLAG: bool = false;
+    //True if an object is throwed forward
+    DROP_FLAG: bool = false,
 
-pub var DROPREADY_FLAG: bool = false;
+    DROPREADY_FLAG: bool = false,
 
-//true if carrying something (add 16 to player sprite)
-pub var CARRY_FLAG: bool = false;
+    //true if carrying something (add 16 to player sprite)
+    CARRY_FLAG: bool = false,
 
-pub var POSEREADY_FLAG: bool = false;
+    POSEREADY_FLAG: bool = false,
 
-//Frames since last action change
-pub var ACTION_TIMER: u8 = 0;
+    //Frames since last action change
+    ACTION_TIMER: u8 = 0,
 
-//When non-zero, boss is invulnerable
-pub var INVULNERABLE_FLAG: u8 = 0;
+    //When non-zero, boss is invulnerable
+    INVULNERABLE_FLAG: u8 = 0,
 
-//When non-zero, fall through certain floors (after key down)
-pub var CROSS_FLAG: u8 = 0;
+    //When non-zero, fall through certain floors (after key down)
+    CROSS_FLAG: u8 = 0,
 
-//When zero, skip object gravity function
-pub var GRAVITY_FLAG: u8 = 0;
+    //When zero, skip object gravity function
+    GRAVITY_FLAG: u8 = 0,
 
-//Smoke when object hits the floor
-pub var FUME_FLAG: u8 = 0;
+    //Smoke when object hits the floor
+    FUME_FLAG: u8 = 0,
 
-pub var POCKET_FLAG: bool = false;
+    POCKET_FLAG: bool = false,
 
-//Increased every loop in game loop
-pub var loop_cycle: u8 = 0;
+    //Increased every loop in game loop
+    loop_cycle: u8 = 0,
 
-//Current tile animation (0-1-2), changed every 4th game loop cycle
-pub var tile_anim: u8 = 0;
+    //Current tile animation (0-1-2), changed every 4th game loop cycle
+    tile_anim: u8 = 0,
 
-//Screen offset (X) in tiles
-pub var BITMAP_X: TileCoord = 0;
+    //Screen offset (X) in tiles
+    BITMAP_X: TileCoord = 0,
 
-//Screen offset (Y) in tiles
-pub var BITMAP_Y: TileCoord = 0;
+    //Screen offset (Y) in tiles
+    BITMAP_Y: TileCoord = 0,
 
-//If true, the screen will scroll in X
-pub var g_scroll_x: bool = false;
+    //If true, the screen will scroll in X
+    g_scroll_x: bool = false,
 
-pub var g_scroll_px_offset: PixelCoord = 0;
+    g_scroll_px_offset: PixelCoord = 0,
 
-//The engine will not scroll past this tile before the player have crossed the line (X)
-pub var XLIMIT: TileCoord = 0;
-pub var XLIMIT_BREACHED: bool = false;
+    //Pixels the rendered screen trails behind BITMAP_Y while scrolling in Y
+    g_scroll_py_offset: PixelCoord = 0,
+    //The offset the easing started from, and how many ticks it has been going
+    g_scroll_py_start: PixelCoord = 0,
+    g_scroll_py_easing: u8 = 0,
 
-//If true, the screen will scroll in Y
-pub var g_scroll_y: bool = false;
+    //The engine will not scroll past this tile before the player have crossed the line (X)
+    XLIMIT: TileCoord = 0,
+    XLIMIT_BREACHED: bool = false,
 
-//If scrolling: scroll until player is in this tile (Y)
-pub var g_scroll_y_target: TileCoord = 0;
+    //If true, the screen will scroll in Y
+    g_scroll_y: bool = false,
 
-//The engine will not scroll below this tile before the player have gone below (Y)
-pub var ALTITUDE_ZERO: TileCoord = 0;
+    //If scrolling: scroll until player is in this tile (Y)
+    g_scroll_y_target: TileCoord = 0,
 
-//Increased every loop in game loop (0 to 0x0FFF)
-pub var IMAGE_COUNTER: u16 = 0;
+    //The engine will not scroll below this tile before the player have gone below (Y)
+    ALTITUDE_ZERO: TileCoord = 0,
 
-//1: walk right, 0: stand still, -1: walk left, triggers the ACTION_TIMER if it changes
-pub var SENSX: i8 = 0;
+    //Increased every loop in game loop (0 to 0x0FFF)
+    IMAGE_COUNTER: u16 = 0,
 
-pub var NOSCROLL_FLAG: bool = false;
+    //1: walk right, 0: stand still, -1: walk left, triggers the ACTION_TIMER if it changes
+    SENSX: i8 = 0,
 
-//Finish a level
-pub var NEWLEVEL_FLAG: bool = false;
+    NOSCROLL_FLAG: bool = false,
 
-//Skip a level without recording completion (cheat)
-pub var SKIPLEVEL_FLAG: bool = false;
+    //Finish a level
+    NEWLEVEL_FLAG: bool = false,
 
-//Used for enemies walking and popping up
-pub var TAUPE_FLAG: u8 = 0;
+    //Skip a level without recording completion (cheat)
+    SKIPLEVEL_FLAG: bool = false,
 
-//When non-zero, the flying carpet is flying
-pub var TAPISFLY_FLAG: u8 = 0;
+    //Used for enemies walking and popping up
+    TAUPE_FLAG: u8 = 0,
 
-//Flying carpet state
-pub var TAPISWAIT_FLAG: u8 = 0;
+    //When non-zero, the flying carpet is flying
+    TAPISFLY_FLAG: u8 = 0,
 
-//Counter when hit
-pub var SEECHOC_FLAG: u8 = 0;
+    //Flying carpet state
+    TAPISWAIT_FLAG: u8 = 0,
 
-//Lives of the boss
-pub var boss_lives: u8 = 0;
+    //Counter when hit
+    SEECHOC_FLAG: u8 = 0,
 
-//True if the boss is alive
-pub var boss_alive: bool = false;
+    //Lives of the boss
+    boss_lives: u8 = 0,
+
+    //True if the boss is alive
+    boss_alive: bool = false,
+
+    // Camera easing towards the direction the player faces
+    easing_value: i16 = 0,
+};
+
+// Cheats are toggled by the player for the whole session, not per simulation
 
 //If true, the player will not interfere with the enemies
 pub var GODMODE: bool = false;
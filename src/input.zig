@@ -230,6 +230,7 @@ pub const InputState = struct {
     jump_pressed: bool = false,
     crouch_pressed: bool = false,
     aim_direction: AimDirection = .Forward,
+    rewind_pressed: bool = false,
 
     gamepad_map: GamepadMap = undefined,
     current_gamepad: SDL.JoystickID = 0,
@@ -662,6 +663,7 @@ pub fn processEvents() *InputState {
                 g_input_state.jump_pressed = false;
                 g_input_state.crouch_pressed = false;
                 g_input_state.aim_direction = .Forward;
+                g_input_state.rewind_pressed = false;
             }
         },
         .Keyboard => {
@@ -673,6 +675,7 @@ pub fn processEvents() *InputState {
                 @as(i8, @intCast(keystate[SDL.SCANCODE_DOWN] | keystate[SDL.SCANCODE_S])) -
                 @as(i8, @intCast(keystate[SDL.SCANCODE_UP] | keystate[SDL.SCANCODE_W]));
             g_input_state.action_pressed = keystate[SDL.SCANCODE_SPACE] != 0;
+            g_input_state.rewind_pressed = keystate[SDL.SCANCODE_R] != 0;
             g_input_state.jump_pressed = g_input_state.y_axis < 0;
             g_input_state.crouch_pressed = g_input_state.y_axis > 0;
             if(g_input_state.y_axis < 0) {
@@ -690,6 +693,7 @@ pub fn processEvents() *InputState {
             g_input_state.jump_pressed = false;
             g_input_state.crouch_pressed = false;
             g_input_state.aim_direction = .Forward;
+            g_input_state.rewind_pressed = false;
         },
     }
     return &g_input_state;
@@ -748,6 +752,8 @@ fn handle_gamepad(pad_state: *GamepadState) void {
             g_input_state.y_axis = 0;
         }
     }
+    // Same button in both modes, neither uses it for anything else
+    g_input_state.rewind_pressed = pad_state.north_pressed;
     switch(game.settings.input_mode) {
         .Classic => {
             // Left stick behaves the same as dpad, no dedicated buttons for jump and crawl
@@ -779,6 +785,11 @@ fn handle_gamepad(pad_state: *GamepadState) void {
     }
 }
 
+// Whether the rewind button was held the last time events were processed
+pub fn rewindHeld() bool {
+    return g_input_state.rewind_pressed;
+}
+
 pub fn waitforbutton() c_int {
     var waiting: c_int = 1;
     while (waiting > 0) {
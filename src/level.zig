@@ -5,14 +5,16 @@ const globals = @import("globals.zig");
 const sprites = @import("sprites.zig");
 const audio = @import("audio/audio.zig");
 const input = @import("input.zig");
+const events = @import("events.zig");
+const objects = @import("objects.zig");
+const enemies = @import("enemies.zig");
+const pool = @import("pool.zig");
 const AudioTrack = audio.AudioTrack;
 
-// TODO: split the original level representation:
-//  - from internal 'initialize level stuff this way' data types
-//  - from runtime gameplay data types
+// The original level representation is split into the loaded LevelDefinition and the LevelState
+// that changes while playing.
 //
 // The idea is that we will have a new format for the levels that isn't this limited (bigger size, more objects)
-// to do that, we have to split all of the data representations
 
 // fully describe enemy data as an externally tagged union, then remove these
 inline fn load_u16(high: u8, low: u8) u16 {
@@ -40,27 +42,34 @@ test "test u16 loading" {
 }
 
 pub const Sprite = struct {
-    x: i16,
-    y: i16,
-    speed_x: i16,
-    speed_y: i16,
-    number: i16,
+    x: i16 = 0,
+    y: i16 = 0,
+    speed_x: i16 = 0,
+    speed_y: i16 = 0,
+    number: i16 = 0,
     //On screen or not on screen (above/below/left/right)
-    visible: bool,
-    flash: bool,
-    invincibility_frames: u8,
-    flipped: bool,
-    enabled: bool,
-    spritedata: ?*const SpriteData,
+    visible: bool = false,
+    flash: bool = false,
+    invincibility_frames: u8 = 0,
+    flipped: bool = false,
+    enabled: bool = false,
+    spritedata: ?*const SpriteData = null,
     //0: big spring, 1: small spring because of another object on top, 2: small spring because player on top
-    UNDER: u8,
+    UNDER: u8 = 0,
     //Object on top of the spring
-    ONTOP: ?*Sprite,
-    animation: [*c] const i16,
-    droptobottom: bool,
-    killing: bool,
+    ONTOP: Load = .none,
+    animation: [*c] const i16 = null,
+    droptobottom: bool = false,
+    killing: bool = false,
     //Set by "hidden" enemies
-    invisible: bool,
+    invisible: bool = false,
+};
+
+// What is on top of a spring. Objects are held by handle, so one that is gone by now is not moved.
+pub const Load = union(enum) {
+    none,
+    player,
+    object: pool.Handle,
 };
 
 pub const SpriteData = struct {
@@ -112,7 +121,6 @@ pub const Enemy = struct {
     range_y: c_uint,
     saved_y: i16, // Used for jumping fish
 
-    init_enabled: bool,
     init_sprite: u16,
     init_flipped: bool,
     init_x: c_int,
@@ -131,7 +139,6 @@ pub const Enemy = struct {
 };
 
 pub const Bonus = struct {
-    exists: bool,
     bonustile: u8,
     replacetile: u8,
     x: u8,
@@ -139,7 +146,6 @@ pub const Bonus = struct {
 };
 
 pub const Gate = struct {
-    exists: bool,
     entranceX: c_uint,
     entranceY: c_uint,
     exitX: c_uint,
@@ -150,14 +156,12 @@ pub const Gate = struct {
 };
 
 pub const Elevator = struct {
-    enabled: bool,
     sprite: Sprite,
     counter: c_uint,
 
     range: c_uint,
 
     init_direction: u8,
-    init_enabled: bool,
     init_speed_x: i16,
     init_speed_y: i16,
     init_sprite: u16,
@@ -190,14 +194,19 @@ pub const Player = struct {
     aim_direction: input.AimDirection,
 };
 
+// Slots in the original level format. Only the bonuses, gates, elevators and enemies that are actually
+// in a level get loaded. Objects come and go while the level is played, enemies and the player drop
+// things into the free slots, so they are kept in a pool.
 pub const BONUS_CAPACITY = 100;
 pub const GATE_CAPACITY = 20;
 pub const ELEVATOR_CAPACITY = 10;
-pub const TRASH_CAPACITY= 4;
+pub const TRASH_CAPACITY = 4;
 pub const ENEMY_CAPACITY = 50;
 pub const OBJECT_CAPACITY = 40;
 
-pub const WallType = enum(u8) {
+pub const ObjectPool = pool.Pool(Object, OBJECT_CAPACITY);
+
+pub const WallType = enum(u3) {
     NoWall = 0,
     Wall = 1,
     Bonus = 2,
@@ -207,7 +216,7 @@ pub const WallType = enum(u8) {
     CodeLevel14 = 6,
 };
 
-pub const FloorType = enum(u7) {
+pub const FloorType = enum(u4) {
     NoFloor = 0,
     Floor = 1,
     SlightlySlipperyFloor = 2,
@@ -224,7 +233,7 @@ pub const FloorType = enum(u7) {
     CodeLevel14 = 13,
 };
 
-pub const CeilingType = enum(u8) {
+pub const CeilingType = enum(u3) {
     NoCeiling = 0,
     Ceiling = 1,
     Ladder = 2,
@@ -232,20 +241,62 @@ pub const CeilingType = enum(u8) {
     Deadly = 4,
 };
 
+// Everything the collision checks need to know about a map cell, in one load
+pub const Collision = packed struct(u16) {
+    wall: WallType,
+    floor: FloorType,
+    ceiling: CeilingType,
+    _: u6 = 0,
+};
+
 pub const Tile = struct {
     tiledata: *SDL.Surface,
     animation: [3]u8, // Index to animation tiles
     horizflag: WallType,
     floorflag: FloorType,
     ceilflag: CeilingType,
+
+    fn collision(self: *const Tile) Collision {
+        return .{ .wall = self.horizflag, .floor = self.floorflag, .ceiling = self.ceilflag };
+    }
+
+    pub fn isAnimated(self: *const Tile) bool {
+        return self.animation[1] != self.animation[0] or self.animation[2] != self.animation[0];
+    }
 };
 
-pub const Level = struct {
-    levelnumber: u16,
-    has_cage: bool,
-    is_finish: bool,
-    boss_power: u8,
+pub const TilePosition = struct {
+    x: u16,
+    y: u16,
+};
+
+// Tiles changed since the renderer last took them, so it only has to redraw those
+pub const TileChanges = struct {
+    const capacity = 16;
+
+    positions: [capacity]TilePosition = undefined,
+    count: usize = 0,
+    // More changed than fit in here, everything has to be redrawn
+    overflow: bool = false,
+
+    fn add(self: *TileChanges, position: TilePosition) void {
+        if (self.count == capacity) {
+            self.overflow = true;
+            return;
+        }
+        self.positions[self.count] = position;
+        self.count += 1;
+    }
 
+    pub fn take(self: *TileChanges) TileChanges {
+        const changes = self.*;
+        self.* = .{};
+        return changes;
+    }
+};
+
+// Everything loaded from a level file. Nothing in here changes while the level is played.
+pub const LevelDefinition = struct {
     height: usize,
     width: usize, // always 256
     tile: [256]Tile,
@@ -254,80 +305,160 @@ pub const Level = struct {
     finishX: i16,
     finishY: i16,
 
-    //Enemy *boss; //Pointer to the boss; NULL if there is no boss
-    //Object *finish_object; // Pointer to the required object to carry to finish; NULL if there is no such object
+    bonus: []const Bonus,
+    bonuscount: usize,
+    // The bonus at each tile that has one
+    bonus_index: std.AutoHashMapUnmanaged(TilePosition, u16),
+    gate: []const Gate,
+    // The gate whose entrance is at each tile that has one
+    gate_index: std.AutoHashMapUnmanaged(TilePosition, u16),
+
+    // The tilemap before any bonus is collected
+    tilemap: []const u8,
+    // Positions in the tilemap that can change with the tile animation phase
+    animated_tiles: []const TilePosition,
+
+    // The entities as they are when the level (re)starts
+    initial_object: ObjectPool,
+    initial_enemy: [ENEMY_CAPACITY]Enemy,
+    initial_elevator: [ELEVATOR_CAPACITY]Elevator,
+    enemy_count: usize,
+    elevator_count: usize,
+};
 
+// Everything that changes while a level is played. It holds no slices and only points into the
+// definition, so it can be copied with a plain assignment and put into any copy of the same level.
+pub const LevelState = struct {
     player: Player,
-
-    object: [OBJECT_CAPACITY]Object,
+    object: ObjectPool,
     enemy: [ENEMY_CAPACITY]Enemy,
-    bonus: [BONUS_CAPACITY]Bonus,
-    gate: [GATE_CAPACITY]Gate,
     elevator: [ELEVATOR_CAPACITY]Elevator,
     trash: [TRASH_CAPACITY]Sprite,
+    // The level files have BONUS_CAPACITY fixed bonus slots and no count, so there are never more
+    bonus_taken: std.StaticBitSet(BONUS_CAPACITY),
+    sim: globals.SimulationContext,
 
     // FIXME: move this outside level...
-    bonuscount: usize,
     bonuscollected: usize,
     lives: c_int,
     extrabonus: c_int,
     tickcount: usize,
+};
 
-    tilemap: []u8,
+pub const Level = struct {
+    levelnumber: u16,
+    has_cage: bool,
+    is_finish: bool,
+    boss_power: u8,
     music: AudioTrack,
 
+    //Enemy *boss; //Pointer to the boss; NULL if there is no boss
+    //Object *finish_object; // Pointer to the required object to carry to finish; NULL if there is no such object
+
+    definition: *const LevelDefinition,
+    state: LevelState,
+
+    // The entities of the level in the state. Pointers into them stay valid until the level is freed.
+    object: []Object,
+    enemy: []Enemy,
+    elevator: []Elevator,
+
+    // The definition's tilemap, with the collected bonuses replaced
+    tilemap: []u8,
+    // The collision flags of the tilemap, with a border of one cell all around that holds what is outside
+    // of the map. Rows are width + 2 long.
+    collision: []Collision,
+    // For the renderer, not part of the state
+    tile_changes: TileChanges,
+
+    // Nobody is watching: no events for audio and rumble, no screen transitions and no tile cache
+    headless: bool,
+
     pub fn getTile(self: *const Level, x: usize, y: usize) u8 {
-        if (x >= self.width or y >= self.height) {
+        if (x >= self.definition.width or y >= self.definition.height) {
             unreachable;
         }
-        return self.tilemap[y * self.width + x];
+        return self.tilemap[y * self.definition.width + x];
     }
 
-    pub fn setTile(self: *const Level, x: usize, y: usize, tile: u8) void {
-        if (x >= self.width or y >= self.height) {
+    pub fn setTile(self: *Level, x: usize, y: usize, tile: u8) void {
+        if (x >= self.definition.width or y >= self.definition.height) {
             unreachable;
         }
-        self.tilemap[y * self.width + x] = tile;
+        self.tilemap[y * self.definition.width + x] = tile;
+        self.collision[(y + 1) * (self.definition.width + 2) + x + 1] = self.definition.tile[tile].collision();
+        if (!self.headless) {
+            self.tile_changes.add(.{ .x = @intCast(x), .y = @intCast(y) });
+        }
     }
 
-    pub fn getTileWall(self: *const Level, tileX: i16, tileY: i16) WallType {
-        if ((tileX < 0) or
-            (tileX >= self.width))
-        {
-            return .Wall;
-        } else if ((tileY < 0) or
-            (tileY >= self.height))
-        {
-            return .NoWall;
-        } else {
-            const tile = self.getTile(@intCast(tileX), @intCast(tileY));
-            return self.tile[tile].horizflag;
+    pub fn findBonus(self: *const Level, tileX: i16, tileY: i16) ?u16 {
+        if (tileX < 0 or tileY < 0) {
+            return null;
         }
+        return self.definition.bonus_index.get(.{ .x = @intCast(tileX), .y = @intCast(tileY) });
     }
 
-    pub fn getTileFloor(self: *const Level, tileX: i16, tileY: i16) FloorType {
-        if ((tileX < 0) or (tileX >= self.width))
-        {
-            return .Floor;
-        } else if ((tileY < 0) or (tileY >= self.height))
-        {
-            return .NoFloor;
-        } else {
-            const tile = self.getTile(@intCast(tileX), @intCast(tileY));
-            return self.tile[tile].floorflag;
+    pub fn findGate(self: *const Level, tileX: i16, tileY: i16) ?u16 {
+        if (tileX < 0 or tileY < 0) {
+            return null;
         }
+        return self.definition.gate_index.get(.{ .x = @intCast(tileX), .y = @intCast(tileY) });
     }
 
-    pub fn getTileCeiling(self: *const Level, tileX: i16, tileY: i16) CeilingType {
-        if ((tileY < 0) or (tileY >= self.height) or (tileX < 0) or (tileX >= self.width))
-        {
-            return .NoCeiling;
-        } else {
-            const tile = self.getTile(@intCast(tileX), @intCast(tileY));
-            return self.tile[tile].ceilflag;
+    pub fn triggerEvent(self: *const Level, event: events.GameEvent) void {
+        if (!self.headless) {
+            events.triggerEvent(event);
         }
     }
 
+    // Picked up, burnt, drowned or fallen out of the level
+    pub fn removeObject(self: *Level, index: usize) void {
+        self.object[index].sprite.enabled = false;
+        self.state.object.release(index);
+    }
+
+    // What a spring is loaded with, if it is still there
+    pub fn loadedSprite(self: *Level, load: Load) ?*Sprite {
+        return switch (load) {
+            .none => null,
+            .player => &self.state.player.sprite,
+            .object => |handle| if (self.state.object.get(handle)) |object| &object.sprite else null,
+        };
+    }
+
+    // Puts a copy of the state back, including the bonus tiles
+    pub fn restoreState(self: *Level, state: *const LevelState) void {
+        self.state = state.*;
+        for (self.definition.bonus, 0..) |bonus, i| {
+            const tile = if (self.state.bonus_taken.isSet(i)) bonus.replacetile else bonus.bonustile;
+            if (self.getTile(bonus.x, bonus.y) != tile) {
+                self.setTile(bonus.x, bonus.y, tile);
+            }
+        }
+    }
+
+    // Coordinates outside of the map are clamped onto the border
+    fn getCollision(self: *const Level, tileX: i16, tileY: i16) Collision {
+        const width: i16 = @intCast(self.definition.width);
+        const height: i16 = @intCast(self.definition.height);
+        const x: usize = @intCast(std.math.clamp(tileX, -1, width) + 1);
+        const y: usize = @intCast(std.math.clamp(tileY, -1, height) + 1);
+        return self.collision[y * (self.definition.width + 2) + x];
+    }
+
+    pub fn getTileWall(self: *const Level, tileX: i16, tileY: i16) WallType {
+        return self.getCollision(tileX, tileY).wall;
+    }
+
+    pub fn getTileFloor(self: *const Level, tileX: i16, tileY: i16) FloorType {
+        return self.getCollision(tileX, tileY).floor;
+    }
+
+    pub fn getTileCeiling(self: *const Level, tileX: i16, tileY: i16) CeilingType {
+        return self.getCollision(tileX, tileY).ceiling;
+    }
+
 };
 
 const InitSprite = extern union {
@@ -383,7 +514,7 @@ const StaticData = extern struct {
         varies: [12]u8,
     },
     // 35082
-    bonuses: [100]extern struct {
+    bonuses: [BONUS_CAPACITY]extern struct {
         bonustile: u8,
         replacetile: u8,
         x: u8,
@@ -475,273 +606,433 @@ pub fn loadlevel(
     objectdata: []const ObjectData,
     levelcolor: *SDL.Color,
 ) !c_int {
-    level.player.inithp = 16;
-    level.player.cageX = 0;
-    level.player.cageY = 0;
+    const definition = try allocator.create(LevelDefinition);
+    errdefer allocator.destroy(definition);
+    level.definition = definition;
+
+    level.state.player.inithp = 16;
+    level.state.player.cageX = 0;
+    level.state.player.cageY = 0;
 
     // read tilemap
     {
         const tilemap_data = leveldata[0 .. leveldata.len - 35828];
-        level.height = @intCast(tilemap_data.len / 256);
-        level.width = 256;
+        definition.height = @intCast(tilemap_data.len / 256);
+        definition.width = 256;
 
-        const tilemap_size: usize = @intCast(level.width * level.height);
+        const tilemap_size: usize = @intCast(definition.width * definition.height);
         level.tilemap = try allocator.alloc(u8, tilemap_size);
         @memcpy(level.tilemap, leveldata[0 .. tilemap_size]);
     }
+    errdefer allocator.free(level.tilemap);
 
     data.titus_palette.colors[14].r = levelcolor.r;
     data.titus_palette.colors[14].g = levelcolor.g;
     data.titus_palette.colors[14].b = levelcolor.b;
 
-    level.spritedata = sprites.sprites.definitions;
-    level.objectdata = objectdata;
+    definition.spritedata = sprites.sprites.definitions;
+    definition.objectdata = objectdata;
 
     const other_data: *const StaticData = @ptrCast(@alignCast(leveldata[leveldata.len - 35828 ..]));
     {
         var j: usize = 256; //j is used for "last tile with animation flag"
         for (0..256) |i| {
-            level.tile[i].tiledata = @ptrCast(try sprites.load_tile(&other_data.tile_images[i].data, &data.titus_palette));
-            level.tile[i].horizflag = @enumFromInt(other_data.horiz_flags[i]);
-            level.tile[i].floorflag = @enumFromInt(other_data.floor_flags[i]);
-            level.tile[i].ceilflag = @enumFromInt(other_data.ceil_flags[i].ceil);
+            // Headless levels never draw their tiles
+            if (!level.headless) {
+                definition.tile[i].tiledata = @ptrCast(try sprites.load_tile(&other_data.tile_images[i].data, &data.titus_palette));
+            }
+            definition.tile[i].horizflag = @enumFromInt(other_data.horiz_flags[i]);
+            definition.tile[i].floorflag = @enumFromInt(other_data.floor_flags[i]);
+            definition.tile[i].ceilflag = @enumFromInt(other_data.ceil_flags[i].ceil);
 
             const ii: u8 = @truncate(i);
-            level.tile[i].animation[0] = ii;
+            definition.tile[i].animation[0] = ii;
             if (i > 0 and j == i - 1) { //Check if this is the second tile after animation flag
-                level.tile[i].animation[1] = ii + 1;
-                level.tile[i].animation[2] = ii - 1;
+                definition.tile[i].animation[1] = ii + 1;
+                definition.tile[i].animation[2] = ii - 1;
             } else if (i > 1 and j == i - 2) { //Check if this is the third tile after animation flag
-                level.tile[i].animation[1] = ii - 2;
-                level.tile[i].animation[2] = ii - 1;
+                definition.tile[i].animation[1] = ii - 2;
+                definition.tile[i].animation[2] = ii - 1;
             } else if (other_data.ceil_flags[i].animated == 1) { //Animation flag
-                level.tile[i].animation[1] = ii + 1;
-                level.tile[i].animation[2] = ii + 2;
+                definition.tile[i].animation[1] = ii + 1;
+                definition.tile[i].animation[2] = ii + 2;
                 j = i;
             } else {
-                level.tile[i].animation[1] = ii;
-                level.tile[i].animation[2] = ii;
+                definition.tile[i].animation[1] = ii;
+                definition.tile[i].animation[2] = ii;
             }
         }
     }
-    {
-        for (0..OBJECT_CAPACITY) |i| {
-            const initSprite = other_data.objects[i].initSprite;
-            // TODO: use dynamic arrays for the actual loaded data
-            // TODO: if it's not 'enabled', don't even load it, just skip entirely
-            level.object[i].init_enabled = initSprite.value != 0xFFFF;
-            level.object[i].init_sprite = initSprite.unpacked.sprite;
-            level.object[i].init_visible = initSprite.unpacked.visible;
-            level.object[i].init_flipped = initSprite.unpacked.flipped;
-            level.object[i].init_flash = initSprite.unpacked.flash;
-            level.object[i].init_x = other_data.objects[i].initX;
-            level.object[i].init_y = other_data.objects[i].initY;
+    definition.initial_object = .{};
+    for (0..OBJECT_CAPACITY) |i| {
+        const object = &definition.initial_object.items[i];
+        const initSprite = other_data.objects[i].initSprite;
+        object.init_enabled = initSprite.value != 0xFFFF;
+        object.init_sprite = initSprite.unpacked.sprite;
+        object.init_visible = initSprite.unpacked.visible;
+        object.init_flipped = initSprite.unpacked.flipped;
+        object.init_flash = initSprite.unpacked.flash;
+        object.init_x = other_data.objects[i].initX;
+        object.init_y = other_data.objects[i].initY;
+
+        object.sprite = .{};
+        object.momentum = 0;
+        if (object.init_enabled) {
+            definition.initial_object.live.set(i);
+            objects.updateobjectsprite(level, object, @intCast(object.init_sprite), true);
+            object.sprite.visible = object.init_visible;
+            object.sprite.flash = object.init_flash;
+            object.sprite.flipped = object.init_flipped;
+            object.sprite.x = @truncate(object.init_x);
+            object.sprite.y = @truncate(object.init_y);
         }
     }
 
-    globals.ALTITUDE_ZERO = other_data.altitude_zero; // + 12;
+    level.state.sim.ALTITUDE_ZERO = other_data.altitude_zero; // + 12;
     // 33778
-    level.player.initX = other_data.initX;
-    level.player.initY = other_data.initY;
+    level.state.player.initX = other_data.initX;
+    level.state.player.initY = other_data.initY;
 
     // 33782
+    definition.enemy_count = 0;
     for (0..ENEMY_CAPACITY) |i| {
         const init_sprite = other_data.enemies[i].init_sprite;
-        level.enemy[i].init_enabled = init_sprite.value != 0xFFFF;
-
-        // TODO: use dynamic arrays for the actual loaded data
-        // TODO: if it's not 'enabled', don't even load it, just skip entirely
-        if (level.enemy[i].init_enabled) {
-            // visible and flash are ignored
-            level.enemy[i].init_flipped = init_sprite.unpacked.flipped;
-            level.enemy[i].init_sprite = init_sprite.unpacked.sprite + 101;
-            level.enemy[i].init_x = other_data.enemies[i].init_x;
-            level.enemy[i].init_y = other_data.enemies[i].init_y;
-            level.enemy[i].type = other_data.enemies[i].type.value;
-            level.enemy[i].init_speed_x = other_data.enemies[i].init_speed_x;
-            level.enemy[i].init_speed_y = 0;
-            level.enemy[i].power = other_data.enemies[i].power;
-
-            const enemy_orig = &other_data.enemies[i].varies;
-            switch (level.enemy[i].type) {
-                //Noclip walk
-                0, 1 => {
-                    level.enemy[i].center_x = load_i16(enemy_orig[2], enemy_orig[1]);
-                    level.enemy[i].range_x = load_u16(enemy_orig[4], enemy_orig[3]);
-                },
-                //Shoot
-                2 => {
-                    level.enemy[i].delay = enemy_orig[2];
-                    // really a u2 for direction and u14 for the range
-                    level.enemy[i].range_x = load_u16(enemy_orig[4], enemy_orig[3]);
-                    level.enemy[i].direction = @as(u2, @truncate((level.enemy[i].range_x >> 14) & 0x0003));
-                    level.enemy[i].range_x = level.enemy[i].range_x & 0x3FFF;
-                },
-                //Noclip walk, jump to player
-                3, 4 => {
-                    level.enemy[i].center_x = load_i16(enemy_orig[2], enemy_orig[1]);
-                    level.enemy[i].range_x = load_u16(enemy_orig[4], enemy_orig[3]);
-                    level.enemy[i].range_y = enemy_orig[5];
-                },
-                //Noclip walk, move to player
-                5, 6 => {
-                    level.enemy[i].center_x = load_i16(enemy_orig[2], enemy_orig[1]);
-                    level.enemy[i].range_x = load_u16(enemy_orig[4], enemy_orig[3]);
-                    level.enemy[i].range_y = enemy_orig[5];
-                },
-                //Gravity walk, hit when near
-                7 => {
-                    level.enemy[i].walkspeed_x = enemy_orig[5];
-                    level.enemy[i].range_x = load_u16(enemy_orig[10], enemy_orig[9]);
-                },
-                //Gravity walk when off-screen
-                8 => {
-                    level.enemy[i].walkspeed_x = enemy_orig[5];
-                },
-                9 => { //Walk and periodically pop-up
-                    level.enemy[i].walkspeed_x = enemy_orig[5];
-                    level.enemy[i].range_x = load_u16(enemy_orig[10], enemy_orig[9]);
-                },
-                10 => { //Alert when near, walk when nearer
-                    level.enemy[i].walkspeed_x = enemy_orig[5];
-                    level.enemy[i].range_x = load_u16(enemy_orig[10], enemy_orig[9]);
-                },
-                //Walk and shoot
-                11 => {
-                    level.enemy[i].walkspeed_x = enemy_orig[5];
-                    level.enemy[i].range_x = load_u16(enemy_orig[10], enemy_orig[9]);
-                },
-                //Jump (immortal)
-                12 => {
-                    level.enemy[i].range_y = load_u16(enemy_orig[2], enemy_orig[1]);
-                    level.enemy[i].delay = enemy_orig[5];
-                },
-                //Bounce
-                13 => {
-                    level.enemy[i].delay = enemy_orig[6];
-                    level.enemy[i].range_x = load_u16(enemy_orig[10], enemy_orig[9]);
-                },
-                //Gravity walk when off-screen (immortal)
-                14 => {
-                    level.enemy[i].walkspeed_x = enemy_orig[5];
-                },
-                //Nothing (immortal)
-                15 => {},
-                //Nothing
-                16 => {},
-                //Drop (immortal)
-                17 => {
-                    level.enemy[i].range_x = load_u16(enemy_orig[2], enemy_orig[1]);
-                    level.enemy[i].delay = load_u16(enemy_orig[4], enemy_orig[3]);
-                    level.enemy[i].range_y = load_u16(enemy_orig[8], enemy_orig[7]);
-                },
-                //Drop (immortal)
-                18 => {
-                    level.enemy[i].range_x = load_u16(enemy_orig[2], enemy_orig[1]);
-                    level.enemy[i].range_y = load_u16(enemy_orig[4], enemy_orig[3]);
-                    level.enemy[i].init_speed_y = enemy_orig[5];
-                },
-                else => {
-                    std.log.err("Unhandled enemy type in level: {d}", .{level.enemy[i].type});
-                },
-            }
-        } else {
-            level.enemy[i].sprite.enabled = false;
+        if (init_sprite.value == 0xFFFF) {
+            continue;
         }
+        const enemy = &definition.initial_enemy[definition.enemy_count];
+        // visible and flash are ignored
+        enemy.init_flipped = init_sprite.unpacked.flipped;
+        enemy.init_sprite = init_sprite.unpacked.sprite + 101;
+        enemy.init_x = other_data.enemies[i].init_x;
+        enemy.init_y = other_data.enemies[i].init_y;
+        enemy.type = other_data.enemies[i].type.value;
+        enemy.init_speed_x = other_data.enemies[i].init_speed_x;
+        enemy.init_speed_y = 0;
+        enemy.power = other_data.enemies[i].power;
+
+        const enemy_orig = &other_data.enemies[i].varies;
+        switch (enemy.type) {
+            //Noclip walk
+            0, 1 => {
+                enemy.center_x = load_i16(enemy_orig[2], enemy_orig[1]);
+                enemy.range_x = load_u16(enemy_orig[4], enemy_orig[3]);
+            },
+            //Shoot
+            2 => {
+                enemy.delay = enemy_orig[2];
+                // really a u2 for direction and u14 for the range
+                enemy.range_x = load_u16(enemy_orig[4], enemy_orig[3]);
+                enemy.direction = @as(u2, @truncate((enemy.range_x >> 14) & 0x0003));
+                enemy.range_x = enemy.range_x & 0x3FFF;
+            },
+            //Noclip walk, jump to player
+            3, 4 => {
+                enemy.center_x = load_i16(enemy_orig[2], enemy_orig[1]);
+                enemy.range_x = load_u16(enemy_orig[4], enemy_orig[3]);
+                enemy.range_y = enemy_orig[5];
+            },
+            //Noclip walk, move to player
+            5, 6 => {
+                enemy.center_x = load_i16(enemy_orig[2], enemy_orig[1]);
+                enemy.range_x = load_u16(enemy_orig[4], enemy_orig[3]);
+                enemy.range_y = enemy_orig[5];
+            },
+            //Gravity walk, hit when near
+            7 => {
+                enemy.walkspeed_x = enemy_orig[5];
+                enemy.range_x = load_u16(enemy_orig[10], enemy_orig[9]);
+            },
+            //Gravity walk when off-screen
+            8 => {
+                enemy.walkspeed_x = enemy_orig[5];
+            },
+            9 => { //Walk and periodically pop-up
+                enemy.walkspeed_x = enemy_orig[5];
+                enemy.range_x = load_u16(enemy_orig[10], enemy_orig[9]);
+            },
+            10 => { //Alert when near, walk when nearer
+                enemy.walkspeed_x = enemy_orig[5];
+                enemy.range_x = load_u16(enemy_orig[10], enemy_orig[9]);
+            },
+            //Walk and shoot
+            11 => {
+                enemy.walkspeed_x = enemy_orig[5];
+                enemy.range_x = load_u16(enemy_orig[10], enemy_orig[9]);
+            },
+            //Jump (immortal)
+            12 => {
+                enemy.range_y = load_u16(enemy_orig[2], enemy_orig[1]);
+                enemy.delay = enemy_orig[5];
+            },
+            //Bounce
+            13 => {
+                enemy.delay = enemy_orig[6];
+                enemy.range_x = load_u16(enemy_orig[10], enemy_orig[9]);
+            },
+            //Gravity walk when off-screen (immortal)
+            14 => {
+                enemy.walkspeed_x = enemy_orig[5];
+            },
+            //Nothing (immortal)
+            15 => {},
+            //Nothing
+            16 => {},
+            //Drop (immortal)
+            17 => {
+                enemy.range_x = load_u16(enemy_orig[2], enemy_orig[1]);
+                enemy.delay = load_u16(enemy_orig[4], enemy_orig[3]);
+                enemy.range_y = load_u16(enemy_orig[8], enemy_orig[7]);
+            },
+            //Drop (immortal)
+            18 => {
+                enemy.range_x = load_u16(enemy_orig[2], enemy_orig[1]);
+                enemy.range_y = load_u16(enemy_orig[4], enemy_orig[3]);
+                enemy.init_speed_y = enemy_orig[5];
+            },
+            else => {
+                std.log.err("Unhandled enemy type in level: {d}", .{enemy.type});
+            },
+        }
+
+        enemy.sprite = .{};
+        enemy.dying = 0;
+        enemy.phase = 0;
+        enemy.counter = 0;
+        enemy.trigger = false;
+        enemy.visible = false;
+        enemies.updateenemysprite(level, enemy, @intCast(enemy.init_sprite), true);
+        enemy.sprite.flipped = enemy.init_flipped;
+        enemy.sprite.x = @truncate(enemy.init_x);
+        enemy.sprite.y = @truncate(enemy.init_y);
+        enemy.sprite.speed_x = @truncate(enemy.init_speed_x);
+        enemy.sprite.speed_y = @truncate(enemy.init_speed_y);
+        definition.enemy_count += 1;
     }
     // 35082
 
-    level.bonuscount = 0;
-    level.bonuscollected = 0;
-    level.tickcount = 0;
+    definition.bonuscount = 0;
+    level.state.bonuscollected = 0;
+    level.state.bonus_taken = .initEmpty();
+    level.state.tickcount = 0;
+    var bonus_list: std.ArrayList(Bonus) = .empty;
+    errdefer bonus_list.deinit(allocator);
     for (0..BONUS_CAPACITY) |i| {
-        level.bonus[i].x = other_data.bonuses[i].x;
-        level.bonus[i].y = other_data.bonuses[i].y;
-        level.bonus[i].exists = ((level.bonus[i].x != 0xFF) and (level.bonus[i].y != 0xFF));
-        if (level.bonus[i].exists) {
-            level.bonus[i].bonustile = other_data.bonuses[i].bonustile;
-            level.bonus[i].replacetile = other_data.bonuses[i].replacetile;
-            if (level.bonus[i].bonustile >= 255 - 2) {
-                level.bonuscount += 1;
+        const bonus: Bonus = .{
+            .x = other_data.bonuses[i].x,
+            .y = other_data.bonuses[i].y,
+            .bonustile = other_data.bonuses[i].bonustile,
+            .replacetile = other_data.bonuses[i].replacetile,
+        };
+        if (bonus.x == 0xFF or bonus.y == 0xFF) {
+            continue;
+        }
+        if (bonus.bonustile >= 255 - 2) {
+            definition.bonuscount += 1;
+        }
+        // Not setTile, the collision map is made from the finished tilemap further down
+        level.tilemap[@as(usize, bonus.y) * definition.width + bonus.x] = bonus.bonustile;
+        try bonus_list.append(allocator, bonus);
+    }
+    definition.bonus = try bonus_list.toOwnedSlice(allocator);
+    errdefer allocator.free(definition.bonus);
+
+    definition.bonus_index = .empty;
+    errdefer definition.bonus_index.deinit(allocator);
+    try definition.bonus_index.ensureTotalCapacity(allocator, @intCast(definition.bonus.len));
+    for (definition.bonus, 0..) |*bonus, i| {
+        // The first bonus on a tile wins, like it did when they were searched in order
+        const entry = definition.bonus_index.getOrPutAssumeCapacity(.{ .x = bonus.x, .y = bonus.y });
+        if (!entry.found_existing) {
+            entry.value_ptr.* = @intCast(i);
+        }
+    }
+
+    // Index the animated tiles, so only those need to be redrawn when the animation phase changes.
+    // Bonuses are included when the tile they get replaced with is animated.
+    {
+        var animated_tiles: std.ArrayList(TilePosition) = .empty;
+        errdefer animated_tiles.deinit(allocator);
+        for (0..definition.height) |y| {
+            for (0..definition.width) |x| {
+                if (definition.tile[level.getTile(x, y)].isAnimated()) {
+                    try animated_tiles.append(allocator, .{ .x = @intCast(x), .y = @intCast(y) });
+                }
+            }
+        }
+        for (definition.bonus) |*bonus| {
+            if (definition.tile[bonus.bonustile].isAnimated()) {
+                continue;
+            }
+            if (definition.tile[bonus.replacetile].isAnimated()) {
+                try animated_tiles.append(allocator, .{ .x = bonus.x, .y = bonus.y });
             }
-            level.setTile(level.bonus[i].x, level.bonus[i].y, level.bonus[i].bonustile);
         }
+        definition.animated_tiles = try animated_tiles.toOwnedSlice(allocator);
     }
+    errdefer allocator.free(definition.animated_tiles);
 
     // FIXME, @Research: There seems to be no XLIMIT in some levels in the original game, where we have XLIMIT here
     //                   So find where it is in the file, read it and use it so we don't have weird XLIMIT issues
     //                   in levels where this problem doesn't belong...
     //
     //    Ok ... it's not in the file. At least not obviously. The weirdness must be coming from somewhere else.
-    globals.XLIMIT = other_data.xlimit; // + 20;
+    level.state.sim.XLIMIT = other_data.xlimit; // + 20;
     // fprintf(stderr, "XLIMIT is set at %d\n", XLIMIT);
-    globals.XLIMIT_BREACHED = false;
+    level.state.sim.XLIMIT_BREACHED = false;
 
+    var gate_list: std.ArrayList(Gate) = .empty;
+    errdefer gate_list.deinit(allocator);
     for (0..GATE_CAPACITY) |i| {
-        level.gate[i].entranceY = other_data.gates[i].entranceY;
-        level.gate[i].exists = (level.gate[i].entranceY != 0xFF);
-        if (level.gate[i].exists) {
-            level.gate[i].entranceX = other_data.gates[i].entranceX;
-            level.gate[i].screenX = other_data.gates[i].screenX;
-            level.gate[i].screenY = other_data.gates[i].screenY;
-            level.gate[i].exitX = other_data.gates[i].exitX;
-            level.gate[i].exitY = other_data.gates[i].exitY;
-            level.gate[i].noscroll = other_data.gates[i].noscroll != 0;
+        if (other_data.gates[i].entranceY == 0xFF) {
+            continue;
+        }
+        try gate_list.append(allocator, .{
+            .entranceX = other_data.gates[i].entranceX,
+            .entranceY = other_data.gates[i].entranceY,
+            .screenX = other_data.gates[i].screenX,
+            .screenY = other_data.gates[i].screenY,
+            .exitX = other_data.gates[i].exitX,
+            .exitY = other_data.gates[i].exitY,
+            .noscroll = other_data.gates[i].noscroll != 0,
+        });
+    }
+    definition.gate = try gate_list.toOwnedSlice(allocator);
+    errdefer allocator.free(definition.gate);
+
+    definition.gate_index = .empty;
+    errdefer definition.gate_index.deinit(allocator);
+    try definition.gate_index.ensureTotalCapacity(allocator, @intCast(definition.gate.len));
+    for (definition.gate, 0..) |*gate, i| {
+        const entry = definition.gate_index.getOrPutAssumeCapacity(.{ .x = @intCast(gate.entranceX), .y = @intCast(gate.entranceY) });
+        if (!entry.found_existing) {
+            entry.value_ptr.* = @intCast(i);
         }
     }
 
+    definition.elevator_count = 0;
     for (0..ELEVATOR_CAPACITY) |i| {
         const initSprite = other_data.elevators[i].init_sprite;
-        level.elevator[i].init_x = other_data.elevators[i].init_x;
-        level.elevator[i].init_y = other_data.elevators[i].init_y;
+        const elevator = &definition.initial_elevator[definition.elevator_count];
+        elevator.init_x = other_data.elevators[i].init_x;
+        elevator.init_y = other_data.elevators[i].init_y;
         var j: i16 = other_data.elevators[i].speed;
 
-        const enabled = ((initSprite.value != 0xFFFF) and (j < 8) and (j > -8) and (level.elevator[i].init_x >= -16) and (level.elevator[i].init_y >= 0));
+        const enabled = ((initSprite.value != 0xFFFF) and (j < 8) and (j > -8) and (elevator.init_x >= -16) and (elevator.init_y >= 0));
         // This is so oddly specific...
         // Let's NOT have this in the new format
-        level.elevator[i].init_enabled = enabled;
-        level.elevator[i].enabled = enabled;
         if (!enabled) {
             continue;
         }
 
-        level.elevator[i].init_sprite = initSprite.unpacked.sprite + 30;
-        level.elevator[i].init_visible = initSprite.unpacked.visible;
-        level.elevator[i].init_flipped = initSprite.unpacked.flipped;
-        level.elevator[i].init_flash = initSprite.unpacked.flash;
-        level.elevator[i].range = other_data.elevators[i].range;
+        elevator.init_sprite = initSprite.unpacked.sprite + 30;
+        elevator.init_visible = initSprite.unpacked.visible;
+        elevator.init_flipped = initSprite.unpacked.flipped;
+        elevator.init_flash = initSprite.unpacked.flash;
+        elevator.range = other_data.elevators[i].range;
         // FIXME: this should be an enum...
-        level.elevator[i].init_direction = other_data.elevators[i].init_direction;
-        if ((level.elevator[i].init_direction == 0) or (level.elevator[i].init_direction == 3)) { //Up or left
+        elevator.init_direction = other_data.elevators[i].init_direction;
+        if ((elevator.init_direction == 0) or (elevator.init_direction == 3)) { //Up or left
             j = 0 - j;
         }
-        if ((level.elevator[i].init_direction == 0) or //up
-            (level.elevator[i].init_direction == 2))
+        if ((elevator.init_direction == 0) or //up
+            (elevator.init_direction == 2))
         { //down
-            level.elevator[i].init_speed_x = 0;
-            level.elevator[i].init_speed_y = j;
+            elevator.init_speed_x = 0;
+            elevator.init_speed_y = j;
         } else {
-            level.elevator[i].init_speed_x = j;
-            level.elevator[i].init_speed_y = 0;
+            elevator.init_speed_x = j;
+            elevator.init_speed_y = 0;
         }
+
+        elevator.sprite = .{};
+        sprites.updatesprite(level, &elevator.sprite, @intCast(elevator.init_sprite), true);
+        elevator.sprite.visible = elevator.init_visible;
+        elevator.sprite.flash = elevator.init_flash;
+        elevator.sprite.flipped = elevator.init_flipped;
+        elevator.sprite.x = @truncate(elevator.init_x);
+        elevator.sprite.y = @truncate(elevator.init_y);
+        elevator.counter = 0;
+        elevator.sprite.speed_x = elevator.init_speed_x;
+        elevator.sprite.speed_y = elevator.init_speed_y;
+        definition.elevator_count += 1;
     }
 
-    level.finishX = other_data.finishX;
-    level.finishY = other_data.finishY;
+    definition.finishX = other_data.finishX;
+    definition.finishY = other_data.finishY;
+    definition.tilemap = try allocator.dupe(u8, level.tilemap);
+    errdefer allocator.free(definition.tilemap);
+    level.collision = try makeCollisionMap(definition, level.tilemap, allocator);
+
+    level.object = &level.state.object.items;
+    level.enemy = level.state.enemy[0..definition.enemy_count];
+    level.elevator = level.state.elevator[0..definition.elevator_count];
 
-    _ = sprites.sprites.setPalette(&data.titus_palette);
-    sprites.sprite_cache.evictAll();
+    if (!level.headless) {
+        _ = sprites.sprites.setPalette(&data.titus_palette);
+        sprites.sprite_cache.evictAll();
+    }
+    // A new tilemap, nothing in the tile cache is any good
+    level.tile_changes = .{ .overflow = true };
 
-    for (0..4) |i| {
-        level.trash[i].enabled = false;
+    for (&level.state.trash) |*trash| {
+        trash.enabled = false;
     }
     return (0);
 }
 
-pub fn freelevel(level: *Level, allocator: std.mem.Allocator) void {
+fn makeCollisionMap(definition: *const LevelDefinition, tilemap: []const u8, allocator: std.mem.Allocator) ![]Collision {
+    const stride = definition.width + 2;
+    const map = try allocator.alloc(Collision, stride * (definition.height + 2));
+
+    // Left and right of the map are walls with a floor, above and below is nothing
+    @memset(map, .{ .wall = .NoWall, .floor = .NoFloor, .ceiling = .NoCeiling });
+    for (0..definition.height + 2) |y| {
+        map[y * stride] = .{ .wall = .Wall, .floor = .Floor, .ceiling = .NoCeiling };
+        map[y * stride + stride - 1] = .{ .wall = .Wall, .floor = .Floor, .ceiling = .NoCeiling };
+    }
+    for (0..definition.height) |y| {
+        for (0..definition.width) |x| {
+            map[(y + 1) * stride + x + 1] = definition.tile[tilemap[y * definition.width + x]].collision();
+        }
+    }
+    return map;
+}
+
+// Sets up another running copy of a loaded level. It shares the definition, so it must be freed with
+// freecopy before the original is freed with freelevel.
+pub fn copylevel(level: *Level, original: *const Level, allocator: std.mem.Allocator) !void {
+    level.* = original.*;
+    level.tilemap = try allocator.dupe(u8, original.tilemap);
+    errdefer allocator.free(level.tilemap);
+    level.collision = try allocator.dupe(Collision, original.collision);
+    level.object = &level.state.object.items;
+    level.enemy = level.state.enemy[0..original.enemy.len];
+    level.elevator = level.state.elevator[0..original.elevator.len];
+}
+
+pub fn freecopy(level: *Level, allocator: std.mem.Allocator) void {
     allocator.free(level.tilemap);
+    allocator.free(level.collision);
+}
 
-    for (0..256) |i| {
-        SDL.destroySurface(@ptrCast(@alignCast(level.tile[i].tiledata)));
+pub fn freelevel(level: *Level, allocator: std.mem.Allocator) void {
+    const definition = level.definition;
+    allocator.free(level.tilemap);
+    allocator.free(level.collision);
+    allocator.free(definition.tilemap);
+    allocator.free(definition.animated_tiles);
+    allocator.free(definition.bonus);
+    var bonus_index = definition.bonus_index;
+    bonus_index.deinit(allocator);
+    allocator.free(definition.gate);
+    var gate_index = definition.gate_index;
+    gate_index.deinit(allocator);
+
+    if (!level.headless) {
+        for (0..256) |i| {
+            SDL.destroySurface(@ptrCast(@alignCast(definition.tile[i].tiledata)));
+        }
     }
+    allocator.destroy(definition);
 }
@@ -29,14 +29,14 @@
 
 const globals = @import("globals.zig");
 const lvl = @import("level.zig");
-const events = @import("events.zig");
+const spatial = @import("spatial.zig");
 const plr = @import("player.zig");
 const sprites = @import("sprites.zig");
 
 const ORIG_OBJECT_COUNT = 71;
 
 pub fn move_objects(level: *lvl.Level) void {
-    if (@as(c_int, @bitCast(@as(c_uint, globals.GRAVITY_FLAG))) == @as(c_int, 0)) return;
+    if (@as(c_int, @bitCast(@as(c_uint, level.state.sim.GRAVITY_FLAG))) == @as(c_int, 0)) return;
     var off_object: *lvl.Object = undefined;
     _ = &off_object;
     var hflag: lvl.WallType = undefined;
@@ -47,12 +47,13 @@ pub fn move_objects(level: *lvl.Level) void {
     _ = &j;
     var obj_vs_sprite: bool = undefined;
     _ = &obj_vs_sprite;
-    for (&level.object) |*object| {
+    var live = level.state.object.iterator();
+    while (live.next()) |i| {
+        const object = &level.object[i];
         obj_vs_sprite = false;
 
-        // Skip unused objects
-        if (!object.sprite.enabled)
-            continue;
+        // Later objects and the player look for this one in the grid
+        defer spatial.grid.update(.{ .kind = .Object, .index = @intCast(i) }, &object.sprite);
 
         // Left edge of level
         if (object.sprite.x <= 8) {
@@ -61,33 +62,33 @@ pub fn move_objects(level: *lvl.Level) void {
         }
 
         // Right edge of level
-        if (object.sprite.x >= level.width * 16 - 8) {
+        if (object.sprite.x >= level.definition.width * 16 - 8) {
             object.sprite.speed_x = -2 * 16;
             object.sprite.speed_y = 0;
         }
 
         // Handle carpet
         if (object.sprite.number == globals.FIRST_OBJET + 21 or object.sprite.number == globals.FIRST_OBJET + 22) { // Flying
-            globals.GRAVITY_FLAG = 4; // Keep doing gravity
+            level.state.sim.GRAVITY_FLAG = 4; // Keep doing gravity
 
             // (Adjust height after player)
-            if (globals.TAPISWAIT_FLAG != 0) { // Flying ready
+            if (level.state.sim.TAPISWAIT_FLAG != 0) { // Flying ready
                 object.momentum = 0;
-                if (object.sprite.y == level.player.sprite.y - 8) {
+                if (object.sprite.y == level.state.player.sprite.y - 8) {
                     object.sprite.speed_y = 0;
-                } else if (object.sprite.y < level.player.sprite.y - 8) {
+                } else if (object.sprite.y < level.state.player.sprite.y - 8) {
                     object.sprite.speed_y = 16;
                 } else {
                     object.sprite.speed_y = -16;
                 }
             }
 
-            if (globals.TAPISFLY_FLAG == 0) { // Time's up! Stop flying
+            if (level.state.sim.TAPISFLY_FLAG == 0) { // Time's up! Stop flying
                 updateobjectsprite(level, object, globals.FIRST_OBJET + 19, true);
                 object.sprite.speed_x = 0;
-                globals.TAPISWAIT_FLAG = 2;
+                level.state.sim.TAPISWAIT_FLAG = 2;
             }
-        } else if (((((@as(c_int, @bitCast(@as(c_int, object.sprite.number))) == (@as(c_int, 30) + @as(c_int, 19))) or (@as(c_int, @bitCast(@as(c_int, object.sprite.number))) == (@as(c_int, 30) + @as(c_int, 20)))) and ((@as(c_int, @bitCast(@as(c_uint, globals.IMAGE_COUNTER))) & @as(c_int, 3)) == @as(c_int, 0))) and (@as(c_int, @bitCast(@as(c_int, object.sprite.speed_y))) > @as(c_int, 0))) and (@as(c_int, @bitCast(@as(c_uint, globals.TAPISWAIT_FLAG))) != @as(c_int, 2))) {
+        } else if (((((@as(c_int, @bitCast(@as(c_int, object.sprite.number))) == (@as(c_int, 30) + @as(c_int, 19))) or (@as(c_int, @bitCast(@as(c_int, object.sprite.number))) == (@as(c_int, 30) + @as(c_int, 20)))) and ((@as(c_int, @bitCast(@as(c_uint, level.state.sim.IMAGE_COUNTER))) & @as(c_int, 3)) == @as(c_int, 0))) and (@as(c_int, @bitCast(@as(c_int, object.sprite.speed_y))) > @as(c_int, 0))) and (@as(c_int, @bitCast(@as(c_uint, level.state.sim.TAPISWAIT_FLAG))) != @as(c_int, 2))) {
             if (@as(c_int, @bitCast(@as(c_int, object.sprite.number))) == (@as(c_int, 30) + @as(c_int, 19))) {
                 object.sprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, object.sprite.speed_x))) >> @intCast(1)))));
                 updateobjectsprite(level, object, @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, 30) + @as(c_int, 20))))), false);
@@ -95,8 +96,8 @@ pub fn move_objects(level: *lvl.Level) void {
                 object.sprite.speed_x = 0;
                 updateobjectsprite(level, object, @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, 30) + @as(c_int, 21))))), false);
             }
-            globals.TAPISWAIT_FLAG = 1;
-            globals.TAPISFLY_FLAG = 200;
+            level.state.sim.TAPISWAIT_FLAG = 1;
+            level.state.sim.TAPISFLY_FLAG = 200;
         }
 
         // Does it move in X?
@@ -119,7 +120,7 @@ pub fn move_objects(level: *lvl.Level) void {
                 } else {
                     tileX += 1;
                 }
-                if (tileX < level.width and tileX >= 0) {
+                if (tileX < level.definition.width and tileX >= 0) {
                     hflag = level.getTileWall(tileX, tileY);
                     if (hflag == .Wall or hflag == .Deadly or hflag == .Padlock) {
                         object.sprite.speed_x = @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, 0) - @as(c_int, @bitCast(@as(c_int, object.sprite.speed_x)))))));
@@ -127,7 +128,7 @@ pub fn move_objects(level: *lvl.Level) void {
                     }
                 }
             }
-            globals.GRAVITY_FLAG = 4;
+            level.state.sim.GRAVITY_FLAG = 4;
             object.sprite.x += @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, object.sprite.speed_x))) >> @intCast(4)))));
             var reduction: i8 = 0;
             if (@abs(@as(c_int, @bitCast(@as(c_int, object.sprite.speed_y)))) >= @as(c_int, 16)) {
@@ -166,7 +167,7 @@ pub fn move_objects(level: *lvl.Level) void {
             }
         } else if ((@as(c_int, @intFromBool(object.sprite.droptobottom)) != 0) or ((@as(c_int, @intFromBool(object.objectdata.*.droptobottom)) != 0) and (@as(c_int, @bitCast(@as(c_int, object.sprite.speed_y))) >= (@as(c_int, 10) * @as(c_int, 16))))) {
             if (!object.sprite.visible) {
-                object.sprite.enabled = false;
+                level.removeObject(i);
                 continue;
             }
         } else {
@@ -174,15 +175,15 @@ pub fn move_objects(level: *lvl.Level) void {
             var tileY = @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, object.sprite.y))) >> @intCast(4)))));
             hflag = level.getTileWall(tileX, tileY);
             fflag = level.getTileFloor(tileX, tileY);
-            if (object.sprite.y <= 6 or object.sprite.y >= level.height << 4) {
+            if (object.sprite.y <= 6 or object.sprite.y >= level.definition.height << 4) {
                 fflag = .NoFloor;
-                if (object.sprite.y >= ((level.*.height << 4) + 64)) {
-                    object.sprite.enabled = false;
+                if (object.sprite.y >= ((level.definition.height << 4) + 64)) {
+                    level.removeObject(i);
                     continue;
                 }
             }
             if (fflag == .Fire) {
-                object.sprite.enabled = false;
+                level.removeObject(i);
                 continue;
             }
             if (fflag == .Water) {
@@ -190,7 +191,7 @@ pub fn move_objects(level: *lvl.Level) void {
                     object.sprite.speed_y = 0;
                     continue;
                 } else {
-                    object.sprite.enabled = false;
+                    level.removeObject(i);
                     continue;
                 }
             }
@@ -215,7 +216,7 @@ pub fn move_objects(level: *lvl.Level) void {
                     hflag = level.getTileWall(tileX, tileY);
                     fflag = level.getTileFloor(tileX, tileY);
                     if (fflag == .Fire) {
-                        object.sprite.enabled = false;
+                        level.removeObject(i);
                         break;
                     }
                     if ((fflag != .Ladder) and ((fflag != .NoFloor) or (hflag == .Wall) or (hflag == .Deadly) or (hflag == .Padlock))) {
@@ -224,17 +225,17 @@ pub fn move_objects(level: *lvl.Level) void {
                             object.sprite.y = @as(i16, @bitCast(@as(c_short, @truncate((@as(c_int, @bitCast(@as(c_int, object.sprite.y))) & @as(c_int, 65520)) + @as(c_int, 16)))));
                             if ((@as(c_int, @bitCast(@as(c_int, object.sprite.number))) >= (@as(c_int, 30) + @as(c_int, 19))) and (@as(c_int, @bitCast(@as(c_int, object.sprite.number))) <= (@as(c_int, 30) + @as(c_int, 22)))) {
                                 updateobjectsprite(level, object, @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, 30) + @as(c_int, 19))))), false);
-                                globals.TAPISWAIT_FLAG = 0;
+                                level.state.sim.TAPISWAIT_FLAG = 0;
                             }
-                            if ((@as(c_int, @intFromBool(object.sprite.visible)) != 0) and !level.*.player.sprite2.enabled) {
-                                globals.FUME_FLAG = 32;
-                                level.*.player.sprite2.y = object.sprite.y;
-                                level.*.player.sprite2.x = object.sprite.x;
-                                sprites.updatesprite(level, &level.*.player.sprite2, @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, 30) + @as(c_int, 16))))), true);
+                            if ((@as(c_int, @intFromBool(object.sprite.visible)) != 0) and !level.state.player.sprite2.enabled) {
+                                level.state.sim.FUME_FLAG = 32;
+                                level.state.player.sprite2.y = object.sprite.y;
+                                level.state.player.sprite2.x = object.sprite.x;
+                                sprites.updatesprite(level, &level.state.player.sprite2, @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, 30) + @as(c_int, 16))))), true);
                             }
                         } else {
                             object.sprite.y = @as(i16, @bitCast(@as(c_short, @truncate((@as(c_int, @bitCast(@as(c_int, object.sprite.y))) & @as(c_int, 65520)) + @as(c_int, 16)))));
-                            globals.GRAVITY_FLAG = 4;
+                            level.state.sim.GRAVITY_FLAG = 4;
                             object.momentum = 0;
                             object.sprite.speed_y = @as(i16, @bitCast(@as(c_short, @truncate((@as(c_int, 0) - @as(c_int, @bitCast(@as(c_int, object.sprite.speed_y)))) + (@as(c_int, 16) * @as(c_int, 3))))));
                             if (@as(c_int, @bitCast(@as(c_int, object.sprite.speed_y))) > @as(c_int, 0)) {
@@ -255,7 +256,7 @@ pub fn move_objects(level: *lvl.Level) void {
                 object.momentum = 0;
                 if (off_object.*.objectdata.*.bounce) {
                     off_object.*.sprite.UNDER |= @as(u8, @bitCast(@as(i8, @truncate(@as(c_int, 1)))));
-                    off_object.*.sprite.ONTOP = &object.sprite;
+                    off_object.*.sprite.ONTOP = .{ .object = level.state.object.handle(i) };
                     if (@as(c_int, @bitCast(@as(c_int, object.sprite.speed_y))) > @as(c_int, 64)) {
                         off_object.*.sprite.speed_y = @as(i16, @bitCast(@as(c_short, @truncate(((@as(c_int, 0) - @as(c_int, @bitCast(@as(c_int, object.sprite.speed_y)))) >> @intCast(1)) + @as(c_int, 32)))));
                         object.sprite.speed_y = @as(i16, @bitCast(@as(c_short, @truncate(((@as(c_int, 0) - @as(c_int, @bitCast(@as(c_int, object.sprite.speed_y)))) >> @intCast(1)) + @as(c_int, 16)))));
@@ -268,7 +269,7 @@ pub fn move_objects(level: *lvl.Level) void {
                 } else if (object.objectdata.*.bounce) {
                     object.sprite.y = @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, off_object.*.sprite.y))) - @as(c_int, @bitCast(@as(c_uint, off_object.*.sprite.spritedata.?.collheight)))))));
                     if ((@as(c_int, @bitCast(@as(c_int, object.sprite.speed_y))) >= @as(c_int, 16)) or (@as(c_int, @bitCast(@as(c_int, object.sprite.speed_y))) < @as(c_int, 0))) {
-                        globals.GRAVITY_FLAG = 4;
+                        level.state.sim.GRAVITY_FLAG = 4;
                         object.sprite.speed_y = @as(i16, @bitCast(@as(c_short, @truncate((@as(c_int, 0) - @as(c_int, @bitCast(@as(c_int, object.sprite.speed_y)))) + (@as(c_int, 16) * @as(c_int, 3))))));
                         if (@as(c_int, @bitCast(@as(c_int, object.sprite.speed_y))) > @as(c_int, 0)) {
                             object.sprite.speed_y = 0;
@@ -289,7 +290,7 @@ pub fn move_objects(level: *lvl.Level) void {
         }
         const speed = @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, object.sprite.speed_y))) >> @intCast(4)))));
         if (@as(c_int, @bitCast(@as(c_int, speed))) != @as(c_int, 0)) {
-            globals.GRAVITY_FLAG = 4;
+            level.state.sim.GRAVITY_FLAG = 4;
         }
         object.sprite.y += @as(i16, @bitCast(@as(c_short, @truncate(@as(c_int, @bitCast(@as(c_int, speed)))))));
         if (@as(c_int, @bitCast(@as(c_int, speed))) < @as(c_int, @bitCast(@as(c_uint, max_speed)))) {
@@ -303,7 +304,7 @@ pub fn move_objects(level: *lvl.Level) void {
 }
 
 fn shock(level: *lvl.Level, object: *lvl.Object) void {
-    const player = &level.player;
+    const player = &level.state.player;
     if (@as(c_int, @bitCast(@as(c_uint, object.momentum))) < @as(c_int, 10)) return;
     if (@as(c_int, @bitCast(@as(c_int, player.sprite.speed_y))) >= (@as(c_int, 12) * @as(c_int, 16))) return;
     if (@abs(@as(c_int, @bitCast(@as(c_int, player.sprite.y))) - @as(c_int, @bitCast(@as(c_int, object.sprite.y)))) >= @as(c_int, 32)) {
@@ -322,8 +323,8 @@ fn shock(level: *lvl.Level, object: *lvl.Object) void {
     } else {
         if (((@as(c_int, @bitCast(@as(c_int, object.sprite.y))) - @as(c_int, @bitCast(@as(c_uint, object.sprite.spritedata.?.collheight)))) + @as(c_int, 1)) >= @as(c_int, @bitCast(@as(c_int, player.sprite.y)))) return;
     }
-    events.triggerEvent(.PlayerHeadImpact);
-    globals.CHOC_FLAG = 24;
+    level.triggerEvent(.PlayerHeadImpact);
+    level.state.sim.CHOC_FLAG = 24;
     if (object.*.sprite.killing) {
         if (!globals.GODMODE) {
             plr.DEC_ENERGY(level);
@@ -340,7 +341,10 @@ pub fn SPRITES_VS_SPRITES(level: *lvl.Level, sprite1: *lvl.Sprite, sprite1data:
     // sprite1ref is level->spritedata[0] (first player sprite)
     const obj1left = sprite1.x - (sprite1data.width >> 1);
     i = 0;
-    for (&level.object) |*object2| {
+    const candidates = spatial.grid.near(obj1left, sprite1.y, 64, 70);
+    var iter = spatial.KindIterator.init(&candidates, .Object);
+    while (iter.next()) |index| {
+        const object2 = &level.object[index];
         const sprite2 = &object2.sprite;
         if (sprite2 == sprite1 or !sprite2.enabled or !object2.objectdata.*.support)
             continue;
@@ -372,5 +376,5 @@ pub fn updateobjectsprite(level: *lvl.Level, obj: *lvl.Object, number: i16, clea
     if (index < 0 or index >= ORIG_OBJECT_COUNT) {
         index = 0;
     }
-    obj.*.objectdata = @constCast(@ptrCast(&level.objectdata[@intCast(index)]));
+    obj.*.objectdata = @constCast(@ptrCast(&level.definition.objectdata[@intCast(index)]));
 }
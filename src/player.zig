@@ -32,8 +32,8 @@ const window = @import("window.zig");
 const data = @import("data.zig");
 const objects = @import("objects.zig");
 const lvl = @import("level.zig");
+const spatial = @import("spatial.zig");
 const render = @import("render.zig");
-const events = @import("events.zig");
 const sprites = @import("sprites.zig");
 const common = @import("common.zig");
 const input = @import("input.zig");
@@ -43,8 +43,8 @@ const credits = @import("ui/credits.zig");
 const pause_menu = @import("ui/pause_menu.zig");
 const status = @import("ui/status.zig");
 
-fn add_carry() u8 {
-    if (globals.CARRY_FLAG) {
+fn add_carry(level: *lvl.Level) u8 {
+    if (level.state.sim.CARRY_FLAG) {
         return 16;
     } else {
         return 0;
@@ -148,115 +148,118 @@ pub const PlayerAction = enum(u8) {
     }
 };
 
-pub fn move_player(arg_context: *render.ScreenContext, arg_level: *lvl.Level) c_int {
-    // Part 1: Gather input state
-    // Part 2: Determine the player's action, and execute action dependent code
-    // Part 3: Move the player + collision detection
-    // Part 4: Move the throwed/carried object
-    // Part 5: decrease the timers
-
+// Gathers the input state, and handles the menus and cheats. The player moves in move_player.
+pub fn read_input(arg_context: *render.ScreenContext, arg_level: *lvl.Level) c_int {
     const context = arg_context;
     const level = arg_level;
-    const player = &level.*.player;
+    const player = &level.state.player;
 
-    // Part 1: Gather input state
-    {
-        const input_state = input.processEvents();
-        switch (input_state.action) {
-            .Quit => {
-                return -1;
-            },
-            .Escape, .ToggleMenu => {
-                const retval = pause_menu.pauseMenu(context);
-                if (retval < 0) {
-                    return retval;
-                }
-            },
-            .Status => {
-                _ = status.viewstatus(level, false);
-            },
-            .SecretCreditsScreen => {
-                // This is always available in the original.
-                // Lets you convert extra bonus into lives without completing a level
-                // It's a weird key combination
-                // And it wasn't in the manual.
-                // So I'm calling it a cheat and disabling it in normal builds.
-                _ = credits.credits_screen();
-                if (level.*.extrabonus >= 10) {
-                    level.*.extrabonus -= 10;
-                    level.*.lives += 1;
-                }
-            },
-            .GodMode => {
-                if (globals.GODMODE) {
-                    globals.GODMODE = false;
-                    globals.NOCLIP = false;
-                } else {
-                    globals.GODMODE = true;
-                }
-            },
-            .NoClip => {
-                if (globals.NOCLIP) {
-                    globals.NOCLIP = false;
-                } else {
-                    globals.NOCLIP = true;
-                    globals.GODMODE = true;
-                }
-            },
-            .LoseLife => {
-                // In the original game, this is always available, but you also lose a life. Maybe as a way to get 'unstuck'?
-                DEC_LIFE(level);
-            },
-            .GameOver => {
-                // Always available in original game. But why would you ever want this?
-                globals.GAMEOVER_FLAG = true;
-            },
-            .SkipLevel => {
-                // Added this to skip levels during testing
-                globals.NEWLEVEL_FLAG = true;
-                globals.SKIPLEVEL_FLAG = true;
-            },
-
-            else => {},
-        }
+    const input_state = input.processEvents();
+    switch (input_state.action) {
+        .Quit => {
+            return -1;
+        },
+        .Escape, .ToggleMenu => {
+            const retval = pause_menu.pauseMenu(context);
+            if (retval < 0) {
+                return retval;
+            }
+        },
+        .Status => {
+            _ = status.viewstatus(level, false);
+        },
+        .SecretCreditsScreen => {
+            // This is always available in the original.
+            // Lets you convert extra bonus into lives without completing a level
+            // It's a weird key combination
+            // And it wasn't in the manual.
+            // So I'm calling it a cheat and disabling it in normal builds.
+            _ = credits.credits_screen();
+            if (level.state.extrabonus >= 10) {
+                level.state.extrabonus -= 10;
+                level.state.lives += 1;
+            }
+        },
+        .GodMode => {
+            if (globals.GODMODE) {
+                globals.GODMODE = false;
+                globals.NOCLIP = false;
+            } else {
+                globals.GODMODE = true;
+            }
+        },
+        .NoClip => {
+            if (globals.NOCLIP) {
+                globals.NOCLIP = false;
+            } else {
+                globals.NOCLIP = true;
+                globals.GODMODE = true;
+            }
+        },
+        .LoseLife => {
+            // In the original game, this is always available, but you also lose a life. Maybe as a way to get 'unstuck'?
+            DEC_LIFE(level);
+        },
+        .GameOver => {
+            // Always available in original game. But why would you ever want this?
+            level.state.sim.GAMEOVER_FLAG = true;
+        },
+        .SkipLevel => {
+            // Added this to skip levels during testing
+            level.state.sim.NEWLEVEL_FLAG = true;
+            level.state.sim.SKIPLEVEL_FLAG = true;
+        },
 
-        player.x_axis = input_state.x_axis;
-        player.y_axis = input_state.y_axis;
-        player.action_pressed = input_state.action_pressed;
-        player.jump_pressed = input_state.jump_pressed;
-        player.crouch_pressed = input_state.crouch_pressed;
-        player.aim_direction = input_state.aim_direction;
+        else => {},
     }
 
+    player.x_axis = input_state.x_axis;
+    player.y_axis = input_state.y_axis;
+    player.action_pressed = input_state.action_pressed;
+    player.jump_pressed = input_state.jump_pressed;
+    player.crouch_pressed = input_state.crouch_pressed;
+    player.aim_direction = input_state.aim_direction;
+    return 0;
+}
+
+pub fn move_player(level: *lvl.Level) void {
+    // Part 1: Take the input state gathered by read_input (or fed by a script)
+    // Part 2: Determine the player's action, and execute action dependent code
+    // Part 3: Move the player + collision detection
+    // Part 4: Move the throwed/carried object
+    // Part 5: decrease the timers
+
+    const player = &level.state.player;
+
     // Part 2: Determine the player's action, and execute action dependent code
     if (globals.NOCLIP) {
         player.*.sprite.speed_x = player.x_axis * 100;
         player.*.sprite.speed_y = player.y_axis * 100;
         player.*.sprite.x += player.*.sprite.speed_x >> 4;
         player.*.sprite.y += player.*.sprite.speed_y >> 4;
-        return 0;
+        return;
     }
 
     var action: PlayerAction = undefined;
 
-    if (globals.CHOC_FLAG != 0) {
+    if (level.state.sim.CHOC_FLAG != 0) {
         action = .Headache;
-    } else if (globals.KICK_FLAG != 0) {
-        if (globals.GRANDBRULE_FLAG) {
+    } else if (level.state.sim.KICK_FLAG != 0) {
+        if (level.state.sim.GRANDBRULE_FLAG) {
             action = .HitBurn;
         } else {
             action = .Hit;
         }
     } else {
-        globals.GRANDBRULE_FLAG = false;
-        if (globals.LADDER_FLAG) {
+        level.state.sim.GRANDBRULE_FLAG = false;
+        if (level.state.sim.LADDER_FLAG) {
             action = .Climb;
-        } else if (!globals.low_ceiling and player.jump_pressed and player.y_axis <= 0 and globals.jump_timer == 0) {
+        } else if (!level.state.sim.low_ceiling and player.jump_pressed and player.y_axis <= 0 and level.state.sim.jump_timer == 0) {
             action = .Jump;
-            if (globals.LAST_ORDER == .KneeStand) { // Test if last order was kneestanding
-                globals.FURTIF_FLAG = 100; // If jump after kneestanding, init silent walk timer
+            if (level.state.sim.LAST_ORDER == .KneeStand) { // Test if last order was kneestanding
+                level.state.sim.FURTIF_FLAG = 100; // If jump after kneestanding, init silent walk timer
             }
-        } else if (globals.low_ceiling or (globals.jump_timer != 6 and player.crouch_pressed)) {
+        } else if (level.state.sim.low_ceiling or (level.state.sim.jump_timer != 6 and player.crouch_pressed)) {
             if (player.x_axis != 0) { // Move left or right
                 action = .Crawl; // Action: crawling
             } else {
@@ -268,34 +271,34 @@ pub fn move_player(arg_context: *render.ScreenContext, arg_level: *lvl.Level) c_
             action = .Rest; // Action: rest (no action)
         }
         // Is space button pressed?
-        if (player.action_pressed and !globals.low_ceiling) {
-            if (!globals.DROP_FLAG) {
+        if (player.action_pressed and !level.state.sim.low_ceiling) {
+            if (!level.state.sim.DROP_FLAG) {
                 if (action == .Crawl or action == .KneeStand) { // Kneestand
-                    globals.DROPREADY_FLAG = false;
+                    level.state.sim.DROPREADY_FLAG = false;
                     action = .Grab; // Grab an object
-                } else if (globals.CARRY_FLAG and globals.DROPREADY_FLAG) { // Fall
+                } else if (level.state.sim.CARRY_FLAG and level.state.sim.DROPREADY_FLAG) { // Fall
                     action = .Drop; // Drop the object
                 }
             }
         } else {
-            globals.DROPREADY_FLAG = true;
-            globals.POSEREADY_FLAG = false;
+            level.state.sim.DROPREADY_FLAG = true;
+            level.state.sim.POSEREADY_FLAG = false;
         }
     }
-    if (globals.CARRY_FLAG) {
+    if (level.state.sim.CARRY_FLAG) {
         action.addCarry();
     }
 
     var newsensX: i8 = undefined;
-    if (globals.CHOC_FLAG != 0 or globals.KICK_FLAG != 0) {
-        if (globals.SENSX < 0) {
+    if (level.state.sim.CHOC_FLAG != 0 or level.state.sim.KICK_FLAG != 0) {
+        if (level.state.sim.SENSX < 0) {
             newsensX = -1;
         } else {
             newsensX = 0;
         }
     } else if (player.x_axis != 0) {
         newsensX = player.x_axis;
-    } else if (globals.SENSX == -1) {
+    } else if (level.state.sim.SENSX == -1) {
         newsensX = -1;
     } else if (action == .Rest) {
         newsensX = 0;
@@ -303,11 +306,11 @@ pub fn move_player(arg_context: *render.ScreenContext, arg_level: *lvl.Level) c_
         newsensX = 1;
     }
 
-    if (globals.SENSX != newsensX) {
-        globals.SENSX = newsensX;
-        globals.ACTION_TIMER = 1;
+    if (level.state.sim.SENSX != newsensX) {
+        level.state.sim.SENSX = newsensX;
+        level.state.sim.ACTION_TIMER = 1;
     } else {
-        if (globals.FURTIF_FLAG != 0) {
+        if (level.state.sim.FURTIF_FLAG != 0) {
             if (action == .Rest) {
                 action = .SilentRest;
             }
@@ -315,10 +318,10 @@ pub fn move_player(arg_context: *render.ScreenContext, arg_level: *lvl.Level) c_
                 action = .SilentWalk;
             }
         }
-        if (action != globals.LAST_ORDER) {
-            globals.ACTION_TIMER = 1;
-        } else if (globals.ACTION_TIMER < 0xFF) {
-            globals.ACTION_TIMER += 1;
+        if (action != level.state.sim.LAST_ORDER) {
+            level.state.sim.ACTION_TIMER = 1;
+        } else if (level.state.sim.ACTION_TIMER < 0xFF) {
+            level.state.sim.ACTION_TIMER += 1;
         }
     }
     ACTION_PRG(level, action); // call movement function based on ACTION
@@ -327,7 +330,7 @@ pub fn move_player(arg_context: *render.ScreenContext, arg_level: *lvl.Level) c_
     // Move the player in X if the new position doesn't exceed 8 pixels from the
     // edges
     if (((player.sprite.speed_x < 0) and ((player.sprite.x + (player.sprite.speed_x >> 4)) >= 8)) or // Going left
-        ((player.sprite.speed_x > 0) and ((player.sprite.x + (player.sprite.speed_x >> 4)) <= (level.width << 4) - 8))) // Going right
+        ((player.sprite.speed_x > 0) and ((player.sprite.x + (player.sprite.speed_x >> 4)) <= (level.definition.width << 4) - 8))) // Going right
     {
         player.sprite.x += player.sprite.speed_x >> 4;
     }
@@ -338,40 +341,40 @@ pub fn move_player(arg_context: *render.ScreenContext, arg_level: *lvl.Level) c_
 
     // Part 4: Move the throwed/carried object
     // Move throwed/carried object
-    if (globals.DROP_FLAG) {
+    if (level.state.sim.DROP_FLAG) {
         // sprite2: throwed or dropped object
         const newX: i16 = (player.sprite2.speed_x >> 4) + player.sprite2.x;
-        if ((newX < (level.width << 4)) and // Left for right level edge
+        if ((newX < (level.definition.width << 4)) and // Left for right level edge
             (newX >= 0) and // Right for level left edge
             (newX >=
-            (globals.BITMAP_X << 4) -
+            (level.state.sim.BITMAP_X << 4) -
             globals.GESTION_X) and // Max 40 pixels left for screen (bug: the purpose
             // was probably one screen left for the screen)
-            (newX <= (globals.BITMAP_X << 4) + (globals.screen_width << 4) +
+            (newX <= (level.state.sim.BITMAP_X << 4) + (globals.screen_width << 4) +
             globals.GESTION_X))
         { // Max 40 pixels right for screen
             player.sprite2.x = newX;
             const newY: i16 = (player.sprite2.speed_y >> 4) + player.sprite2.y;
-            if ((newY < (level.height << 4)) and // Above bottom edge of level
+            if ((newY < (level.definition.height << 4)) and // Above bottom edge of level
                 (newY >= 0) and // Below top edge of level
                 (newY >=
-                (globals.BITMAP_Y << 4) -
+                (level.state.sim.BITMAP_Y << 4) -
                 globals.GESTION_Y) and // Max 20 pixels above the screen (bug: the purpose
                 // was probably one screen above the screen)
-                (newY <= (globals.BITMAP_Y << 4) + (globals.screen_height << 4) +
+                (newY <= (level.state.sim.BITMAP_Y << 4) + (globals.screen_height << 4) +
                 globals.GESTION_Y))
             { // Max 20 pixels below the screen
                 player.sprite2.y = newY;
             } else {
                 player.sprite2.enabled = false;
-                globals.DROP_FLAG = false;
+                level.state.sim.DROP_FLAG = false;
             }
         } else {
             player.sprite2.enabled = false;
-            globals.DROP_FLAG = false;
+            level.state.sim.DROP_FLAG = false;
         }
-    } else if (globals.CARRY_FLAG) { // Place the object on top of or beside the player
-        if (!globals.LADDER_FLAG and ((globals.LAST_ORDER == .KneeStand_Carry) or (globals.LAST_ORDER == .Grab_Carry)))
+    } else if (level.state.sim.CARRY_FLAG) { // Place the object on top of or beside the player
+        if (!level.state.sim.LADDER_FLAG and ((level.state.sim.LAST_ORDER == .KneeStand_Carry) or (level.state.sim.LAST_ORDER == .Grab_Carry)))
         { // Kneestand or take
             player.sprite2.y = player.sprite.y - 4;
             if (player.sprite.flipped) {
@@ -381,7 +384,7 @@ pub fn move_player(arg_context: *render.ScreenContext, arg_level: *lvl.Level) c_
             }
         } else {
             if ((player.sprite.number == 14) or // Sliding down the ladder OR
-                (globals.LAST_ORDER.withoutCarry() != .Grab and globals.LAST_ORDER.withoutCarry() != .Drop)) // Not taking or dropping
+                (level.state.sim.LAST_ORDER.withoutCarry() != .Grab and level.state.sim.LAST_ORDER.withoutCarry() != .Drop)) // Not taking or dropping
             { // Not throwing/dropping
                 player.sprite2.x = player.sprite.x + 2;
                 if ((player.sprite.number == 23) or // Climbing (c)
@@ -397,46 +400,45 @@ pub fn move_player(arg_context: *render.ScreenContext, arg_level: *lvl.Level) c_
             }
         }
     }
-    if (globals.SEECHOC_FLAG != 0) {
-        globals.SEECHOC_FLAG -= 1;
-        if (globals.SEECHOC_FLAG == 0) {
+    if (level.state.sim.SEECHOC_FLAG != 0) {
+        level.state.sim.SEECHOC_FLAG -= 1;
+        if (level.state.sim.SEECHOC_FLAG == 0) {
             player.sprite2.enabled = false;
         }
     }
 
     // Part 5: decrease the timers
     common.subto0(&player.*.sprite.invincibility_frames);
-    common.subto0(&globals.INVULNERABLE_FLAG);
-    common.subto0(&globals.RESETLEVEL_FLAG);
-    common.subto0(&globals.TAPISFLY_FLAG);
-    common.subto0(&globals.CROSS_FLAG);
-    common.subto0(&globals.GRAVITY_FLAG);
-    common.subto0(&globals.FURTIF_FLAG);
-    common.subto0(&globals.KICK_FLAG);
+    common.subto0(&level.state.sim.INVULNERABLE_FLAG);
+    common.subto0(&level.state.sim.RESETLEVEL_FLAG);
+    common.subto0(&level.state.sim.TAPISFLY_FLAG);
+    common.subto0(&level.state.sim.CROSS_FLAG);
+    common.subto0(&level.state.sim.GRAVITY_FLAG);
+    common.subto0(&level.state.sim.FURTIF_FLAG);
+    common.subto0(&level.state.sim.KICK_FLAG);
     if (player.sprite.speed_y == 0) {
-        common.subto0(&globals.CHOC_FLAG);
+        common.subto0(&level.state.sim.CHOC_FLAG);
     }
     if (player.*.sprite.speed_x == 0 and player.*.sprite.speed_y == 0) {
-        globals.KICK_FLAG = 0;
+        level.state.sim.KICK_FLAG = 0;
     }
-    common.subto0(&globals.FUME_FLAG);
-    if ((globals.FUME_FLAG != 0) and ((globals.FUME_FLAG & 0x03) == 0)) {
+    common.subto0(&level.state.sim.FUME_FLAG);
+    if ((level.state.sim.FUME_FLAG != 0) and ((level.state.sim.FUME_FLAG & 0x03) == 0)) {
         sprites.updatesprite(level, &player.sprite2, player.sprite2.number + 1, false);
         if (player.sprite2.number == globals.FIRST_OBJET + 19) {
             player.sprite2.enabled = false;
-            globals.FUME_FLAG = 0;
+            level.state.sim.FUME_FLAG = 0;
         }
     }
-    return 0;
 }
 
 fn DEC_LIFE(level: *lvl.Level) void {
-    globals.RESETLEVEL_FLAG = 10;
-    globals.BAR_FLAG = 0;
-    if (level.lives == 0) {
-        globals.GAMEOVER_FLAG = true;
+    level.state.sim.RESETLEVEL_FLAG = 10;
+    level.state.sim.BAR_FLAG = 0;
+    if (level.state.lives == 0) {
+        level.state.sim.GAMEOVER_FLAG = true;
     } else {
-        globals.LOSELIFE_FLAG = true;
+        level.state.sim.LOSELIFE_FLAG = true;
     }
 }
 
@@ -445,26 +447,26 @@ fn CASE_DEAD_IM(level: *lvl.Level) void {
     // Sets RESET_FLAG to 2, in opposite to being killed as a result of 0 HP (then
     // RESET_FLAG is 10)
     DEC_LIFE(level);
-    globals.RESETLEVEL_FLAG = 2;
+    level.state.sim.RESETLEVEL_FLAG = 2;
 }
 
 fn player_collide(level: *lvl.Level) void {
     // Collision detection between player
     // and tiles/objects/elevators
     // Point the foot on the block!
-    const player = &level.player;
+    const player = &level.state.player;
     var tileX: i16 = player.sprite.x >> 4;
     var tileY: i16 = (player.*.sprite.y >> 4) - 1;
     const initY = tileY;
 
     // if too low then die!
-    if ((player.sprite.y > ((level.height + 1) << 4)) and !globals.NOCLIP) {
+    if ((player.sprite.y > ((level.definition.height + 1) << 4)) and !globals.NOCLIP) {
         CASE_DEAD_IM(level);
     }
 
     // Test under the feet of the hero and on his head! (In y)
     const TEST_ZONE = 4;
-    globals.YFALL = 0;
+    level.state.sim.YFALL = 0;
     // Find the left tile
     // colltest can be 0 to 15 +- 8 (-1 to -8 will change into 255 to 248)
     var colltest = player.sprite.x & 0x0F;
@@ -478,7 +480,7 @@ fn player_collide(level: *lvl.Level) void {
     // Test the tile for vertical blocking
     TAKE_BLK_AND_YTEST(level, tileY, tileX);
 
-    if (globals.YFALL == 1) { // Have the fall stopped?
+    if (level.state.sim.YFALL == 1) { // Have the fall stopped?
         // No! Is it necessary to test the right tile?
         colltest += TEST_ZONE * 2; // 4 * 2
         //      if (colltest > 255) {
@@ -492,12 +494,12 @@ fn player_collide(level: *lvl.Level) void {
             // Also test the left tile
             TAKE_BLK_AND_YTEST(level, tileY, tileX);
         }
-        if (globals.YFALL == 1) {
-            if (globals.CROSS_FLAG == 0 and globals.CHOC_FLAG == 0) {
+        if (level.state.sim.YFALL == 1) {
+            if (level.state.sim.CROSS_FLAG == 0 and level.state.sim.CHOC_FLAG == 0) {
                 player_collide_with_elevators(level);
-                if (globals.YFALL == 1) {
+                if (level.state.sim.YFALL == 1) {
                     player_collide_with_objects(level); // Player versus objects
-                    if (globals.YFALL == 1) {
+                    if (level.state.sim.YFALL == 1) {
                         player_fall(level); // No wall/elevator/object under the player; fall down!
                     } else {
                         player.GLISSE = 0;
@@ -517,7 +519,7 @@ fn player_collide(level: *lvl.Level) void {
         changeX = 0;
     }
     var height: i16 = player.sprite.spritedata.?.collheight;
-    if ((player.sprite.y > globals.MAP_LIMIT_Y + 1) and (initY >= 0) and (initY < level.height)) {
+    if ((player.sprite.y > globals.MAP_LIMIT_Y + 1) and (initY >= 0) and (initY < level.definition.height)) {
         tileX = (player.sprite.x + changeX) >> 4;
         tileY = initY;
         var first = true;
@@ -542,21 +544,21 @@ fn player_collide(level: *lvl.Level) void {
 fn TAKE_BLK_AND_YTEST(level: *lvl.Level, tileY_in: i16, tileX_in: i16) void {
     var tileY = tileY_in;
     var tileX = tileX_in;
-    const player = &level.*.player;
-    globals.POCKET_FLAG = false;
-    globals.low_ceiling = false;
-    globals.LADDER_FLAG = false;
+    const player = &level.state.player;
+    level.state.sim.POCKET_FLAG = false;
+    level.state.sim.low_ceiling = false;
+    level.state.sim.LADDER_FLAG = false;
     var change: i8 = undefined;
     // if player is too high (<= -1), skip test
     if (player.sprite.y <= -1 or tileY < -1) {
         player_fall(level);
-        globals.YFALL = 255;
+        level.state.sim.YFALL = 255;
         return;
     }
     // if player is too low, skip test
-    if (tileY + 1 >= level.height) {
+    if (tileY + 1 >= level.definition.height) {
         player_fall(level);
-        globals.YFALL = 255;
+        level.state.sim.YFALL = 255;
         return;
     }
     // In order to fall down in the right chamber if jumping above level 8
@@ -566,7 +568,7 @@ fn TAKE_BLK_AND_YTEST(level: *lvl.Level, tileY_in: i16, tileX_in: i16) void {
     const floor = level.getTileFloor(tileX, tileY + 1);
     const floor_above = level.getTileFloor(tileX, tileY);
 
-    if (globals.LAST_ORDER.withoutCarry() != .Jump) {
+    if (level.state.sim.LAST_ORDER.withoutCarry() != .Jump) {
         // Player versus floor
         BLOCK_YYPRG(level, floor, floor_above, tileY + 1, tileX);
     }
@@ -604,7 +606,7 @@ fn TAKE_BLK_AND_YTEST(level: *lvl.Level, tileY_in: i16, tileX_in: i16) void {
 fn BLOCK_YYPRGD(level: *lvl.Level, cflag: lvl.CeilingType, tileY_in: i16, tileX_in: i16) void {
     var tileX = tileX_in;
     var tileY = tileY_in;
-    const player = &level.player;
+    const player = &level.state.player;
 
     // Action on different ceiling flags
     switch (cflag) {
@@ -616,13 +618,13 @@ fn BLOCK_YYPRGD(level: *lvl.Level, cflag: lvl.CeilingType, tileY_in: i16, tileX_
                 // Stop movement
                 player.sprite.speed_y = 0;
                 player.sprite.y = @as(i16, @bitCast(@as(u16, @bitCast(player.sprite.y)) & 0xFFF0)) + 16;
-                globals.jump_acceleration_counter = 0xFF;
+                level.state.sim.jump_acceleration_counter = 0xFF;
             } else if (player.sprite.number != 10 and // 10 = Free fall
                 player.sprite.number != 21 and // 21 = Free fall (c)
-                globals.jump_timer != 6)
+                level.state.sim.jump_timer != 6)
             {
-                globals.low_ceiling = true;
-                if (globals.CARRY_FLAG) {
+                level.state.sim.low_ceiling = true;
+                if (level.state.sim.CARRY_FLAG) {
                     const maybe_object = player_drop_carried(level);
                     if (maybe_object) |object| {
                         tileX = object.sprite.x >> 4;
@@ -646,8 +648,8 @@ fn BLOCK_YYPRGD(level: *lvl.Level, cflag: lvl.CeilingType, tileY_in: i16, tileX_
             //if (player.sprite.speed_y < 0 and player.sprite.speed_x == 0) {
             //if (player.sprite.speed_y <= 0 and player.y_axis < 0 and player.x_axis == 0) {
             if (player.sprite.speed_y <= 0 and player.y_axis < 0) {
-                globals.jump_acceleration_counter = 10;
-                globals.LADDER_FLAG = true;
+                level.state.sim.jump_acceleration_counter = 10;
+                level.state.sim.LADDER_FLAG = true;
             }
         },
         .Padlock => {
@@ -685,24 +687,23 @@ fn BLOCK_XXPRG(level: *lvl.Level, hflag: lvl.WallType, tileY: i16, tileX: i16) v
 }
 
 fn player_block_x(level: *lvl.Level) void {
-    const player = &level.player;
+    const player = &level.state.player;
     // Horizontal hit (wall), stop the player
     player.sprite.x -= player.sprite.speed_x >> 4;
     player.sprite.speed_x = 0;
-    if (globals.KICK_FLAG != 0 and globals.jump_timer != 6) {
-        globals.CHOC_FLAG = 20;
-        globals.KICK_FLAG = 0;
+    if (level.state.sim.KICK_FLAG != 0 and level.state.sim.jump_timer != 6) {
+        level.state.sim.CHOC_FLAG = 20;
+        level.state.sim.KICK_FLAG = 0;
     }
 }
 
 pub fn player_drop_carried(level: *lvl.Level) ?*lvl.Object {
-    const sprite2 = &level.*.player.sprite2;
-    if (!sprite2.enabled or !globals.CARRY_FLAG)
+    const sprite2 = &level.state.player.sprite2;
+    if (!sprite2.enabled or !level.state.sim.CARRY_FLAG)
         return null;
 
-    for (&level.*.object) |*object| {
-        if (object.sprite.enabled)
-            continue;
+    if (level.state.object.claim(0)) |i| {
+        const object = &level.object[i];
         objects.updateobjectsprite(level, object, sprite2.number, true);
         sprite2.enabled = false;
         object.sprite.killing = false;
@@ -717,10 +718,11 @@ pub fn player_drop_carried(level: *lvl.Level) ?*lvl.Object {
         object.sprite.speed_y = 0;
         object.sprite.speed_x = 0;
         object.sprite.UNDER = 0;
-        object.sprite.ONTOP = null;
-        globals.POSEREADY_FLAG = true;
-        globals.GRAVITY_FLAG = 4;
-        globals.CARRY_FLAG = false;
+        object.sprite.ONTOP = .none;
+        spatial.grid.update(.{ .kind = .Object, .index = i }, &object.sprite);
+        level.state.sim.POSEREADY_FLAG = true;
+        level.state.sim.GRAVITY_FLAG = 4;
+        level.state.sim.CARRY_FLAG = false;
         return object;
     }
     std.log.err("Could not drop carried object: it was not found!", .{});
@@ -729,28 +731,28 @@ pub fn player_drop_carried(level: *lvl.Level) ?*lvl.Object {
 
 fn player_fall(level: *lvl.Level) void {
     // No wall under the player; fall down!
-    const player = &level.player;
-    globals.jump_timer = 6;
-    if (globals.KICK_FLAG != 0) {
+    const player = &level.state.player;
+    level.state.sim.jump_timer = 6;
+    if (level.state.sim.KICK_FLAG != 0) {
         return;
     }
-    XACCELERATION(player, globals.MAX_X * 16);
+    XACCELERATION(level, player, globals.MAX_X * 16);
     YACCELERATION(player, globals.MAX_Y * 16);
-    if (globals.CHOC_FLAG != 0) {
+    if (level.state.sim.CHOC_FLAG != 0) {
         sprites.updatesprite(level, &player.sprite, 15, true); // sprite when hit
-    } else if (!globals.CARRY_FLAG) {
+    } else if (!level.state.sim.CARRY_FLAG) {
         sprites.updatesprite(level, &player.sprite, 10, true); // position while falling  (jump sprite?)
     } else {
         sprites.updatesprite(level, &player.sprite, 21, true); // position falling and carry  (jump and carry sprite?)
     }
-    player.*.sprite.flipped = globals.SENSX < 0;
+    player.*.sprite.flipped = level.state.sim.SENSX < 0;
 }
 
-fn XACCELERATION(player: *lvl.Player, maxspeed: i16) void {
+fn XACCELERATION(level: *lvl.Level, player: *lvl.Player, maxspeed: i16) void {
     // Sideway acceleration
     var changeX: i16 = undefined;
     if (player.x_axis != 0) {
-        changeX = (globals.SENSX << 4) >> @truncate(player.GLISSE);
+        changeX = (level.state.sim.SENSX << 4) >> @truncate(player.GLISSE);
     } else {
         changeX = 0;
     }
@@ -775,52 +777,52 @@ fn YACCELERATION(player: *lvl.Player, maxspeed: i16) void {
 
 fn BLOCK_YYPRG(level: *lvl.Level, floor: lvl.FloorType, floor_above: lvl.FloorType, tileY: i16, tileX: i16) void {
     // Action on different floor flags
-    const player = &level.player;
+    const player = &level.state.player;
     switch (floor) {
         .NoFloor => {
-            player_fall_F();
+            player_fall_F(level);
         },
         .Floor => {
-            player_block_yu(player);
+            player_block_yu(level, player);
         },
         .SlightlySlipperyFloor => {
-            player_block_yu(player);
+            player_block_yu(level, player);
             player.GLISSE = 1;
         },
         .SlipperyFloor => {
-            player_block_yu(player);
+            player_block_yu(level, player);
             player.GLISSE = 2;
         },
         .VerySlipperyFloor => {
-            player_block_yu(player);
+            player_block_yu(level, player);
             player.GLISSE = 3;
         },
         // Drop-through if kneestanding
         .Drop => {
             player.GLISSE = 0;
-            if (globals.CROSS_FLAG == 0) {
-                player_block_yu(player);
+            if (level.state.sim.CROSS_FLAG == 0) {
+                player_block_yu(level, player);
             } else {
-                player_fall_F();
+                player_fall_F(level);
             }
         },
         .Ladder => {
             // Fall if hit
-            if (globals.CHOC_FLAG != 0) {
-                player_fall_F(); // Free fall
+            if (level.state.sim.CHOC_FLAG != 0) {
+                player_fall_F(level); // Free fall
                 return;
             }
-            const order = globals.LAST_ORDER.withoutCarry();
-            const is_in_air = globals.YFALL != 0 or globals.jump_acceleration_counter != 0;
+            const order = level.state.sim.LAST_ORDER.withoutCarry();
+            const is_in_air = level.state.sim.YFALL != 0 or level.state.sim.jump_acceleration_counter != 0;
             // Skip if walking/crawling
             if (order == .Walk or order == .Crawl or order == .Grab or order == .Drop or order == .KneeStand or order == .Rest) {
                 if(player.y_axis <= 0 and !is_in_air) {
-                    player_block_yu(player); // Stop fall
+                    player_block_yu(level, player); // Stop fall
                     return;
                 }
                 else
                 {
-                    player_fall_F(); // Free fall
+                    player_fall_F(level); // Free fall
                     const flip = player.sprite.flipped;
                     sprites.updatesprite(level, &player.sprite, 14, true); // sprite: start climbing down
                     player.sprite.flipped = flip;
@@ -830,20 +832,20 @@ fn BLOCK_YYPRG(level: *lvl.Level, floor: lvl.FloorType, floor_above: lvl.FloorTy
             // we stand on top of a ladder
             if (floor_above != .Ladder) { // ladder
 //                 if (order == .Rest) { // action repos
-//                     player_block_yu(player); // Stop fall
+//                     player_block_yu(level, player); // Stop fall
 //                     return;
 //                 }
                 if (player.y_axis < 0 and order == .Climb) { // action UP + climb ladder
-                    player_block_yu(player); // Stop fall
+                    player_block_yu(level, player); // Stop fall
                     return;
                 }
             }
 
-            common.subto0(&globals.jump_timer);
-            globals.jump_acceleration_counter = 0;
-            globals.YFALL = 2;
+            common.subto0(&level.state.sim.jump_timer);
+            level.state.sim.jump_acceleration_counter = 0;
+            level.state.sim.YFALL = 2;
 
-            globals.LADDER_FLAG = true;
+            level.state.sim.LADDER_FLAG = true;
         },
         .Bonus => {
             _ = collect_bonus(level, tileY, tileX);
@@ -852,7 +854,7 @@ fn BLOCK_YYPRG(level: *lvl.Level, floor: lvl.FloorType, floor_above: lvl.FloorTy
             if (!globals.GODMODE) {
                 CASE_DEAD_IM(level);
             } else {
-                player_block_yu(player); // If godmode; ordinary floor
+                player_block_yu(level, player); // If godmode; ordinary floor
             }
         },
         .Code => {
@@ -867,43 +869,38 @@ fn BLOCK_YYPRG(level: *lvl.Level, floor: lvl.FloorType, floor_above: lvl.FloorTy
     }
 }
 
-fn player_fall_F() void {
-    globals.YFALL = globals.YFALL | 0x01;
+fn player_fall_F(level: *lvl.Level) void {
+    level.state.sim.YFALL = level.state.sim.YFALL | 0x01;
 }
 
-fn player_block_yu(player: *lvl.Player) void {
+fn player_block_yu(level: *lvl.Level, player: *lvl.Player) void {
     // Floor; the player will not fall through
-    globals.POCKET_FLAG = true;
+    level.state.sim.POCKET_FLAG = true;
     player.GLISSE = 0;
     if (player.sprite.speed_y < 0) {
-        globals.YFALL = globals.YFALL | 0x01;
+        level.state.sim.YFALL = level.state.sim.YFALL | 0x01;
         return;
     }
     player.sprite.y = @bitCast(@as(u16, @bitCast(player.sprite.y)) & 0xFFF0);
     player.sprite.speed_y = 0;
-    common.subto0(&globals.jump_timer);
-    globals.jump_acceleration_counter = 0;
-    globals.YFALL = 2;
+    common.subto0(&level.state.sim.jump_timer);
+    level.state.sim.jump_acceleration_counter = 0;
+    level.state.sim.YFALL = 2;
 }
 
 fn collect_bonus(level: *lvl.Level, tileY: i16, tileX: i16) bool {
     // Handle bonuses. Increase energy if HP, and change the bonus tile to normal tile
-    for (&level.bonus) |*bonus| {
-        if (!bonus.exists)
-            continue;
-        if (bonus.x != tileX or bonus.y != tileY)
-            continue;
-
-        if (bonus.bonustile >= (255 - 2)) {
-            level.bonuscollected += 1;
-            events.triggerEvent(.PlayerCollectBonus);
-            INC_ENERGY(level);
-        }
-        level.setTile(@intCast(tileX), @intCast(tileY), bonus.replacetile);
-        globals.GRAVITY_FLAG = 4;
-        return true;
+    const i = level.findBonus(tileX, tileY) orelse return false;
+    const bonus = &level.definition.bonus[i];
+    if (bonus.bonustile >= (255 - 2)) {
+        level.state.bonuscollected += 1;
+        level.triggerEvent(.PlayerCollectBonus);
+        INC_ENERGY(level);
     }
-    return false;
+    level.state.bonus_taken.set(i);
+    level.setTile(@intCast(tileX), @intCast(tileY), bonus.replacetile);
+    level.state.sim.GRAVITY_FLAG = 4;
+    return true;
 }
 
 fn collect_level_unlock(level: *lvl.Level, level_index: u8, tileY: i16, tileX: i16) void {
@@ -911,19 +908,22 @@ fn collect_level_unlock(level: *lvl.Level, level_index: u8, tileY: i16, tileX: i
     // if the bonus is found in the bonus list
     if (!collect_bonus(level, tileY, tileX))
         return;
+    // Headless runs have no save game loaded, and must not write one
+    if (level.headless)
+        return;
     const allocator = std.heap.page_allocator;
-    game_state.unlock_level(allocator, level_index, level.lives) catch |err| {
+    game_state.unlock_level(allocator, level_index, level.state.lives) catch |err| {
         std.log.err("Failed to save progression: {s}", .{ @errorName(err) });
     };
-    events.triggerEvent(.PlayerCollectLamp);
+    level.triggerEvent(.PlayerCollectLamp);
 }
 
 fn collect_checkpoint(level: *lvl.Level, tileY: i16, tileX: i16) void {
     if (!collect_bonus(level, tileY, tileX))
         return;
 
-    const player = &level.player;
-    events.triggerEvent(.PlayerCollectWaypoint);
+    const player = &level.state.player;
+    level.triggerEvent(.PlayerCollectWaypoint);
     player.initX = player.sprite.x;
     player.initY = player.sprite.y;
     // carrying cage?
@@ -934,19 +934,19 @@ fn collect_checkpoint(level: *lvl.Level, tileY: i16, tileX: i16) void {
 }
 
 fn INC_ENERGY(level: *lvl.Level) void {
-    const player = &level.player;
-    globals.BAR_FLAG = 50;
+    const player = &level.state.player;
+    level.state.sim.BAR_FLAG = 50;
     if (player.hp == globals.MAXIMUM_ENERGY) {
-        level.extrabonus += 1;
+        level.state.extrabonus += 1;
     } else {
         player.hp += 1;
     }
 }
 
 pub fn DEC_ENERGY(level: *lvl.Level) void {
-    const player = &level.player;
-    globals.BAR_FLAG = 50;
-    if (globals.RESETLEVEL_FLAG == 0) {
+    const player = &level.state.player;
+    level.state.sim.BAR_FLAG = 50;
+    if (level.state.sim.RESETLEVEL_FLAG == 0) {
         if (player.hp > 0) {
             player.hp -= 1;
         }
@@ -959,7 +959,7 @@ pub fn DEC_ENERGY(level: *lvl.Level) void {
 
 // Action dependent code
 fn ACTION_PRG(level: *lvl.Level, action: PlayerAction) void {
-    const player = &level.player;
+    const player = &level.state.player;
     var tileX: i16 = undefined;
     var tileY: i16 = undefined;
     var diffX: i16 = undefined;
@@ -969,81 +969,81 @@ fn ACTION_PRG(level: *lvl.Level, action: PlayerAction) void {
     switch (action) {
         .Rest, .SilentRest, .Rest_Carry => {
             // Rest. Handle deacceleration and slide
-            globals.LAST_ORDER = action;
+            level.state.sim.LAST_ORDER = action;
             player_friction(player);
             if (@abs(player.*.sprite.speed_x) >= 1 * 16 and player.sprite.flipped == (player.*.sprite.speed_x < 0)) {
-                player.sprite.animation = data.get_anim_player(if (globals.CARRY_FLAG) .Slide_Carry else .Slide);
+                player.sprite.animation = data.get_anim_player(if (level.state.sim.CARRY_FLAG) .Slide_Carry else .Slide);
             } else {
                 player.sprite.animation = data.get_anim_player(action);
             }
             sprites.updatesprite(level, &player.sprite, player.sprite.animation.*, true);
-            player.sprite.flipped = globals.SENSX < 0;
+            player.sprite.flipped = level.state.sim.SENSX < 0;
         },
         .Walk, .Walk_Carry, .Crawl_Carry => {
             // Handle walking
-            XACCELERATION(player, globals.MAX_X * 16);
-            NEW_FORM(player, action); // Update last order and action (animation)
+            XACCELERATION(level, player, globals.MAX_X * 16);
+            NEW_FORM(level, player, action); // Update last order and action (animation)
             GET_IMAGE(level); // Update player sprite
         },
         .Jump, .Jump_Carry => {
             // Handle a jump
-            if (globals.jump_acceleration_counter == 0) {
-                events.triggerEvent(.PlayerJump);
+            if (level.state.sim.jump_acceleration_counter == 0) {
+                level.triggerEvent(.PlayerJump);
             }
-            if (globals.jump_acceleration_counter >= 3) {
-                globals.jump_timer = 6; // Stop jump animation and acceleration
+            if (level.state.sim.jump_acceleration_counter >= 3) {
+                level.state.sim.jump_timer = 6; // Stop jump animation and acceleration
             } else {
-                globals.jump_acceleration_counter +%= 1;
+                level.state.sim.jump_acceleration_counter +%= 1;
                 YACCELERATION_NEG(player, globals.MAX_Y * 16 / 4);
-                XACCELERATION(player, globals.MAX_X * 16);
-                NEW_FORM(player, action);
+                XACCELERATION(level, player, globals.MAX_X * 16);
+                NEW_FORM(level, player, action);
                 GET_IMAGE(level);
             }
         },
         .Crawl => {
             // Handle crawling
-            NEW_FORM(player, action);
+            NEW_FORM(level, player, action);
             GET_IMAGE(level);
-            XACCELERATION(player, @divTrunc(globals.MAX_X * 16, 2));
+            XACCELERATION(level, player, @divTrunc(globals.MAX_X * 16, 2));
             if (@abs(player.sprite.speed_x) < (2 * 16)) {
                 sprites.updatesprite(level, &player.sprite, 6, true); // Crawling but not moving
-                player.*.sprite.flipped = globals.SENSX < 0;
+                player.*.sprite.flipped = level.state.sim.SENSX < 0;
             }
         },
         .KneeStand => {
             // Kneestand
-            NEW_FORM(player, action);
+            NEW_FORM(level, player, action);
             GET_IMAGE(level);
             player_friction(player);
-            if (globals.ACTION_TIMER == 15) {
-                globals.CROSS_FLAG = 6;
+            if (level.state.sim.ACTION_TIMER == 15) {
+                level.state.sim.CROSS_FLAG = 6;
                 player.sprite.speed_y = 0;
             }
         },
         .Climb, .Climb_Carry => {
             // Climb a ladder
             if (player.x_axis != 0) {
-                XACCELERATION(player, globals.MAX_X * 16);
-                player.sprite.flipped = globals.SENSX < 0;
+                XACCELERATION(level, player, globals.MAX_X * 16);
+                player.sprite.flipped = level.state.sim.SENSX < 0;
             } else {
                 player_friction(player);
             }
-            if (globals.ACTION_TIMER <= 1) {
-                if (!globals.CARRY_FLAG) {
+            if (level.state.sim.ACTION_TIMER <= 1) {
+                if (!level.state.sim.CARRY_FLAG) {
                     sprites.updatesprite(level, &player.sprite, 12, true); // Last climb sprite
                 } else {
                     sprites.updatesprite(level, &player.sprite, 23, true); // First climb sprite (c)
                 }
             }
-            const is_in_air = globals.YFALL != 0 or globals.jump_acceleration_counter != 0;
+            const is_in_air = level.state.sim.YFALL != 0 or level.state.sim.jump_acceleration_counter != 0;
             // attach to ladder in air
-            if(is_in_air and (globals.LAST_ORDER != .Climb and globals.LAST_ORDER != .Climb_Carry)) {
-                NEW_FORM(player, if (globals.CARRY_FLAG) .Climb_Carry else .Climb);
+            if(is_in_air and (level.state.sim.LAST_ORDER != .Climb and level.state.sim.LAST_ORDER != .Climb_Carry)) {
+                NEW_FORM(level, player, if (level.state.sim.CARRY_FLAG) .Climb_Carry else .Climb);
                 GET_IMAGE(level);
                 player.sprite.speed_y = 0;
             }
             if (player.y_axis != 0) {
-                NEW_FORM(player, if (globals.CARRY_FLAG) .Climb_Carry else .Climb);
+                NEW_FORM(level, player, if (level.state.sim.CARRY_FLAG) .Climb_Carry else .Climb);
                 GET_IMAGE(level);
 
                 // Snap to the ladder they are climbing
@@ -1078,11 +1078,11 @@ fn ACTION_PRG(level: *lvl.Level, action: PlayerAction) void {
         },
         .Grab, .Grab_Carry => {
             // Take a box
-            NEW_FORM(player, action);
+            NEW_FORM(level, player, action);
             GET_IMAGE(level);
             player_friction(player);
-            if (!globals.POSEREADY_FLAG) {
-                if (globals.ACTION_TIMER == 1 and globals.CARRY_FLAG) {
+            if (!level.state.sim.POSEREADY_FLAG) {
+                if (level.state.sim.ACTION_TIMER == 1 and level.state.sim.CARRY_FLAG) {
                     // If the object is placed in a block, fix a speed_x
                     const maybe_object = player_drop_carried(level);
                     if (maybe_object) |object| {
@@ -1100,8 +1100,11 @@ fn ACTION_PRG(level: *lvl.Level, action: PlayerAction) void {
                         }
                     }
                 } else {
-                    if (!globals.CARRY_FLAG) {
-                        for (&level.object) |*object| {
+                    if (!level.state.sim.CARRY_FLAG) {
+                        const candidates = spatial.grid.near(player.sprite.x, player.sprite.y, 128, 20);
+                        var objects_near = spatial.KindIterator.init(&candidates, .Object);
+                        while (objects_near.next()) |index| {
+                            const object = &level.object[index];
                             // First do a quick test
                             if (!object.sprite.enabled or @abs(player.sprite.y - object.sprite.y) >= 20) {
                                 continue;
@@ -1143,17 +1146,18 @@ fn ACTION_PRG(level: *lvl.Level, action: PlayerAction) void {
                             }
 
                             // Take the object
-                            events.triggerEvent(.PlayerPickup);
-                            globals.FUME_FLAG = 0;
+                            level.triggerEvent(.PlayerPickup);
+                            level.state.sim.FUME_FLAG = 0;
                             object.sprite.speed_y = 0;
                             object.sprite.speed_x = 0;
-                            globals.GRAVITY_FLAG = 4;
+                            level.state.sim.GRAVITY_FLAG = 4;
                             sprites.copysprite(level, &player.*.sprite2, &object.sprite);
-                            object.sprite.enabled = false;
-                            globals.CARRY_FLAG = true;
-                            globals.SEECHOC_FLAG = 0;
+                            level.removeObject(index);
+                            spatial.grid.update(.{ .kind = .Object, .index = index }, &object.sprite);
+                            level.state.sim.CARRY_FLAG = true;
+                            level.state.sim.SEECHOC_FLAG = 0;
                             if (player.sprite2.number == globals.FIRST_OBJET + 19) { // flying carpet
-                                globals.TAPISWAIT_FLAG = 0;
+                                level.state.sim.TAPISWAIT_FLAG = 0;
                             }
                             player.sprite2.y = player.sprite.y - 4;
                             if (player.sprite.flipped) {
@@ -1163,8 +1167,10 @@ fn ACTION_PRG(level: *lvl.Level, action: PlayerAction) void {
                             }
                             break;
                         }
-                        if (!globals.CARRY_FLAG) { // No objects taken, check if he picks up an enemy!
-                            for (&level.enemy) |*enemy| {
+                        if (!level.state.sim.CARRY_FLAG) { // No objects taken, check if he picks up an enemy!
+                            var enemies_near = spatial.KindIterator.init(&candidates, .Enemy);
+                            while (enemies_near.next()) |index| {
+                                const enemy = &level.enemy[index];
                                 if (!enemy.sprite.enabled or @abs(player.sprite.y - enemy.sprite.y) >= 20) {
                                     continue;
                                 }
@@ -1219,19 +1225,19 @@ fn ACTION_PRG(level: *lvl.Level, action: PlayerAction) void {
                                     }
                                 }
 
-                                events.triggerEvent(.PlayerPickupEnemy);
-                                globals.FUME_FLAG = 0;
+                                level.triggerEvent(.PlayerPickupEnemy);
+                                level.state.sim.FUME_FLAG = 0;
                                 enemy.sprite.speed_y = 0;
                                 enemy.sprite.speed_x = 0;
-                                globals.GRAVITY_FLAG = 4;
+                                level.state.sim.GRAVITY_FLAG = 4;
                                 player.*.sprite2.flipped = enemy.sprite.flipped;
                                 player.*.sprite2.flash = enemy.sprite.flash;
                                 player.*.sprite2.invincibility_frames = enemy.sprite.invincibility_frames;
                                 player.*.sprite2.visible = enemy.sprite.visible;
                                 sprites.updatesprite(level, &player.sprite2, enemy.carry_sprite, false);
                                 enemy.sprite.enabled = false;
-                                globals.CARRY_FLAG = true;
-                                globals.SEECHOC_FLAG = 0;
+                                level.state.sim.CARRY_FLAG = true;
+                                level.state.sim.SEECHOC_FLAG = 0;
                                 player.sprite2.y = player.sprite.y - 4;
                                 if (player.sprite.flipped) {
                                     player.sprite2.x = player.sprite.x - 10;
@@ -1244,15 +1250,15 @@ fn ACTION_PRG(level: *lvl.Level, action: PlayerAction) void {
                     } // condition (!CARRY_FLAG), check for object/enemy pickup
                 } // condition ((ACTION_TIMER == 1) and (CARRY_FLAG)),
             } // condition (POSEREADY_FLAG == 0)
-            globals.POSEREADY_FLAG = true;
+            level.state.sim.POSEREADY_FLAG = true;
         },
         .Drop, .Drop_Carry => {
             // Throw
-            NEW_FORM(player, action);
+            NEW_FORM(level, player, action);
             GET_IMAGE(level);
             player_friction(player);
 
-            if (!globals.CARRY_FLAG)
+            if (!level.state.sim.CARRY_FLAG)
                 return;
 
             if (player.aim_direction == .Forward) {
@@ -1274,54 +1280,54 @@ fn ACTION_PRG(level: *lvl.Level, action: PlayerAction) void {
                 }
             } else {
                 if (player.sprite2.number < globals.FIRST_NMI) {
-                    if (level.objectdata[@intCast(player.sprite2.number - globals.FIRST_OBJET)].gravity) {
+                    if (level.definition.objectdata[@intCast(player.sprite2.number - globals.FIRST_OBJET)].gravity) {
                         // Gravity throw
                         if (player_drop_carried(level)) |object| {
                             object.*.sprite.speed_y = speed_y;
                             object.*.sprite.speed_x = speed_x - (speed_x >> 2);
-                            events.triggerEvent(.PlayerThrow);
+                            level.triggerEvent(.PlayerThrow);
                         }
                     } else { // Ordinary throw
-                        globals.DROP_FLAG = true;
+                        level.state.sim.DROP_FLAG = true;
                         player.sprite2.speed_x = speed_x;
                         player.sprite2.speed_y = speed_y;
-                        events.triggerEvent(.PlayerThrow);
+                        level.triggerEvent(.PlayerThrow);
                     }
                 } else { // Ordinary throw
-                    globals.DROP_FLAG = true;
+                    level.state.sim.DROP_FLAG = true;
                     player.sprite2.speed_x = speed_x;
                     player.sprite2.speed_y = speed_y;
-                    events.triggerEvent(.PlayerThrow);
+                    level.triggerEvent(.PlayerThrow);
                 }
             }
             sprites.updatesprite(level, &player.sprite, 10, true); // The same as in free fall
-            player.sprite.flipped = globals.SENSX < 0;
-            globals.CARRY_FLAG = false;
+            player.sprite.flipped = level.state.sim.SENSX < 0;
+            level.state.sim.CARRY_FLAG = false;
         },
         .SilentWalk => {
-            XACCELERATION(player, (globals.MAX_X - 1) * 16);
-            NEW_FORM(player, action);
+            XACCELERATION(level, player, (globals.MAX_X - 1) * 16);
+            NEW_FORM(level, player, action);
             GET_IMAGE(level);
         },
         .Headache => {
             player.*.sprite.speed_x = 0;
-            NEW_FORM(player, action);
+            NEW_FORM(level, player, action);
             GET_IMAGE(level);
         },
         .Hit, .HitBurn, .Hit_Carry, .HitBurn_Carry => {
             YACCELERATION(player, globals.MAX_Y * 16);
-            NEW_FORM(player, action);
+            NEW_FORM(level, player, action);
             GET_IMAGE(level);
         },
         .KneeStand_Carry => {
-            NEW_FORM(player, action);
+            NEW_FORM(level, player, action);
             GET_IMAGE(level);
             player_friction(player);
         },
         .Headache_Carry => {
             _ = player_drop_carried(level);
             player.*.sprite.speed_x = 0;
-            NEW_FORM(player, action);
+            NEW_FORM(level, player, action);
             GET_IMAGE(level);
         },
         else => {},
@@ -1346,16 +1352,16 @@ fn player_friction(player: *lvl.Player) void {
     player.sprite.speed_x = speed;
 }
 
-fn NEW_FORM(player: *lvl.Player, action: PlayerAction) void {
+fn NEW_FORM(level: *lvl.Level, player: *lvl.Player, action: PlayerAction) void {
     // if the order is changed, change player animation
-    if (globals.LAST_ORDER != action or player.sprite.animation == null) {
-        globals.LAST_ORDER = action;
+    if (level.state.sim.LAST_ORDER != action or player.sprite.animation == null) {
+        level.state.sim.LAST_ORDER = action;
         player.sprite.animation = data.get_anim_player(action);
     }
 }
 
 fn GET_IMAGE(level: *lvl.Level) void {
-    const player = &level.player;
+    const player = &level.state.player;
     var frame: i16 = player.sprite.animation.*;
     if (@as(c_int, @bitCast(@as(c_int, frame))) < 0) {
         if (@as(c_int, @bitCast(@as(c_int, frame))) == -1) {
@@ -1365,7 +1371,7 @@ fn GET_IMAGE(level: *lvl.Level) void {
         frame = player.*.sprite.animation.*;
     }
     sprites.updatesprite(level, &player.*.sprite, frame, true);
-    player.*.sprite.flipped = @as(c_int, @bitCast(@as(c_int, globals.SENSX))) < 0;
+    player.*.sprite.flipped = @as(c_int, @bitCast(@as(c_int, level.state.sim.SENSX))) < 0;
     player.*.sprite.animation += 1;
 }
 
@@ -1382,22 +1388,25 @@ fn YACCELERATION_NEG(player: *lvl.Player, maxspeed_in: i16) void {
 fn player_collide_with_elevators(level: *lvl.Level) void {
     // Player versus elevators
     // Change player's location according to the elevator
-    const player = &level.player;
-    if (player.sprite.speed_y < 0 or globals.CROSS_FLAG != 0)
+    const player = &level.state.player;
+    if (player.sprite.speed_y < 0 or level.state.sim.CROSS_FLAG != 0)
         return;
 
-    for (&level.elevator) |*elevator| {
-        if (!elevator.enabled or !elevator.sprite.visible)
+    const candidates = spatial.grid.near(player.sprite.x, player.sprite.y, 64, 16);
+    var iter = spatial.KindIterator.init(&candidates, .Elevator);
+    while (iter.next()) |index| {
+        const elevator = &level.elevator[index];
+        if (!elevator.sprite.visible)
             continue;
         if (@abs(elevator.sprite.x - player.sprite.x) >= 64 or @abs(elevator.sprite.y - player.sprite.y) >= 16) {
             continue;
         }
-        if (player.sprite.x - level.spritedata[0].refwidth < elevator.sprite.x) { // The elevator is right
-            if (player.sprite.x - level.spritedata[0].refwidth + level.spritedata[0].collwidth <= elevator.sprite.x) { // player->sprite must be 0
+        if (player.sprite.x - level.definition.spritedata[0].refwidth < elevator.sprite.x) { // The elevator is right
+            if (player.sprite.x - level.definition.spritedata[0].refwidth + level.definition.spritedata[0].collwidth <= elevator.sprite.x) { // player->sprite must be 0
                 continue; // The elevator is too far right
             }
         } else { // The elevator is left
-            if (player.sprite.x - level.spritedata[0].refwidth >= elevator.sprite.x + elevator.sprite.spritedata.?.collwidth) {
+            if (player.sprite.x - level.definition.spritedata[0].refwidth >= elevator.sprite.x + elevator.sprite.spritedata.?.collwidth) {
                 continue; // The elevator is too far left
             }
         }
@@ -1412,17 +1421,17 @@ fn player_collide_with_elevators(level: *lvl.Level) void {
         }
 
         // Skip fall-through-tile action (ACTION_TIMER == 15)
-        if (globals.ACTION_TIMER == 14) {
-            globals.ACTION_TIMER = 16;
+        if (level.state.sim.ACTION_TIMER == 14) {
+            level.state.sim.ACTION_TIMER = 16;
         }
 
-        globals.YFALL = 0;
+        level.state.sim.YFALL = 0;
         player.sprite.y = elevator.sprite.y;
 
         player.sprite.speed_y = 0;
-        common.subto0(&globals.jump_timer);
-        globals.jump_acceleration_counter = 0;
-        globals.YFALL = 2;
+        common.subto0(&level.state.sim.jump_timer);
+        level.state.sim.jump_acceleration_counter = 0;
+        level.state.sim.YFALL = 2;
 
         player.sprite.x += elevator.sprite.speed_x;
         if (elevator.sprite.speed_y > 0) {
@@ -1437,13 +1446,13 @@ fn player_collide_with_elevators(level: *lvl.Level) void {
 // Collision, spring state, speed up carpet/scooter/skateboard, bounce bouncy
 // objects
 fn player_collide_with_objects(level: *lvl.Level) void {
-    const player = &level.player;
+    const player = &level.state.player;
     if (player.sprite.speed_y < 0) {
         return;
     }
     // Collision with a sprite
     var off_object_c: *lvl.Object = undefined;
-    if (!objects.SPRITES_VS_SPRITES(level, &player.sprite, &level.spritedata[@as(c_uint, @intCast(0))], &off_object_c)) {
+    if (!objects.SPRITES_VS_SPRITES(level, &player.sprite, &level.definition.spritedata[@as(c_uint, @intCast(0))], &off_object_c)) {
         return;
     }
     const off_object: *lvl.Object = off_object_c;
@@ -1452,7 +1461,7 @@ fn player_collide_with_objects(level: *lvl.Level) void {
     // If the foot is placed on a spring, it must be soft!
     if (off_object.sprite.number == globals.FIRST_OBJET + 24 or off_object.sprite.number == globals.FIRST_OBJET + 25) {
         off_object.sprite.UNDER = off_object.sprite.UNDER | 0x02;
-        off_object.sprite.ONTOP = &player.sprite;
+        off_object.sprite.ONTOP = .player;
     }
     // If we jump on the flying carpet, let it fly
     if (off_object.sprite.number == globals.FIRST_OBJET + 21 or off_object.sprite.number == globals.FIRST_OBJET + 22) {
@@ -1462,10 +1471,10 @@ fn player_collide_with_objects(level: *lvl.Level) void {
             off_object.sprite.speed_x = 0 - (6 * 16);
         }
         off_object.sprite.flipped = player.sprite.flipped;
-        globals.GRAVITY_FLAG = 4;
-        globals.TAPISWAIT_FLAG = 0;
-    } else if (globals.ACTION_TIMER > 10 and
-        globals.LAST_ORDER.withoutCarry() == .Rest and
+        level.state.sim.GRAVITY_FLAG = 4;
+        level.state.sim.TAPISWAIT_FLAG = 0;
+    } else if (level.state.sim.ACTION_TIMER > 10 and
+        level.state.sim.LAST_ORDER.withoutCarry() == .Rest and
         player.sprite.speed_y == 0 and
         (off_object.sprite.number == 83 or off_object.sprite.number == 94))
     {
@@ -1475,7 +1484,7 @@ fn player_collide_with_objects(level: *lvl.Level) void {
             off_object.sprite.speed_x = 0 - (16 * 3);
         }
         off_object.sprite.flipped = player.sprite.flipped;
-        globals.GRAVITY_FLAG = 4;
+        level.state.sim.GRAVITY_FLAG = 4;
     }
     if (off_object.sprite.speed_x < 0) {
         player.sprite.speed_x = off_object.sprite.speed_x;
@@ -1484,7 +1493,7 @@ fn player_collide_with_objects(level: *lvl.Level) void {
     }
 
     // If we want to CROSS (cross) it does not bounce
-    if (globals.CROSS_FLAG == 0 and // No long kneestand
+    if (level.state.sim.CROSS_FLAG == 0 and // No long kneestand
         (player.sprite.speed_y > 16 * 3) and off_object.objectdata.*.bounce)
     {
         // Bounce on a ball if no long kneestand (down key)
@@ -1501,14 +1510,14 @@ fn player_collide_with_objects(level: *lvl.Level) void {
                 player.sprite.speed_y = 0;
             }
         }
-        globals.ACTION_TIMER = 0;
+        level.state.sim.ACTION_TIMER = 0;
 
         // If the ball lies on the ground
         if (off_object.sprite.speed_y == 0) {
-            events.triggerEvent(.BallBounce);
+            level.triggerEvent(.BallBounce);
             off_object.sprite.speed_y = 0 - player.sprite.speed_y;
             off_object.sprite.y -= off_object.sprite.speed_y >> 4;
-            globals.GRAVITY_FLAG = 4;
+            level.state.sim.GRAVITY_FLAG = 4;
         }
     } else {
         if (off_object.sprite.speed_y != 0) {
@@ -1516,8 +1525,8 @@ fn player_collide_with_objects(level: *lvl.Level) void {
         } else {
             player.sprite.speed_y = 0;
         }
-        common.subto0(&globals.jump_timer);
-        globals.jump_acceleration_counter = 0;
-        globals.YFALL = 2;
+        common.subto0(&level.state.sim.jump_timer);
+        level.state.sim.jump_acceleration_counter = 0;
+        level.state.sim.YFALL = 2;
     }
 }
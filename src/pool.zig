@@ -0,0 +1,103 @@
+//
+// Copyright (C) 2024 The OpenTitus team
+//
+// Authors:
+// Petr Mrázek
+//
+// "Titus the Fox: To Marrakech and Back" (1992) and
+// "Lagaf': Les Aventures de Moktar - Vol 1: La Zoubida" (1991)
+// was developed by, and is probably copyrighted by Titus Software,
+// which, according to Wikipedia, stopped buisness in 2005.
+//
+// OpenTitus is not affiliated with Titus Software.
+//
+// OpenTitus is  free software; you can redistribute  it and/or modify
+// it under the  terms of the GNU General  Public License as published
+// by the Free  Software Foundation; either version 3  of the License,
+// or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+// MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+// General Public License for more details.
+//
+
+const std = @import("std");
+
+// Refers to an entry of a pool. The generation tells it apart from whatever takes the slot after it.
+pub const Handle = struct {
+    index: u8,
+    generation: u8,
+};
+
+// Storage for entities that come and go while a level is played. Entries never move, so an index is
+// good for as long as its entry lives, and a handle kept for longer than that is caught. The live
+// entries are kept in a bitset, so loops only visit those, in slot order like the original game.
+// There are no pointers in here, it is copied with a plain assignment like the rest of the state.
+pub fn Pool(comptime T: type, comptime capacity: usize) type {
+    if (capacity > 256) {
+        @compileError("pool handles only have room for 256 slots");
+    }
+    return struct {
+        const Self = @This();
+        pub const LiveSet = std.StaticBitSet(capacity);
+
+        items: [capacity]T = undefined,
+        live: LiveSet = LiveSet.initEmpty(),
+        generation: [capacity]u8 = @splat(0),
+
+        // Takes the first free slot at or after first
+        pub fn claim(self: *Self, first: usize) ?u8 {
+            for (first..capacity) |i| {
+                if (!self.live.isSet(i)) {
+                    self.live.set(i);
+                    return @intCast(i);
+                }
+            }
+            return null;
+        }
+
+        // Frees a slot, the handles to it stop working
+        pub fn release(self: *Self, index: usize) void {
+            self.live.unset(index);
+            self.generation[index] +%= 1;
+        }
+
+        pub fn handle(self: *const Self, index: usize) Handle {
+            return .{ .index = @intCast(index), .generation = self.generation[index] };
+        }
+
+        pub fn get(self: *Self, h: Handle) ?*T {
+            if (!self.live.isSet(h.index) or self.generation[h.index] != h.generation) {
+                return null;
+            }
+            return &self.items[h.index];
+        }
+
+        pub fn iterator(self: *const Self) LiveSet.Iterator(.{}) {
+            return self.live.iterator(.{});
+        }
+    };
+}
+
+test "handles to a reused slot are stale" {
+    var pool: Pool(u32, 4) = .{};
+    const first = pool.claim(0).?;
+    const second = pool.claim(1).?;
+    try std.testing.expectEqual(@as(u8, 0), first);
+    try std.testing.expectEqual(@as(u8, 1), second);
+
+    const h = pool.handle(second);
+    pool.items[second] = 7;
+    try std.testing.expectEqual(@as(u32, 7), pool.get(h).?.*);
+
+    pool.release(second);
+    try std.testing.expect(pool.get(h) == null);
+    try std.testing.expectEqual(@as(?u8, 1), pool.claim(1));
+    try std.testing.expect(pool.get(h) == null);
+
+    var live = pool.iterator();
+    try std.testing.expectEqual(@as(?usize, 0), live.next());
+    try std.testing.expectEqual(@as(?usize, 1), live.next());
+    try std.testing.expectEqual(@as(?usize, null), live.next());
+}
@@ -30,8 +30,11 @@ const window = @import("window.zig");
 const fonts = @import("ui/fonts.zig");
 const sprites = @import("sprites.zig");
 const lvl = @import("level.zig");
+const scroll = @import("scroll.zig");
+const spatial = @import("spatial.zig");
 const input = @import("input.zig");
 const debug = @import("_debug.zig");
+const audio = @import("audio/audio.zig");
 
 const SDL = @import("SDL.zig");
 
@@ -79,81 +82,168 @@ pub fn flip_screen(context: *ScreenContext, slow: bool) void {
     }
 }
 
-// We use this to fill the whole 320x200 space in most cases instead of not rendering the bottom 8 pixels
-// TODO: actual vertical smooth scrolling instead of this coarse stuff and half-tile workarounds
-fn get_y_offset() u8 {
-    return if (globals.BITMAP_Y == 0) 0 else 8;
+fn get_y_offset(level: *const lvl.Level) i16 {
+    return scroll.base_y_offset(level) + level.state.sim.g_scroll_py_offset;
 }
 
-pub fn render_tiles(level: *lvl.Level) void {
-    const y_offset = get_y_offset();
-    var x: i16 = -1;
-    while (x < 21) : (x += 1) {
-        const checkX = globals.BITMAP_X + x;
-        if (checkX < 0 or checkX >= level.width) {
-            continue;
+// Pre-rendered tiles for the visible area, with a margin on each side for the pixel offsets.
+// Only redrawn fully when the view moves or the tilemap changes, animation steps only refresh the animated tiles.
+pub const TileCache = struct {
+    const margin_x = 1;
+    const margin_y = 2;
+    const columns = globals.screen_width + 2 * margin_x;
+    const rows = globals.screen_height + 2 * margin_y;
+
+    surface: ?*SDL.Surface = null,
+    valid: bool = false,
+    bitmap_x: globals.TileCoord = 0,
+    bitmap_y: globals.TileCoord = 0,
+    tile_anim: u8 = 0,
+
+    pub fn init(self: *TileCache, pixelformat: SDL.PixelFormat) !void {
+        const surface = SDL.createSurface(columns * 16, rows * 16, pixelformat);
+        if (surface == null) {
+            return error.Failed;
         }
-        const tileX = @as(usize, @intCast(checkX));
-        var y: i16 = -1;
-        while (y < 13) : (y += 1) {
-            const checkY = globals.BITMAP_Y + y;
-            if (checkY < 0 or checkY >= level.height) {
-                continue;
-            }
-            const tileY = @as(usize, @intCast(checkY));
-
-            var dest: SDL.Rect = undefined;
-            dest.x = x * 16 + globals.g_scroll_px_offset;
-            dest.y = y * 16 + y_offset;
-            const tile = level.getTile(tileX, tileY);
-            const animated_tile = level.tile[tile].animation[globals.tile_anim];
-            const surface = level.tile[animated_tile].tiledata;
-            _ = SDL.blitSurface(@ptrCast(@alignCast(surface)), null, window.screen, &dest);
+        self.* = .{ .surface = surface };
+    }
+
+    pub fn deinit(self: *TileCache) void {
+        if (self.surface) |surface| {
+            SDL.destroySurface(surface);
         }
+        self.* = .{};
     }
-}
 
-pub fn render_sprites(level: *lvl.Level) void {
-    for (0..lvl.ELEVATOR_CAPACITY) |i| {
-        render_sprite(&level.elevator[lvl.ELEVATOR_CAPACITY - 1 - i].sprite);
+    // x and y are in tiles, relative to the cache origin. Cells off the map are never shown.
+    fn drawTile(self: *TileCache, level: *const lvl.Level, x: i16, y: i16) void {
+        var dest = SDL.Rect{ .x = x * 16, .y = y * 16, .w = 16, .h = 16 };
+        const checkX = self.bitmap_x - margin_x + x;
+        const checkY = self.bitmap_y - margin_y + y;
+        if (checkX < 0 or checkX >= level.definition.width or checkY < 0 or checkY >= level.definition.height) {
+            return;
+        }
+        const tile = level.getTile(@intCast(checkX), @intCast(checkY));
+        const animated_tile = level.definition.tile[tile].animation[self.tile_anim];
+        const surface = level.definition.tile[animated_tile].tiledata;
+        _ = SDL.blitSurface(@ptrCast(@alignCast(surface)), null, self.surface, &dest);
     }
 
-    for (0..lvl.TRASH_CAPACITY) |i| {
-        render_sprite(&level.trash[lvl.TRASH_CAPACITY - 1 - i]);
+    // Redraw a tile of the level, if it is in the cache
+    fn redrawTile(self: *TileCache, level: *const lvl.Level, position: lvl.TilePosition) void {
+        const x = @as(i16, @intCast(position.x)) - self.bitmap_x + margin_x;
+        const y = @as(i16, @intCast(position.y)) - self.bitmap_y + margin_y;
+        if (x < 0 or x >= columns or y < 0 or y >= rows) {
+            return;
+        }
+        self.drawTile(level, x, y);
     }
 
-    for (0..lvl.ENEMY_CAPACITY) |i| {
-        render_sprite(&level.enemy[lvl.ENEMY_CAPACITY - 1 - i].sprite);
+    fn update(self: *TileCache, level: *lvl.Level) void {
+        const changes = level.tile_changes.take();
+        if (self.valid and !changes.overflow and self.bitmap_x == level.state.sim.BITMAP_X and self.bitmap_y == level.state.sim.BITMAP_Y) {
+            for (changes.positions[0..changes.count]) |position| {
+                self.redrawTile(level, position);
+            }
+            if (self.tile_anim == level.state.sim.tile_anim) {
+                return;
+            }
+            self.tile_anim = level.state.sim.tile_anim;
+            for (level.definition.animated_tiles) |position| {
+                self.redrawTile(level, position);
+            }
+            return;
+        }
+
+        self.bitmap_x = level.state.sim.BITMAP_X;
+        self.bitmap_y = level.state.sim.BITMAP_Y;
+        self.tile_anim = level.state.sim.tile_anim;
+        var y: i16 = 0;
+        while (y < rows) : (y += 1) {
+            var x: i16 = 0;
+            while (x < columns) : (x += 1) {
+                self.drawTile(level, x, y);
+            }
+        }
+        self.valid = true;
     }
+};
+
+pub var tile_cache: TileCache = .{};
 
-    for (0..lvl.OBJECT_CAPACITY) |i| {
-        render_sprite(&level.object[lvl.OBJECT_CAPACITY - 1 - i].sprite);
+pub fn render_tiles(level: *lvl.Level) void {
+    tile_cache.update(level);
+    // Only blit the cells that are on the map, what is under the others is left alone
+    const width: i16 = @intCast(level.definition.width);
+    const height: i16 = @intCast(level.definition.height);
+    const first_x: i16 = @max(0, TileCache.margin_x - tile_cache.bitmap_x);
+    const first_y: i16 = @max(0, TileCache.margin_y - tile_cache.bitmap_y);
+    const end_x: i16 = @min(TileCache.columns, width - tile_cache.bitmap_x + TileCache.margin_x);
+    const end_y: i16 = @min(TileCache.rows, height - tile_cache.bitmap_y + TileCache.margin_y);
+    if (first_x >= end_x or first_y >= end_y) {
+        return;
+    }
+    var src = SDL.Rect{
+        .x = first_x * 16,
+        .y = first_y * 16,
+        .w = (end_x - first_x) * 16,
+        .h = (end_y - first_y) * 16,
+    };
+    var dest = SDL.Rect{
+        .x = (first_x - TileCache.margin_x) * 16 + level.state.sim.g_scroll_px_offset,
+        .y = (first_y - TileCache.margin_y) * 16 + get_y_offset(level),
+        .w = src.w,
+        .h = src.h,
+    };
+    _ = SDL.blitSurface(tile_cache.surface, &src, window.screen, &dest);
+}
+
+pub fn render_sprites(level: *lvl.Level) void {
+    spatial.visible_sprites.ensure(level);
+    var iter = spatial.visible_sprites.iterator(.forward);
+    while (iter.next()) |ref| {
+        render_sprite(level, spatial.getSprite(level, ref));
     }
 
-    render_sprite(&level.player.sprite3);
-    render_sprite(&level.player.sprite2);
-    render_sprite(&level.player.sprite);
+    render_sprite(level, &level.state.player.sprite3);
+    render_sprite(level, &level.state.player.sprite2);
+    render_sprite(level, &level.state.player.sprite);
 
     if (debug.player_position) {
-        const x = level.player.sprite.x - (globals.BITMAP_X * 16) + globals.g_scroll_px_offset;
-        const y = level.player.sprite.y - (globals.BITMAP_Y * 16) + get_y_offset();
+        const x = level.state.player.sprite.x - (level.state.sim.BITMAP_X * 16) + level.state.sim.g_scroll_px_offset;
+        const y = level.state.player.sprite.y - (level.state.sim.BITMAP_Y * 16) + get_y_offset(level);
         //_ = SDL.writeSurfacePixel(window.screen, 20, 10, 255, 0, 0, 255);
         if(y >= 0 and x >= 0 and y < window.game_height and x < window.game_width) {
             _ = SDL.writeSurfacePixel(window.screen, x, y, 255, 0, 0, 255);
         }
         var buf = [_]u8{0} ** 32;
-        const bytes = std.fmt.bufPrint(&buf, "{d},{d}", .{level.player.sprite.x >> 4, level.player.sprite.y >> 4}) catch {
+        const bytes = std.fmt.bufPrint(&buf, "{d},{d}", .{level.state.player.sprite.x >> 4, level.state.player.sprite.y >> 4}) catch {
             unreachable;
         };
-        fonts.Gold.render(bytes, 30 * 8, 0 * 12, .{ .monospace = true });
+        fonts.Gold.render(bytes, 30 * 8, 0 * 12, .{ .monospace = true, .uncached = true });
     }
     if (debug.ladder_flag) {
-        if(globals.LADDER_FLAG) {
+        if(level.state.sim.LADDER_FLAG) {
             fonts.Gold.render("LADDER", 30 * 8, 1 * 12, .{ .monospace = true });
         }
     }
     if (debug.player_action) {
-        fonts.Gold.render(globals.LAST_ORDER.str(), 30 * 8, 2 * 12, .{ .monospace = true });
+        fonts.Gold.render(level.state.sim.LAST_ORDER.str(), 30 * 8, 2 * 12, .{ .monospace = true });
+    }
+    if (debug.audio_latency) {
+        // event to callback (peak) + device buffer, in ms
+        const stats = audio.engine.takeLatencyStats();
+        var buf = [_]u8{0} ** 32;
+        const bytes = std.fmt.bufPrint(&buf, "{d}.{d}({d}.{d})+{d}", .{
+            stats.command / 1000,
+            stats.command / 100 % 10,
+            stats.command_peak / 1000,
+            stats.command_peak / 100 % 10,
+            stats.output / 1000,
+        }) catch {
+            unreachable;
+        };
+        fonts.Gold.render(bytes, 26 * 8, 3 * 12, .{ .monospace = true, .uncached = true });
     }
 
     if (globals.GODMODE) {
@@ -164,25 +254,24 @@ pub fn render_sprites(level: *lvl.Level) void {
     }
 }
 
-fn render_sprite(spr: *allowzero lvl.Sprite) void {
+fn render_sprite(level: *const lvl.Level, spr: *allowzero lvl.Sprite) void {
     if (!spr.enabled) {
         return;
     }
     if (spr.invisible) {
         return;
     }
-    spr.visible = false;
 
     var dest: SDL.Rect = undefined;
     if (!spr.flipped) {
         // FIXME: crash in final level!
-        dest.x = spr.x - spr.spritedata.?.refwidth - (globals.BITMAP_X * 16) + globals.g_scroll_px_offset;
+        dest.x = spr.x - spr.spritedata.?.refwidth - (level.state.sim.BITMAP_X * 16) + level.state.sim.g_scroll_px_offset;
     } else {
-        dest.x = spr.x + spr.spritedata.?.refwidth - spr.spritedata.?.width - (globals.BITMAP_X * 16) + globals.g_scroll_px_offset;
+        dest.x = spr.x + spr.spritedata.?.refwidth - spr.spritedata.?.width - (level.state.sim.BITMAP_X * 16) + level.state.sim.g_scroll_px_offset;
     }
 
     const sprite_offset: i16 = 0 - (@as(i16, spr.spritedata.?.refheight) - spr.spritedata.?.height);
-    dest.y = spr.y + sprite_offset - spr.spritedata.?.height + 1 - (globals.BITMAP_Y * 16) + get_y_offset();
+    dest.y = spr.y + sprite_offset - spr.spritedata.?.height + 1 - (level.state.sim.BITMAP_Y * 16) + get_y_offset(level);
 
     if ((dest.x >= globals.screen_width * 16) or //Right for the screen
         (dest.x + spr.spritedata.?.width < 0) or //Left for the screen
@@ -198,7 +287,6 @@ fn render_sprite(spr: *allowzero lvl.Sprite) void {
         .flash = (spr.*.flash or (spr.*.invincibility_frames / 4) % 2 == 1) ,
     }) catch {
         _ = SDL.fillSurfaceRect(window.screen, &dest, SDL.mapSurfaceRGB(window.screen, 255, 180, 128));
-        spr.visible = true;
         spr.flash = false;
         return;
     };
@@ -212,24 +300,23 @@ fn render_sprite(spr: *allowzero lvl.Sprite) void {
 
     _ = SDL.blitSurface(image, &src, window.screen, &dest);
 
-    spr.visible = true;
     spr.flash = false;
 }
 
 pub fn render_health_bars(level: *lvl.Level) void {
-    common.subto0(&globals.BAR_FLAG);
+    common.subto0(&level.state.sim.BAR_FLAG);
     if (window.screen == null) {
         return;
     }
 
     const white = SDL.mapSurfaceRGB(window.screen, 255, 255, 255);
-    if (globals.BAR_FLAG <= 0) {
+    if (level.state.sim.BAR_FLAG <= 0) {
         return;
     }
     var offset: u8 = 96;
 
     //render big bars (4px*16px, spacing 4px)
-    for (0..level.player.hp) |_| {
+    for (0..level.state.player.hp) |_| {
         const dest = SDL.Rect{
             .x = offset,
             .y = 9,
@@ -242,7 +329,7 @@ pub fn render_health_bars(level: *lvl.Level) void {
     }
 
     //render small bars (4px*4px, spacing 4px)
-    for (0..@as(usize, globals.MAXIMUM_ENERGY) - level.player.hp) |_| {
+    for (0..@as(usize, globals.MAXIMUM_ENERGY) - level.state.player.hp) |_| {
         const dest = SDL.Rect{
             .x = offset,
             .y = 15,
@@ -257,17 +344,11 @@ pub fn render_health_bars(level: *lvl.Level) void {
 pub fn fadeout() void {
     const fade_time: c_uint = 1000;
 
-    var rect = SDL.Rect{
-        .x = 0,
-        .y = 0,
-        .w = window.game_width,
-        .h = window.game_height,
-    };
-
-    const image = SDL.convertSurface(window.screen.?, window.screen.?.format) catch {
-        @panic("OOPS");
-    };
-    defer SDL.destroySurface(image);
+    // Whatever is on the screen gets faded as it's presented, then we leave a black screen behind
+    defer {
+        window.window_clear(null);
+        window.set_brightness(255);
+    }
 
     const tick_start = SDL.getTicks();
     var image_alpha: u64 = 0;
@@ -291,10 +372,7 @@ pub fn fadeout() void {
             image_alpha = 255;
         }
 
-        _ = SDL.setSurfaceAlphaMod(image, 255 - @as(u8, @truncate(image_alpha)));
-        _ = SDL.setSurfaceBlendMode(image, SDL.BLENDMODE_BLEND);
-        window.window_clear(null);
-        _ = SDL.blitSurface(image, &rect, window.screen, &rect);
+        window.set_brightness(255 - @as(u8, @truncate(image_alpha)));
         window.window_render();
 
         SDL.delay(1);
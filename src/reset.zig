@@ -25,72 +25,71 @@
 
 const globals = @import("globals.zig");
 const lvl = @import("level.zig");
+const spatial = @import("spatial.zig");
 const sprites = @import("sprites.zig");
-const objects = @import("objects.zig");
-const enemies = @import("enemies.zig");
 const data = @import("data.zig");
 
 fn SET_DATA_NMI(level: *lvl.Level) void {
-    globals.boss_alive = false;
-    for (0..lvl.ENEMY_CAPACITY) |i| {
+    level.state.sim.boss_alive = false;
+    for (level.enemy) |*enemy| {
         var anim: usize = 0;
-        if (!level.enemy[i].init_enabled) {
-            continue;
-        }
-        while (data.anim_enemy[anim] + globals.FIRST_NMI != level.enemy[i].sprite.number) {
+        while (data.anim_enemy[anim] + globals.FIRST_NMI != enemy.sprite.number) {
             anim += 1;
         }
-        level.enemy[i].sprite.animation = &(data.anim_enemy[anim]);
-        if (level.enemy[i].boss) {
-            globals.boss_alive = true;
+        enemy.sprite.animation = &(data.anim_enemy[anim]);
+        if (enemy.boss) {
+            level.state.sim.boss_alive = true;
         }
     }
-    globals.boss_lives = level.boss_power;
+    level.state.sim.boss_lives = level.boss_power;
 }
 
 pub fn CLEAR_DATA(level: *lvl.Level) void {
-    globals.loop_cycle = 0;
-    globals.tile_anim = 0;
-    globals.IMAGE_COUNTER = 0;
-    globals.TAUPE_FLAG = 0;
-    globals.GRANDBRULE_FLAG = false;
-    globals.NOSCROLL_FLAG = false;
-    globals.TAPISWAIT_FLAG = 0;
-    globals.TAPISFLY_FLAG = 0;
-    globals.FUME_FLAG = 0;
-    globals.BAR_FLAG = 0;
-    globals.CARRY_FLAG = false;
-    globals.DROP_FLAG = false;
-    globals.DROPREADY_FLAG = false;
-    globals.POSEREADY_FLAG = false;
-    globals.LADDER_FLAG = false;
-    globals.low_ceiling = false;
-    globals.jump_timer = 0;
-    globals.CROSS_FLAG = 0;
-    globals.FURTIF_FLAG = 0;
-    globals.CHOC_FLAG = 0;
-    globals.KICK_FLAG = 0;
-    globals.SEECHOC_FLAG = 0;
-    globals.RESETLEVEL_FLAG = 0;
-    globals.LOSELIFE_FLAG = false;
-    globals.GAMEOVER_FLAG = false;
-    globals.NEWLEVEL_FLAG = false;
-    globals.SKIPLEVEL_FLAG = false;
-    globals.INVULNERABLE_FLAG = 0;
-    globals.POCKET_FLAG = false;
-    globals.jump_acceleration_counter = 0;
-    globals.ACTION_TIMER = 0;
-    globals.g_scroll_x = false;
-    globals.g_scroll_y = false;
-    globals.g_scroll_y_target = 0;
-    globals.g_scroll_px_offset = 0;
-    globals.YFALL = 0;
+    level.state.sim.loop_cycle = 0;
+    level.state.sim.tile_anim = 0;
+    level.state.sim.IMAGE_COUNTER = 0;
+    level.state.sim.TAUPE_FLAG = 0;
+    level.state.sim.GRANDBRULE_FLAG = false;
+    level.state.sim.NOSCROLL_FLAG = false;
+    level.state.sim.TAPISWAIT_FLAG = 0;
+    level.state.sim.TAPISFLY_FLAG = 0;
+    level.state.sim.FUME_FLAG = 0;
+    level.state.sim.BAR_FLAG = 0;
+    level.state.sim.CARRY_FLAG = false;
+    level.state.sim.DROP_FLAG = false;
+    level.state.sim.DROPREADY_FLAG = false;
+    level.state.sim.POSEREADY_FLAG = false;
+    level.state.sim.LADDER_FLAG = false;
+    level.state.sim.low_ceiling = false;
+    level.state.sim.jump_timer = 0;
+    level.state.sim.CROSS_FLAG = 0;
+    level.state.sim.FURTIF_FLAG = 0;
+    level.state.sim.CHOC_FLAG = 0;
+    level.state.sim.KICK_FLAG = 0;
+    level.state.sim.SEECHOC_FLAG = 0;
+    level.state.sim.RESETLEVEL_FLAG = 0;
+    level.state.sim.LOSELIFE_FLAG = false;
+    level.state.sim.GAMEOVER_FLAG = false;
+    level.state.sim.NEWLEVEL_FLAG = false;
+    level.state.sim.SKIPLEVEL_FLAG = false;
+    level.state.sim.INVULNERABLE_FLAG = 0;
+    level.state.sim.POCKET_FLAG = false;
+    level.state.sim.jump_acceleration_counter = 0;
+    level.state.sim.ACTION_TIMER = 0;
+    level.state.sim.g_scroll_x = false;
+    level.state.sim.g_scroll_y = false;
+    level.state.sim.g_scroll_y_target = 0;
+    level.state.sim.g_scroll_px_offset = 0;
+    level.state.sim.g_scroll_py_offset = 0;
+    level.state.sim.g_scroll_py_start = 0;
+    level.state.sim.YFALL = 0;
 
-    globals.GRAVITY_FLAG = 4;
-    globals.SENSX = 0;
-    globals.LAST_ORDER = .Rest;
+    level.state.sim.GRAVITY_FLAG = 4;
+    level.state.sim.SENSX = 0;
+    level.state.sim.LAST_ORDER = .Rest;
 
     SET_ALL_SPRITES(level);
+    spatial.visible_sprites.invalidate();
 
     SET_DATA_NMI(level);
 }
@@ -103,7 +102,7 @@ fn clearsprite(spr: *lvl.Sprite) void {
     spr.speed_y = 0;
     spr.number = 0;
     spr.UNDER = 0;
-    spr.ONTOP = null;
+    spr.ONTOP = .none;
     spr.spritedata = null;
     spr.flipped = false;
     spr.invincibility_frames = 0;
@@ -116,72 +115,36 @@ fn clearsprite(spr: *lvl.Sprite) void {
 }
 
 fn SET_ALL_SPRITES(level: *lvl.Level) void {
-    var player = &level.player;
+    var player = &level.state.player;
 
     for (0..lvl.TRASH_CAPACITY) |i| {
-        clearsprite(&(level.trash[i]));
-    }
-
-    for (0..lvl.ENEMY_CAPACITY) |i| {
-        clearsprite(&(level.enemy[i].sprite));
-        level.enemy[i].dying = 0;
-        level.enemy[i].carry_sprite = -1;
-        level.enemy[i].dead_sprite = -1;
-        level.enemy[i].phase = 0;
-        level.enemy[i].counter = 0;
-        level.enemy[i].trigger = false;
-        level.enemy[i].visible = false;
-        if (level.enemy[i].init_enabled) {
-            enemies.updateenemysprite(level, &(level.enemy[i]), @intCast(level.enemy[i].init_sprite), true);
-            level.enemy[i].sprite.flipped = level.enemy[i].init_flipped;
-            level.enemy[i].sprite.x = @truncate(level.enemy[i].init_x);
-            level.enemy[i].sprite.y = @truncate(level.enemy[i].init_y);
-            level.enemy[i].sprite.speed_x = @truncate(level.enemy[i].init_speed_x);
-            level.enemy[i].sprite.speed_y = @truncate(level.enemy[i].init_speed_y);
-        }
+        clearsprite(&(level.state.trash[i]));
     }
 
-    for (0..lvl.ELEVATOR_CAPACITY) |i| {
-        clearsprite(&(level.elevator[i].sprite));
-        if (level.elevator[i].init_enabled) {
-            sprites.updatesprite(level, &(level.elevator[i].sprite), @intCast(level.elevator[i].init_sprite), true);
-            level.elevator[i].sprite.visible = level.elevator[i].init_visible;
-            level.elevator[i].sprite.flash = level.elevator[i].init_flash;
-            level.elevator[i].sprite.flipped = level.elevator[i].init_flipped;
-            level.elevator[i].sprite.x = @truncate(level.elevator[i].init_x);
-            level.elevator[i].sprite.y = @truncate(level.elevator[i].init_y);
-            level.elevator[i].counter = 0;
-            level.elevator[i].sprite.speed_x = level.elevator[i].init_speed_x;
-            level.elevator[i].sprite.speed_y = level.elevator[i].init_speed_y;
-        }
-    }
+    // The entities start over from the level definition
+    const definition = level.definition;
+    level.state.enemy = definition.initial_enemy;
+    level.state.elevator = definition.initial_elevator;
+    level.state.object = definition.initial_object;
 
-    for (0..lvl.OBJECT_CAPACITY) |i| {
-        clearsprite(&(level.object[i].sprite));
-        level.object[i].momentum = 0;
-        if (level.object[i].init_enabled) {
-            objects.updateobjectsprite(level, &(level.object[i]), @intCast(level.object[i].init_sprite), true);
-            level.object[i].sprite.visible = level.object[i].init_visible;
-            level.object[i].sprite.flash = level.object[i].init_flash;
-            level.object[i].sprite.flipped = level.object[i].init_flipped;
-            level.object[i].sprite.x = @truncate(level.object[i].init_x);
-            level.object[i].sprite.y = @truncate(level.object[i].init_y);
-            if ((player.cageY != 0) and
-                ((level.object[i].sprite.number == globals.FIRST_OBJET + 26) or (level.object[i].sprite.number == globals.FIRST_OBJET + 27)))
-            {
-                level.object[i].sprite.x = player.cageX;
-                level.object[i].sprite.y = player.cageY;
+    if (player.cageY != 0) {
+        var live = level.state.object.iterator();
+        while (live.next()) |i| {
+            const object = &level.object[i];
+            if ((object.sprite.number == globals.FIRST_OBJET + 26) or (object.sprite.number == globals.FIRST_OBJET + 27)) {
+                object.sprite.x = player.cageX;
+                object.sprite.y = player.cageY;
             }
         }
     }
-    globals.GRAVITY_FLAG = 4;
+    level.state.sim.GRAVITY_FLAG = 4;
     clearsprite(&(player.sprite));
     clearsprite(&(player.sprite2));
     clearsprite(&(player.sprite3));
 
     player.sprite.x = player.initX;
     player.sprite.y = player.initY;
-    level.player.hp = level.player.inithp;
-    level.player.animcycle = 0;
-    sprites.updatesprite(level, &(level.player.sprite), 0, true);
+    level.state.player.hp = level.state.player.inithp;
+    level.state.player.animcycle = 0;
+    sprites.updatesprite(level, &(level.state.player.sprite), 0, true);
 }
@@ -0,0 +1,190 @@
+//
+// Copyright (C) 2008 - 2024 The OpenTitus team
+//
+// Authors:
+// Eirik Stople
+// Petr Mrázek
+//
+// "Titus the Fox: To Marrakech and Back" (1992) and
+// "Lagaf': Les Aventures de Moktar - Vol 1: La Zoubida" (1991)
+// was developed by, and is probably copyrighted by Titus Software,
+// which, according to Wikipedia, stopped buisness in 2005.
+//
+// OpenTitus is not affiliated with Titus Software.
+//
+// OpenTitus is  free software; you can redistribute  it and/or modify
+// it under the  terms of the GNU General  Public License as published
+// by the Free  Software Foundation; either version 3  of the License,
+// or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+// MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+// General Public License for more details.
+//
+
+
+// Rewind history: every tick the simulation state is XORed against the previous tick in 16 byte chunks and
+// only the chunks that changed are kept, newest last, in a preallocated byte ring. Rewinding pops the newest
+// delta and XORs it back, so there are no keyframes; the oldest deltas are dropped when the ring fills up.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+const lvl = @import("level.zig");
+const spatial = @import("spatial.zig");
+
+// The level state carries the simulation context, so it is the whole frame
+const Frame = lvl.LevelState;
+
+const CHUNK_SIZE = 16;
+const Chunk = @Vector(CHUNK_SIZE, u8);
+const CHUNK_COUNT = std.math.divCeil(usize, @sizeOf(Frame), CHUNK_SIZE) catch unreachable;
+const FRAME_SIZE = CHUNK_COUNT * CHUNK_SIZE;
+
+// Each changed chunk is stored as its index followed by the XOR of the old and new bytes
+const DELTA_ENTRY_SIZE = @sizeOf(u16) + CHUNK_SIZE;
+const MAX_DELTA_SIZE = CHUNK_COUNT * DELTA_ENTRY_SIZE;
+
+comptime {
+    std.debug.assert(CHUNK_COUNT <= std.math.maxInt(u16));
+}
+
+// About two minutes of play at the game's tick rate
+const MAX_RECORDS = 4096;
+const RING_SIZE = 4 * 1024 * 1024;
+
+const Record = struct {
+    offset: u32,
+    len: u32,
+};
+
+pub const History = struct {
+    // The newest frame, the one the level is in right now
+    current: [FRAME_SIZE]u8 align(@alignOf(Frame)) = undefined,
+    // Where the next tick is captured. The bytes past the end of the state stay zero in both frames.
+    next: [FRAME_SIZE]u8 align(@alignOf(Frame)) = undefined,
+    scratch: [MAX_DELTA_SIZE]u8 = undefined,
+
+    bytes: []u8 = &.{},
+    records: []Record = &.{},
+    first: usize = 0,
+    count: usize = 0,
+    head: usize = 0,
+    used: usize = 0,
+
+    allocator: Allocator = undefined,
+
+    pub fn init(self: *History, allocator: Allocator) !void {
+        self.allocator = allocator;
+        self.bytes = try allocator.alloc(u8, RING_SIZE);
+        errdefer allocator.free(self.bytes);
+        self.records = try allocator.alloc(Record, MAX_RECORDS);
+        @memset(&self.current, 0);
+        @memset(&self.next, 0);
+        self.clear();
+    }
+
+    pub fn deinit(self: *History) void {
+        self.allocator.free(self.records);
+        self.allocator.free(self.bytes);
+        self.* = .{};
+    }
+
+    fn clear(self: *History) void {
+        self.first = 0;
+        self.count = 0;
+        self.head = 0;
+        self.used = 0;
+    }
+
+    fn frame(self: *History) *Frame {
+        return @ptrCast(&self.current);
+    }
+
+    // Forget the history and start over from the level as it is now
+    pub fn reset(self: *History, level: *const lvl.Level) void {
+        self.clear();
+        capture(self.frame(), level);
+    }
+
+    // Store the difference between the previous tick and the level as it is now
+    pub fn record(self: *History, level: *const lvl.Level) void {
+        capture(@ptrCast(&self.next), level);
+
+        var len: usize = 0;
+        for (0..CHUNK_COUNT) |i| {
+            const old: Chunk = self.current[i * CHUNK_SIZE ..][0..CHUNK_SIZE].*;
+            const new: Chunk = self.next[i * CHUNK_SIZE ..][0..CHUNK_SIZE].*;
+            const diff = old ^ new;
+            if (@reduce(.Or, diff) == 0) {
+                continue;
+            }
+            std.mem.writeInt(u16, self.scratch[len..][0..2], @intCast(i), .little);
+            self.scratch[len + 2 ..][0..CHUNK_SIZE].* = diff;
+            self.current[i * CHUNK_SIZE ..][0..CHUNK_SIZE].* = new;
+            len += DELTA_ENTRY_SIZE;
+        }
+        self.push(self.scratch[0..len]);
+    }
+
+    // Step the level back by one tick. Returns false when there is nothing left to rewind.
+    pub fn rewind(self: *History, level: *lvl.Level) bool {
+        if (self.count == 0) {
+            return false;
+        }
+        const delta = self.pop();
+        var pos: usize = 0;
+        while (pos < delta.len) : (pos += DELTA_ENTRY_SIZE) {
+            const i: usize = std.mem.readInt(u16, delta[pos..][0..2], .little);
+            const diff: Chunk = delta[pos + 2 ..][0..CHUNK_SIZE].*;
+            const new: Chunk = self.current[i * CHUNK_SIZE ..][0..CHUNK_SIZE].*;
+            self.current[i * CHUNK_SIZE ..][0..CHUNK_SIZE].* = new ^ diff;
+        }
+        restore(self.frame(), level);
+        return true;
+    }
+
+    fn push(self: *History, delta: []const u8) void {
+        while (self.count == self.records.len or self.used + delta.len > self.bytes.len) {
+            // Drop the oldest delta
+            self.used -= self.records[self.first].len;
+            self.first = (self.first + 1) % self.records.len;
+            self.count -= 1;
+        }
+        self.records[(self.first + self.count) % self.records.len] = .{
+            .offset = @intCast(self.head),
+            .len = @intCast(delta.len),
+        };
+        const tail = @min(delta.len, self.bytes.len - self.head);
+        @memcpy(self.bytes[self.head..][0..tail], delta[0..tail]);
+        @memcpy(self.bytes[0 .. delta.len - tail], delta[tail..]);
+        self.head = (self.head + delta.len) % self.bytes.len;
+        self.used += delta.len;
+        self.count += 1;
+    }
+
+    fn pop(self: *History) []const u8 {
+        self.count -= 1;
+        const newest = self.records[(self.first + self.count) % self.records.len];
+        self.head = newest.offset;
+        self.used -= newest.len;
+        const delta = self.scratch[0..newest.len];
+        const tail = @min(delta.len, self.bytes.len - newest.offset);
+        @memcpy(delta[0..tail], self.bytes[newest.offset..][0..tail]);
+        @memcpy(delta[tail..], self.bytes[0 .. delta.len - tail]);
+        return delta;
+    }
+};
+
+fn capture(frame: *Frame, level: *const lvl.Level) void {
+    // Copy the padding too, so it never shows up as a change
+    @memcpy(std.mem.asBytes(frame), std.mem.asBytes(&level.state));
+}
+
+fn restore(frame: *const Frame, level: *lvl.Level) void {
+    level.restoreState(frame);
+    spatial.visible_sprites.invalidate();
+}
+
+pub var history: History = .{};
@@ -49,33 +49,30 @@ const EASING_RANGE = 9;
 const CAMERA_DISTANCE = 60;
 const CAMERA_RANGE = CAMERA_DISTANCE * 2;
 
-// TODO: put this on the player struct
-var easing_value: i16 = 0;
-
 fn X_ADJUST(level: *lvl.Level) void {
-    const player = &(level.player);
-    globals.g_scroll_x = true;
+    const player = &(level.state.player);
+    level.state.sim.g_scroll_x = true;
 
     const player_position = player.sprite.x;
 
     // determine the right side of the world
     var right_limit: i16 = undefined;
-    if (player_position > globals.XLIMIT * 16 or globals.XLIMIT_BREACHED) {
-        globals.XLIMIT_BREACHED = true;
-        right_limit = @intCast(level.width * 16 - 160);
+    if (player_position > level.state.sim.XLIMIT * 16 or level.state.sim.XLIMIT_BREACHED) {
+        level.state.sim.XLIMIT_BREACHED = true;
+        right_limit = @intCast(level.definition.width * 16 - 160);
     } else {
-        right_limit = @intCast(globals.XLIMIT * 16 - 160);
+        right_limit = @intCast(level.state.sim.XLIMIT * 16 - 160);
     }
 
     // update the camera offset from the player (using an easing function)
-    const facing_right = !level.player.sprite.flipped;
+    const facing_right = !level.state.player.sprite.flipped;
     const easing_target: i16 = if (facing_right) EASING_RANGE else -EASING_RANGE;
-    if (easing_value < easing_target) {
-        easing_value += 1;
-    } else if (easing_value > easing_target) {
-        easing_value -= 1;
+    if (level.state.sim.easing_value < easing_target) {
+        level.state.sim.easing_value += 1;
+    } else if (level.state.sim.easing_value > easing_target) {
+        level.state.sim.easing_value -= 1;
     }
-    const real_camera_offset: i16 = @intFromFloat(@floor(smootherstep(-EASING_RANGE, EASING_RANGE, @floatFromInt(easing_value)) * CAMERA_RANGE - CAMERA_DISTANCE));
+    const real_camera_offset: i16 = @intFromFloat(@floor(smootherstep(-EASING_RANGE, EASING_RANGE, @floatFromInt(level.state.sim.easing_value)) * CAMERA_RANGE - CAMERA_DISTANCE));
 
     // clamp the camera inside the world space
     var camera_position: i16 = player_position + real_camera_offset;
@@ -87,153 +84,206 @@ fn X_ADJUST(level: *lvl.Level) void {
     }
 
     // un-breach XLIMIT if we go one screen to the left of it
-    if (globals.XLIMIT_BREACHED and camera_position < globals.XLIMIT * 16 - window.game_width) {
-        globals.XLIMIT_BREACHED = false;
+    if (level.state.sim.XLIMIT_BREACHED and camera_position < level.state.sim.XLIMIT * 16 - window.game_width) {
+        level.state.sim.XLIMIT_BREACHED = false;
     }
 
-    const camera_screen_px: i16 = camera_position - @as(i16, globals.BITMAP_X) * 16;
+    const camera_screen_px: i16 = camera_position - @as(i16, level.state.sim.BITMAP_X) * 16;
     const scroll_px_target: i16 = 160;
     const scroll_offset_x: i16 = scroll_px_target - camera_screen_px;
     const tile_offset_x: i16 = @divTrunc(scroll_offset_x, 16);
     const px_offset_x: i16 = @rem(scroll_offset_x, 16);
     if (tile_offset_x < 0) {
-        globals.BITMAP_X += 1;
-        globals.g_scroll_px_offset = px_offset_x;
-        globals.g_scroll_x = true;
+        level.state.sim.BITMAP_X += 1;
+        level.state.sim.g_scroll_px_offset = px_offset_x;
+        level.state.sim.g_scroll_x = true;
     } else if (tile_offset_x > 0) {
-        globals.BITMAP_X -= 1;
-        globals.g_scroll_px_offset = px_offset_x;
-        globals.g_scroll_x = true;
+        level.state.sim.BITMAP_X -= 1;
+        level.state.sim.g_scroll_px_offset = px_offset_x;
+        level.state.sim.g_scroll_x = true;
     } else {
-        globals.g_scroll_px_offset = scroll_offset_x;
-        globals.g_scroll_x = false;
+        level.state.sim.g_scroll_px_offset = scroll_offset_x;
+        level.state.sim.g_scroll_x = false;
     }
 }
 
 fn Y_ADJUST(level: *lvl.Level) void {
-    const player = &(level.player);
+    const player = &(level.state.player);
     if (player.sprite.speed_y == 0) {
-        globals.g_scroll_y = false;
+        level.state.sim.g_scroll_y = false;
     }
-    const pstileY: i16 = (player.sprite.y >> 4) - globals.BITMAP_Y; //Player screen tile Y (0 to 11)
-    if (!globals.g_scroll_y) {
-        if ((player.sprite.speed_y == 0) and (globals.LADDER_FLAG == false)) {
+    const pstileY: i16 = (player.sprite.y >> 4) - level.state.sim.BITMAP_Y; //Player screen tile Y (0 to 11)
+    if (!level.state.sim.g_scroll_y) {
+        if ((player.sprite.speed_y == 0) and (level.state.sim.LADDER_FLAG == false)) {
             if (pstileY >= globals.screen_height - 1) {
-                globals.g_scroll_y_target = globals.screen_height - 2;
-                globals.g_scroll_y = true;
+                level.state.sim.g_scroll_y_target = globals.screen_height - 2;
+                level.state.sim.g_scroll_y = true;
             } else if (pstileY <= 2) {
-                globals.g_scroll_y_target = globals.screen_height - 3;
-                globals.g_scroll_y = true;
+                level.state.sim.g_scroll_y_target = globals.screen_height - 3;
+                level.state.sim.g_scroll_y = true;
             }
         } else {
             if (pstileY >= globals.screen_height - 2) { //The player is at the bottom of the screen, scroll down!
-                globals.g_scroll_y_target = 3;
-                globals.g_scroll_y = true;
+                level.state.sim.g_scroll_y_target = 3;
+                level.state.sim.g_scroll_y = true;
             } else if (pstileY <= 2) { //The player is at the top of the screen, scroll up!
-                globals.g_scroll_y_target = globals.screen_height - 3;
-                globals.g_scroll_y = true;
+                level.state.sim.g_scroll_y_target = globals.screen_height - 3;
+                level.state.sim.g_scroll_y = true;
             }
         }
     }
 
     // TODO: do something about this weirdness of discrete tile scrolling.
-    if ((player.sprite.y <= ((@as(i16, globals.ALTITUDE_ZERO) + globals.screen_height) >> 4)) and //If the player is above the horizontal limit
-        (globals.BITMAP_Y > globals.ALTITUDE_ZERO + 1)) //... and the screen have scrolled below the the horizontal limit
+    if ((player.sprite.y <= ((@as(i16, level.state.sim.ALTITUDE_ZERO) + globals.screen_height) >> 4)) and //If the player is above the horizontal limit
+        (level.state.sim.BITMAP_Y > level.state.sim.ALTITUDE_ZERO + 1)) //... and the screen have scrolled below the the horizontal limit
     {
         if (scroll_up(level)) {
-            globals.g_scroll_y = false;
+            level.state.sim.g_scroll_y = false;
         }
-    } else if ((globals.BITMAP_Y > globals.ALTITUDE_ZERO - 5) and // If the screen is less than 5 tiles above the horizontal limit
-        (globals.BITMAP_Y <= globals.ALTITUDE_ZERO) and // ... and still above the horizontal limit
-        (player.sprite.y + (7 * 16) > ((globals.ALTITUDE_ZERO + globals.screen_height) << 4)))
+    } else if ((level.state.sim.BITMAP_Y > level.state.sim.ALTITUDE_ZERO - 5) and // If the screen is less than 5 tiles above the horizontal limit
+        (level.state.sim.BITMAP_Y <= level.state.sim.ALTITUDE_ZERO) and // ... and still above the horizontal limit
+        (player.sprite.y + (7 * 16) > ((level.state.sim.ALTITUDE_ZERO + globals.screen_height) << 4)))
     {
         if (scroll_down(level)) {
-            globals.g_scroll_y = false;
+            level.state.sim.g_scroll_y = false;
         }
-    } else if (globals.g_scroll_y) {
-        if (globals.g_scroll_y_target == pstileY) {
-            globals.g_scroll_y = false;
-        } else if (globals.g_scroll_y_target > pstileY) {
+    } else if (level.state.sim.g_scroll_y) {
+        if (level.state.sim.g_scroll_y_target == pstileY) {
+            level.state.sim.g_scroll_y = false;
+        } else if (level.state.sim.g_scroll_y_target > pstileY) {
             if (scroll_up(level)) {
-                globals.g_scroll_y = false;
+                level.state.sim.g_scroll_y = false;
             }
-        } else if ((player.sprite.y <= ((globals.ALTITUDE_ZERO + globals.screen_height) << 4)) and //If the player is above the horizontal limit
-            (globals.BITMAP_Y > globals.ALTITUDE_ZERO)) //... and the screen is below the horizontal limit
+        } else if ((player.sprite.y <= ((level.state.sim.ALTITUDE_ZERO + globals.screen_height) << 4)) and //If the player is above the horizontal limit
+            (level.state.sim.BITMAP_Y > level.state.sim.ALTITUDE_ZERO)) //... and the screen is below the horizontal limit
         {
-            globals.g_scroll_y = false; //Stop scrolling
+            level.state.sim.g_scroll_y = false; //Stop scrolling
         } else {
             if (scroll_down(level)) {
-                globals.g_scroll_y = false;
+                level.state.sim.g_scroll_y = false;
             }
         }
     }
 }
 
+// We use this to fill the whole 320x200 space in most cases instead of not rendering the bottom 8 pixels
+pub fn base_y_offset(level: *const lvl.Level) i16 {
+    return if (level.state.sim.BITMAP_Y == 0) 0 else 8;
+}
+
+fn camera_top(level: *const lvl.Level) i16 {
+    return level.state.sim.BITMAP_Y * 16 - base_y_offset(level);
+}
+
+const Y_MAX_LAG = 16;
+// Same curve and duration as a full turn of the horizontal camera
+const Y_EASING_TICKS = 2 * EASING_RANGE;
+
+// Y_ADJUST moves the screen in whole tiles. Instead of jumping, let the rendered camera trail behind
+// by g_scroll_py_offset pixels and ease it towards the tile aligned position.
+fn Y_SMOOTH(level: *lvl.Level, previous_top: i16) void {
+    const moved = camera_top(level) - previous_top;
+    if (moved != 0) {
+        // Start over from wherever the camera is drawn now
+        const offset = level.state.sim.g_scroll_py_offset + moved;
+        level.state.sim.g_scroll_py_start = std.math.clamp(offset, -Y_MAX_LAG, Y_MAX_LAG);
+        level.state.sim.g_scroll_py_easing = 0;
+    }
+    if (level.state.sim.g_scroll_py_easing < Y_EASING_TICKS) {
+        level.state.sim.g_scroll_py_easing += 1;
+    }
+    level.state.sim.g_scroll_py_offset = easeOffset(level.state.sim.g_scroll_py_start, level.state.sim.g_scroll_py_easing);
+}
+
+fn easeOffset(start: i16, ticks: u8) i16 {
+    const remaining = 1.0 - smootherstep(0, Y_EASING_TICKS, @floatFromInt(ticks));
+    return @intFromFloat(@round(@as(f32, @floatFromInt(start)) * remaining));
+}
+
+test "vertical scroll jumps ease out over several ticks" {
+    for ([_]i16{ 16, 8, -16, -8 }) |jump| {
+        var offset = jump;
+        var ticks: u8 = 1;
+        while (ticks <= Y_EASING_TICKS) : (ticks += 1) {
+            const next = easeOffset(jump, ticks);
+            // Never further away, never past the target
+            try std.testing.expect(@abs(next) <= @abs(offset));
+            try std.testing.expect(next == 0 or (next > 0) == (jump > 0));
+            offset = next;
+        }
+        try std.testing.expectEqual(@as(i16, 0), offset);
+        // Still on the way halfway through
+        try std.testing.expect(easeOffset(jump, Y_EASING_TICKS / 2) != 0);
+    }
+}
+
 // TODO: put this somewhere else, like `engine`, it has nothing to do with scrolling
-pub fn animate_tiles() void {
-    globals.loop_cycle += 1; //Cycle from 0 to 3
-    if (globals.loop_cycle > 3) {
-        globals.loop_cycle = 0;
-    }
-    if (globals.loop_cycle == 0) { //Every 4th call
-        globals.tile_anim += 1; //Cycle tile animation (0-1-2)
-        if (globals.tile_anim > 2) {
-            globals.tile_anim = 0;
+pub fn animate_tiles(level: *lvl.Level) void {
+    level.state.sim.loop_cycle += 1; //Cycle from 0 to 3
+    if (level.state.sim.loop_cycle > 3) {
+        level.state.sim.loop_cycle = 0;
+    }
+    if (level.state.sim.loop_cycle == 0) { //Every 4th call
+        level.state.sim.tile_anim += 1; //Cycle tile animation (0-1-2)
+        if (level.state.sim.tile_anim > 2) {
+            level.state.sim.tile_anim = 0;
         }
     }
 }
 
 pub fn scrollToPlayer(level: *lvl.Level) void {
-    globals.BITMAP_X = 0;
-    globals.BITMAP_Y = 0;
+    level.state.sim.BITMAP_X = 0;
+    level.state.sim.BITMAP_Y = 0;
 
-    globals.g_scroll_y = true;
-    globals.g_scroll_x = true;
-    while (globals.g_scroll_y or globals.g_scroll_x) {
+    level.state.sim.g_scroll_y = true;
+    level.state.sim.g_scroll_x = true;
+    while (level.state.sim.g_scroll_y or level.state.sim.g_scroll_x) {
         scroll(level);
     }
+    level.state.sim.g_scroll_py_offset = 0;
+    level.state.sim.g_scroll_py_start = 0;
 }
 
 pub fn scroll(level: *lvl.Level) void {
-    animate_tiles();
+    animate_tiles(level);
     //Scroll
-    if (!globals.NOSCROLL_FLAG) {
+    const previous_top = camera_top(level);
+    if (!level.state.sim.NOSCROLL_FLAG) {
         X_ADJUST(level);
         Y_ADJUST(level);
     }
+    Y_SMOOTH(level, previous_top);
 }
 
 pub fn scroll_left(level: *lvl.Level) bool {
-    _ = level;
-    if (globals.BITMAP_X == 0) {
+    if (level.state.sim.BITMAP_X == 0) {
         return true;
     }
-    globals.BITMAP_X -= 1;
+    level.state.sim.BITMAP_X -= 1;
     return false;
 }
 
 pub fn scroll_right(level: *lvl.Level) bool {
-    const maxX: i16 = if (globals.XLIMIT_BREACHED) @as(i16, @intCast(level.width)) - globals.screen_width else globals.XLIMIT;
-    if (globals.BITMAP_X >= maxX) {
+    const maxX: i16 = if (level.state.sim.XLIMIT_BREACHED) @as(i16, @intCast(level.definition.width)) - globals.screen_width else level.state.sim.XLIMIT;
+    if (level.state.sim.BITMAP_X >= maxX) {
         return true;
     }
-    globals.BITMAP_X += 1;
+    level.state.sim.BITMAP_X += 1;
     return false;
 }
 
 pub fn scroll_up(level: *lvl.Level) bool {
-    _ = level;
-    if (globals.BITMAP_Y == 0) {
+    if (level.state.sim.BITMAP_Y == 0) {
         return true;
     }
-    globals.BITMAP_Y -= 1;
+    level.state.sim.BITMAP_Y -= 1;
     return false;
 }
 
 pub fn scroll_down(level: *lvl.Level) bool {
-    if (globals.BITMAP_Y >= (level.height - globals.screen_height)) {
+    if (level.state.sim.BITMAP_Y >= (level.definition.height - globals.screen_height)) {
         return true;
     }
-    globals.BITMAP_Y += 1;
+    level.state.sim.BITMAP_Y += 1;
     return false;
 }
@@ -33,6 +33,7 @@ const ManagedJSON = json.ManagedJSON;
 const JsonList = json.JsonList;
 const audio = @import("audio/audio.zig");
 const BackendType = audio.BackendType;
+const OplCore = audio.OplCore;
 const input = @import("input.zig");
 const InputMode = input.InputMode;
 const Allocator = std.mem.Allocator;
@@ -49,6 +50,14 @@ pub const Settings = extern struct {
     window_width: u16 = window.game_width * 3,
     window_height: u16 = window.game_height * 3,
     audio_backend: BackendType = .Adlib,
+    opl_core: OplCore = .Nuked,
+    // Stream the tracks made with --render-music instead of synthesizing them
+    prerendered_music: bool = false,
+    // Small audio buffers, so sound effects are heard sooner, at the cost of more callbacks
+    audio_low_latency: bool = true,
+    // Audio period size in frames and number of periods, 0 = let the audio library decide
+    audio_period_frames: u16 = 0,
+    audio_periods: u8 = 0,
     input_mode: InputMode = .Modern,
     rumble: u8 = 8, // 0 = off, 16 = max
     seen_intro: bool = false,
@@ -0,0 +1,351 @@
+//
+// Copyright (C) 2008 - 2024 The OpenTitus team
+//
+// Authors:
+// Eirik Stople
+// Petr Mrázek
+//
+// "Titus the Fox: To Marrakech and Back" (1992) and
+// "Lagaf': Les Aventures de Moktar - Vol 1: La Zoubida" (1991)
+// was developed by, and is probably copyrighted by Titus Software,
+// which, according to Wikipedia, stopped buisness in 2005.
+//
+// OpenTitus is not affiliated with Titus Software.
+//
+// OpenTitus is  free software; you can redistribute  it and/or modify
+// it under the  terms of the GNU General  Public License as published
+// by the Free  Software Foundation; either version 3  of the License,
+// or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+// MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+// General Public License for more details.
+//
+
+const std = @import("std");
+
+const globals = @import("globals.zig");
+const lvl = @import("level.zig");
+
+pub const SpriteKind = enum(u8) {
+    Elevator,
+    Trash,
+    Enemy,
+    Object,
+};
+
+pub const SpriteRef = struct {
+    kind: SpriteKind,
+    index: u8,
+};
+
+// Every sprite slot in the level gets a number. They are laid out in drawing order:
+// elevators, trash, enemies and objects, each from the last one to the first one.
+// Levels never have more of each kind than the original format has room for.
+const ELEVATOR_BASE = 0;
+const TRASH_BASE = ELEVATOR_BASE + lvl.ELEVATOR_CAPACITY;
+const ENEMY_BASE = TRASH_BASE + lvl.TRASH_CAPACITY;
+const OBJECT_BASE = ENEMY_BASE + lvl.ENEMY_CAPACITY;
+pub const SLOT_COUNT = OBJECT_BASE + lvl.OBJECT_CAPACITY;
+
+pub const SlotSet = std.StaticBitSet(SLOT_COUNT);
+
+fn toSlot(ref: SpriteRef) usize {
+    return switch (ref.kind) {
+        .Elevator => ELEVATOR_BASE + lvl.ELEVATOR_CAPACITY - 1 - @as(usize, ref.index),
+        .Trash => TRASH_BASE + lvl.TRASH_CAPACITY - 1 - @as(usize, ref.index),
+        .Enemy => ENEMY_BASE + lvl.ENEMY_CAPACITY - 1 - @as(usize, ref.index),
+        .Object => OBJECT_BASE + lvl.OBJECT_CAPACITY - 1 - @as(usize, ref.index),
+    };
+}
+
+fn fromSlot(slot: usize) SpriteRef {
+    if (slot < TRASH_BASE) {
+        return .{ .kind = .Elevator, .index = @intCast(TRASH_BASE - 1 - slot) };
+    } else if (slot < ENEMY_BASE) {
+        return .{ .kind = .Trash, .index = @intCast(ENEMY_BASE - 1 - slot) };
+    } else if (slot < OBJECT_BASE) {
+        return .{ .kind = .Enemy, .index = @intCast(OBJECT_BASE - 1 - slot) };
+    } else {
+        return .{ .kind = .Object, .index = @intCast(SLOT_COUNT - 1 - slot) };
+    }
+}
+
+test "test sprite slots" {
+    for (0..SLOT_COUNT) |slot| {
+        try std.testing.expect(toSlot(fromSlot(slot)) == slot);
+    }
+    try std.testing.expect(toSlot(.{ .kind = .Elevator, .index = lvl.ELEVATOR_CAPACITY - 1 }) == 0);
+    try std.testing.expect(toSlot(.{ .kind = .Object, .index = 0 }) == SLOT_COUNT - 1);
+}
+
+pub fn getSprite(level: *lvl.Level, ref: SpriteRef) *lvl.Sprite {
+    return switch (ref.kind) {
+        .Elevator => &level.elevator[ref.index].sprite,
+        .Trash => &level.state.trash[ref.index],
+        .Enemy => &level.enemy[ref.index].sprite,
+        .Object => &level.object[ref.index].sprite,
+    };
+}
+
+// Uniform grid of enabled sprites, with cells of 4x4 tiles.
+// Objects are kept up to date with update, the other sprites move after the grid is built, so queries
+// look a bit further than asked for. Callers still do their exact tests on the current positions, the
+// grid only gives them the candidates.
+pub const Grid = struct {
+    const CELL_SHIFT = 6; // 64 pixels, 4 tiles
+    // Levels are always 256 tiles wide
+    const COLUMNS = (256 * 16) >> CELL_SHIFT;
+    // Anything below this goes in the last row
+    const ROWS = 64;
+    const MOVE_MARGIN = 32;
+    const NONE = 0xFF;
+
+    // Positions are gathered from the sprites into arrays, and worked on this many at a time
+    const LANES = 8;
+    const PADDED_COUNT = std.mem.alignForward(usize, SLOT_COUNT, LANES);
+    const Coords = @Vector(LANES, i16);
+
+    // Each cell has a linked list of slots
+    head: [COLUMNS * ROWS]u8 = [_]u8{NONE} ** (COLUMNS * ROWS),
+    next: [SLOT_COUNT]u8 = undefined,
+    cell: [PADDED_COUNT]u16 = [_]u16{0} ** PADDED_COUNT,
+    // Where the sprites were when the grid was built
+    x: [PADDED_COUNT]i16 = [_]i16{0} ** PADDED_COUNT,
+    y: [PADDED_COUNT]i16 = [_]i16{0} ** PADDED_COUNT,
+    members: SlotSet = SlotSet.initEmpty(),
+
+    fn column(x: i16) usize {
+        return @intCast(std.math.clamp(x >> CELL_SHIFT, 0, COLUMNS - 1));
+    }
+
+    fn row(y: i16) usize {
+        return @intCast(std.math.clamp(y >> CELL_SHIFT, 0, ROWS - 1));
+    }
+
+    pub fn build(self: *Grid, level: *lvl.Level) void {
+        // Only clear the cells we used last time
+        var iter = self.members.iterator(.{});
+        while (iter.next()) |slot| {
+            self.head[self.cell[slot]] = NONE;
+        }
+        self.members = SlotSet.initEmpty();
+
+        for (level.elevator, 0..) |*elevator, i| {
+            self.gather(.{ .kind = .Elevator, .index = @intCast(i) }, &elevator.sprite);
+        }
+        for (&level.state.trash, 0..) |*trash, i| {
+            self.gather(.{ .kind = .Trash, .index = @intCast(i) }, trash);
+        }
+        for (level.enemy, 0..) |*enemy, i| {
+            self.gather(.{ .kind = .Enemy, .index = @intCast(i) }, &enemy.sprite);
+        }
+        for (level.object, 0..) |*object, i| {
+            self.gather(.{ .kind = .Object, .index = @intCast(i) }, &object.sprite);
+        }
+
+        var i: usize = 0;
+        while (i < PADDED_COUNT) : (i += LANES) {
+            const shift: @Vector(LANES, u4) = @splat(CELL_SHIFT);
+            const zero: Coords = @splat(0);
+            const columns = @min(@max(@as(Coords, self.x[i..][0..LANES].*) >> shift, zero), @as(Coords, @splat(COLUMNS - 1)));
+            const rows = @min(@max(@as(Coords, self.y[i..][0..LANES].*) >> shift, zero), @as(Coords, @splat(ROWS - 1)));
+            const cells: @Vector(LANES, u16) = @intCast(rows * @as(Coords, @splat(COLUMNS)) + columns);
+            self.cell[i..][0..LANES].* = cells;
+        }
+
+        var members = self.members.iterator(.{});
+        while (members.next()) |slot| {
+            const c = self.cell[slot];
+            self.next[slot] = self.head[c];
+            self.head[c] = @intCast(slot);
+        }
+    }
+
+    fn gather(self: *Grid, ref: SpriteRef, spr: *const lvl.Sprite) void {
+        const slot = toSlot(ref);
+        if (!spr.enabled) {
+            self.x[slot] = 0;
+            self.y[slot] = 0;
+            return;
+        }
+        self.x[slot] = spr.x;
+        self.y[slot] = spr.y;
+        self.members.set(slot);
+    }
+
+    // Puts a sprite that was enabled, disabled or moved since the grid was built where it is now
+    pub fn update(self: *Grid, ref: SpriteRef, spr: *const lvl.Sprite) void {
+        const slot = toSlot(ref);
+        const c: u16 = @intCast(row(spr.y) * COLUMNS + column(spr.x));
+        if (self.members.isSet(slot)) {
+            if (spr.enabled and self.cell[slot] == c) {
+                self.x[slot] = spr.x;
+                self.y[slot] = spr.y;
+                return;
+            }
+            // Take it out of the list of its old cell
+            var link = &self.head[self.cell[slot]];
+            while (link.* != slot) : (link = &self.next[link.*]) {}
+            link.* = self.next[slot];
+            self.members.unset(slot);
+        }
+        if (!spr.enabled) {
+            self.x[slot] = 0;
+            self.y[slot] = 0;
+            return;
+        }
+        self.x[slot] = spr.x;
+        self.y[slot] = spr.y;
+        self.cell[slot] = c;
+        self.next[slot] = self.head[c];
+        self.head[c] = @intCast(slot);
+        self.members.set(slot);
+    }
+
+    // Adds the sprites that may be inside the rectangle (in pixels) to the set
+    pub fn query(self: *const Grid, left: i16, top: i16, right: i16, bottom: i16, set: *SlotSet) void {
+        const first_column = column(left -| MOVE_MARGIN);
+        const last_column = column(right +| MOVE_MARGIN);
+        const first_row = row(top -| MOVE_MARGIN);
+        const last_row = row(bottom +| MOVE_MARGIN);
+        for (first_row..last_row + 1) |r| {
+            for (first_column..last_column + 1) |c| {
+                var slot = self.head[r * COLUMNS + c];
+                while (slot != NONE) : (slot = self.next[slot]) {
+                    set.set(slot);
+                }
+            }
+        }
+    }
+
+    // Sprites that may be within range_x and range_y pixels of x and y
+    pub fn near(self: *const Grid, x: i16, y: i16, range_x: i16, range_y: i16) SlotSet {
+        var set = SlotSet.initEmpty();
+        self.query(x -| range_x, y -| range_y, x +| range_x, y +| range_y, &set);
+
+        // The cells are coarse, drop the candidates that were too far away when they were put in the grid
+        const reach_x = @as(u32, @abs(range_x)) + MOVE_MARGIN;
+        const reach_y = @as(u32, @abs(range_y)) + MOVE_MARGIN;
+        const found = set;
+        var candidates = found.iterator(.{});
+        while (candidates.next()) |slot| {
+            if (@abs(@as(i32, self.x[slot]) - x) > reach_x or @abs(@as(i32, self.y[slot]) - y) > reach_y) {
+                set.unset(slot);
+            }
+        }
+        return set;
+    }
+};
+
+test "sprites enabled after the grid is built are found" {
+    var g: Grid = .{};
+    const ref: SpriteRef = .{ .kind = .Object, .index = 3 };
+    var spr: lvl.Sprite = .{ .x = 1000, .y = 300, .enabled = true };
+    g.update(ref, &spr);
+    try std.testing.expect(g.near(1010, 290, 64, 70).isSet(toSlot(ref)));
+
+    spr.x = 2000;
+    g.update(ref, &spr);
+    try std.testing.expect(!g.near(1010, 290, 64, 70).isSet(toSlot(ref)));
+    try std.testing.expect(g.near(2000, 300, 64, 70).isSet(toSlot(ref)));
+
+    spr.enabled = false;
+    g.update(ref, &spr);
+    try std.testing.expect(!g.near(2000, 300, 64, 70).isSet(toSlot(ref)));
+}
+
+// Per thread, so several levels can run at once
+pub threadlocal var grid: Grid = .{};
+
+// Goes through the sprites of one kind in a set, from the first one to the last one
+pub const KindIterator = struct {
+    kind: SpriteKind,
+    inner: SlotSet.Iterator(.{ .direction = .reverse }),
+
+    pub fn init(set: *const SlotSet, kind: SpriteKind) KindIterator {
+        return .{ .kind = kind, .inner = set.iterator(.{ .direction = .reverse }) };
+    }
+
+    pub fn next(self: *KindIterator) ?u8 {
+        while (self.inner.next()) |slot| {
+            const ref = fromSlot(slot);
+            if (ref.kind == self.kind) {
+                return ref.index;
+            }
+        }
+        return null;
+    }
+};
+
+// Sprites in and around the screen, shared by the enemy logic, the sprite animation and rendering.
+pub const VisibleSprites = struct {
+    // SET_NMI looks 2 tiles beyond the screen, and it has to see enemies leave that area.
+    const MARGIN = 4;
+    // How far the screen can scroll before the list has to be rebuilt for rendering.
+    const SLACK = 2;
+
+    members: SlotSet = SlotSet.initEmpty(),
+    bitmap_x: globals.TileCoord = 0,
+    valid: bool = false,
+
+    pub fn update(self: *VisibleSprites, level: *lvl.Level) void {
+        grid.build(level);
+
+        var members = SlotSet.initEmpty();
+        const left = (level.state.sim.BITMAP_X - MARGIN) * 16;
+        const right = (level.state.sim.BITMAP_X + globals.screen_width + MARGIN) * 16;
+        grid.query(left, std.math.minInt(i16), right, std.math.maxInt(i16), &members);
+
+        // Sprites that are no longer tracked will not be rendered, so they are not visible anymore
+        const dropped = self.members.differenceWith(members);
+        var iter = dropped.iterator(.{});
+        while (iter.next()) |slot| {
+            const ref = fromSlot(slot);
+            getSprite(level, ref).visible = false;
+            if (ref.kind == .Enemy) {
+                const enemy = &level.enemy[ref.index];
+                enemy.visible = false;
+                // SET_NMI removes dying enemies once they are off the screen, it won't see these again
+                if ((enemy.dying & 3) != 0) {
+                    enemy.sprite.enabled = false;
+                }
+            }
+        }
+
+        self.members = members;
+        self.bitmap_x = level.state.sim.BITMAP_X;
+        self.valid = true;
+    }
+
+    pub fn ensure(self: *VisibleSprites, level: *lvl.Level) void {
+        if (!self.valid or @abs(level.state.sim.BITMAP_X - self.bitmap_x) > SLACK) {
+            self.update(level);
+        }
+    }
+
+    // For when the sprites were replaced (new level, restart, rewind), so the old list means nothing
+    pub fn invalidate(self: *VisibleSprites) void {
+        self.members = SlotSet.initEmpty();
+        self.valid = false;
+    }
+
+    pub fn Iterator(comptime direction: std.bit_set.IteratorOptions.Direction) type {
+        return struct {
+            inner: SlotSet.Iterator(.{ .direction = direction }),
+
+            pub fn next(self: *@This()) ?SpriteRef {
+                const slot = self.inner.next() orelse return null;
+                return fromSlot(slot);
+            }
+        };
+    }
+
+    // Forward is the drawing order
+    pub fn iterator(self: *const VisibleSprites, comptime direction: std.bit_set.IteratorOptions.Direction) Iterator(direction) {
+        return .{ .inner = self.members.iterator(.{ .direction = direction }) };
+    }
+};
+
+pub threadlocal var visible_sprites: VisibleSprites = .{};
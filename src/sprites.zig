@@ -32,6 +32,8 @@ const window = @import("window.zig");
 const data = @import("data.zig");
 const lvl = @import("level.zig");
 const globals = @import("globals.zig");
+const spatial = @import("spatial.zig");
+const scroll = @import("scroll.zig");
 const debug = @import("_debug.zig");
 
 // TODO: the sprite cache and sprites doesn't have to be global anymore once we aren't going through C code.
@@ -80,11 +82,7 @@ pub const SpriteData = struct {
     fn init(self: *SpriteData, allocator: std.mem.Allocator, spritedata: []const u8, palette: *SDL.Palette) !void {
         defer allocator.free(spritedata);
 
-        if (data.game == .Titus) {
-            self.definitions = &titus_sprite_defs;
-        } else {
-            self.definitions = &moktar_sprite_defs;
-        }
+        self.initDefinitions();
         var remaining_data = spritedata;
         for (0..SPRITECOUNT) |i| {
             const surface = SDL.createSurface(
@@ -97,6 +95,15 @@ pub const SpriteData = struct {
             self.bitmaps[i] = surface;
         }
     }
+    // The definitions are all a level needs to run, the bitmaps are only for drawing
+    pub fn initDefinitions(self: *SpriteData) void {
+        if (data.game == .Titus) {
+            self.definitions = &titus_sprite_defs;
+        } else {
+            self.definitions = &moktar_sprite_defs;
+        }
+    }
+
     fn deinit(self: *SpriteData) void {
         for (self.bitmaps) |ptr| {
             SDL.destroySurface(ptr);
@@ -229,7 +236,7 @@ pub const SpriteCache = struct {
 
 pub fn updatesprite(level: *lvl.Level, spr: *lvl.Sprite, number: i16, clearflags: bool) void {
     spr.number = number;
-    spr.spritedata = &level.spritedata[@intCast(number)];
+    spr.spritedata = &level.definition.spritedata[@intCast(number)];
     spr.enabled = true;
     if (clearflags) {
         spr.flipped = false;
@@ -243,7 +250,7 @@ pub fn updatesprite(level: *lvl.Level, spr: *lvl.Sprite, number: i16, clearflags
 
 pub fn copysprite(level: *lvl.Level, dest: *lvl.Sprite, src: *lvl.Sprite) void {
     dest.number = src.number;
-    dest.spritedata = &level.spritedata[@intCast(src.number)];
+    dest.spritedata = &level.definition.spritedata[@intCast(src.number)];
     dest.enabled = src.enabled;
     dest.flipped = src.flipped;
     dest.flash = src.flash;
@@ -252,47 +259,82 @@ pub fn copysprite(level: *lvl.Level, dest: *lvl.Sprite, src: *lvl.Sprite) void {
     dest.invisible = false;
 }
 
+// Sprites that are not enabled or invisible keep their flag, like they did when the renderer set it
+fn update_visibility(level: *const lvl.Level, spr: *lvl.Sprite) void {
+    if (!spr.enabled or spr.invisible) {
+        return;
+    }
+    const spritedata = spr.spritedata orelse return;
+    var x: i16 = undefined;
+    if (!spr.flipped) {
+        x = spr.x - spritedata.refwidth - (level.state.sim.BITMAP_X * 16) + level.state.sim.g_scroll_px_offset;
+    } else {
+        x = spr.x + spritedata.refwidth - spritedata.width - (level.state.sim.BITMAP_X * 16) + level.state.sim.g_scroll_px_offset;
+    }
+    const sprite_offset: i16 = 0 - (@as(i16, spritedata.refheight) - spritedata.height);
+    const y_offset = scroll.base_y_offset(level) + level.state.sim.g_scroll_py_offset;
+    const y = spr.y + sprite_offset - spritedata.height + 1 - (level.state.sim.BITMAP_Y * 16) + y_offset;
+
+    spr.visible = !((x >= globals.screen_width * 16) or //Right for the screen
+        (x + spritedata.width < 0) or //Left for the screen
+        (y + spritedata.height < 0) or //Above the screen
+        (y >= globals.screen_height * 16)); //Below the screen
+}
+
+// Which sprites are on the screen. The game logic goes by this (what can be picked up, what elevators
+// collide with, ...), so it is worked out at the end of every tick, whether the tick is rendered or not.
+pub fn updateVisibility(level: *lvl.Level) void {
+    var iter = spatial.visible_sprites.iterator(.forward);
+    while (iter.next()) |ref| {
+        update_visibility(level, spatial.getSprite(level, ref));
+    }
+    update_visibility(level, &level.state.player.sprite3);
+    update_visibility(level, &level.state.player.sprite2);
+    update_visibility(level, &level.state.player.sprite);
+}
+
 fn animate_sprite(level: *lvl.Level, spr: *lvl.Sprite) void {
     if (!spr.visible) return; //Not on screen?
     if (!spr.enabled) return;
     if (spr.number == (globals.FIRST_OBJET + 26)) { //Cage
-        if ((globals.IMAGE_COUNTER & 0x0007) == 0) { //Every 8
+        if ((level.state.sim.IMAGE_COUNTER & 0x0007) == 0) { //Every 8
             updatesprite(level, spr, globals.FIRST_OBJET + 27, false); //Cage, 2nd sprite
         }
     } else if (spr.number == (globals.FIRST_OBJET + 27)) { //Cage, 2nd sprite
-        if ((globals.IMAGE_COUNTER & 0x003F) == 0) { //Every 64
+        if ((level.state.sim.IMAGE_COUNTER & 0x003F) == 0) { //Every 64
             updatesprite(level, spr, globals.FIRST_OBJET + 26, false); //Cage, 1st sprite
         }
     } else if (spr.number == (globals.FIRST_OBJET + 21)) { //Flying carpet
-        if ((globals.IMAGE_COUNTER & 0x0007) == 0) { //Every 8
+        if ((level.state.sim.IMAGE_COUNTER & 0x0007) == 0) { //Every 8
             updatesprite(level, spr, globals.FIRST_OBJET + 22, false); //Flying carpet, 2nd sprite
         }
     } else if (spr.number == (globals.FIRST_OBJET + 22)) { //Flying carpet, 2nd sprite
-        if ((globals.IMAGE_COUNTER & 0x0007) == 0) { //Every 8
+        if ((level.state.sim.IMAGE_COUNTER & 0x0007) == 0) { //Every 8
             updatesprite(level, spr, globals.FIRST_OBJET + 21, false); //Flying carpet, 1st sprite
         }
     } else if (spr.number == (globals.FIRST_OBJET + 24)) { //Small spring
-        if ((globals.IMAGE_COUNTER & 0x0001) == 0) { //Every 2
+        if ((level.state.sim.IMAGE_COUNTER & 0x0001) == 0) { //Every 2
             if (spr.UNDER == 0) { //Spring is not loaded
                 updatesprite(level, spr, globals.FIRST_OBJET + 25, false); //Spring is not loaded; convert into big spring
-            } else if (globals.GRAVITY_FLAG > 1) { //if not gravity, not clear
+            } else if (level.state.sim.GRAVITY_FLAG > 1) { //if not gravity, not clear
                 spr.UNDER = 0;
             } else {
                 spr.UNDER = spr.UNDER & 0x01; //Keep eventually object load, remove player load
             }
         }
     } else if (spr.number == (globals.FIRST_OBJET + 25)) { //Big spring
-        if ((globals.IMAGE_COUNTER & 0x0001) == 0) { //Every 2
+        if ((level.state.sim.IMAGE_COUNTER & 0x0001) == 0) { //Every 2
             if (spr.UNDER == 0) {
                 return; //Spring is not loaded; remain big
-            } else if (globals.GRAVITY_FLAG > 1) { //if not gravity, not clear
+            } else if (level.state.sim.GRAVITY_FLAG > 1) { //if not gravity, not clear
                 spr.UNDER = 0;
             } else {
                 spr.UNDER = spr.UNDER & 0x01; //Keep eventually object load, remove player load
             }
-            // FIXME: maybe null sanity check in debug mode
-            spr.ONTOP.?.y += 5;
-            globals.GRAVITY_FLAG = 3;
+            if (level.loadedSprite(spr.ONTOP)) |ontop| {
+                ontop.y += 5;
+            }
+            level.state.sim.GRAVITY_FLAG = 3;
             updatesprite(level, spr, globals.FIRST_OBJET + 24, false); //Small spring
         }
     }
@@ -300,30 +342,28 @@ fn animate_sprite(level: *lvl.Level, spr: *lvl.Sprite) void {
 
 pub fn animateSprites(level: *lvl.Level) void {
     //Animate player
-    if ((globals.LAST_ORDER == .Rest) and
-        (globals.POCKET_FLAG) and
-        (globals.ACTION_TIMER >= 35 * 4))
+    if ((level.state.sim.LAST_ORDER == .Rest) and
+        (level.state.sim.POCKET_FLAG) and
+        (level.state.sim.ACTION_TIMER >= 35 * 4))
     {
-        updatesprite(level, &(level.player.sprite), 29, false); //"Pause"-sprite
-        if (globals.ACTION_TIMER >= 35 * 5) {
-            updatesprite(level, &(level.player.sprite), 0, false); //Normal player sprite
-            globals.ACTION_TIMER = 0;
+        updatesprite(level, &(level.state.player.sprite), 29, false); //"Pause"-sprite
+        if (level.state.sim.ACTION_TIMER >= 35 * 5) {
+            updatesprite(level, &(level.state.player.sprite), 0, false); //Normal player sprite
+            level.state.sim.ACTION_TIMER = 0;
         }
     }
     //Animate other objects
 
-    animate_sprite(level, &(level.player.sprite2));
-    animate_sprite(level, &(level.player.sprite3));
-
-    for (0..lvl.OBJECT_CAPACITY) |i| {
-        animate_sprite(level, &(level.object[i].sprite));
-    }
-
-    for (0..lvl.ENEMY_CAPACITY) |i| {
-        animate_sprite(level, &(level.enemy[i].sprite));
-    }
+    animate_sprite(level, &(level.state.player.sprite2));
+    animate_sprite(level, &(level.state.player.sprite3));
 
-    for (0..lvl.ELEVATOR_CAPACITY) |i| {
-        animate_sprite(level, &(level.elevator[i].sprite));
+    // Only sprites on the screen are animated. Going backwards through the drawing order visits
+    // objects, enemies and elevators, each from the first one to the last one.
+    var iter = spatial.visible_sprites.iterator(.reverse);
+    while (iter.next()) |ref| {
+        if (ref.kind == .Trash) {
+            continue;
+        }
+        animate_sprite(level, spatial.getSprite(level, ref));
     }
 }
@@ -40,12 +40,63 @@ const Character = struct {
     x_offset: i8 = 0,
 };
 
+// Rendered strings, so we don't have to blit them glyph by glyph every frame
+const TextCache = struct {
+    // Text that changes all the time (like the debug overlays) is not cached, anything else that
+    // fills this up makes us start over
+    const CAPACITY = 256;
+
+    const Entry = struct {
+        surface: ?*SDL.Surface,
+        // Position of the surface relative to where the text starts
+        x_offset: i16,
+        width: u16,
+    };
+
+    const HashMap = std.StringArrayHashMap(Entry);
+
+    allocator: std.mem.Allocator,
+    hashmap: HashMap,
+
+    fn init(self: *TextCache, allocator: std.mem.Allocator) void {
+        self.allocator = allocator;
+        self.hashmap = HashMap.init(allocator);
+    }
+
+    fn deinit(self: *TextCache) void {
+        self.evictAll();
+        self.hashmap.deinit();
+    }
+
+    // Keys are the render options followed by the text
+    fn key(buffer: *[256]u8, text: []const u8, options: Font.RenderOptions) ?[]const u8 {
+        if (text.len >= buffer.len) {
+            return null;
+        }
+        buffer[0] = @as(u3, @bitCast(options));
+        @memcpy(buffer[1 .. text.len + 1], text);
+        return buffer[0 .. text.len + 1];
+    }
+
+    fn evictAll(self: *TextCache) void {
+        var iter = self.hashmap.iterator();
+        while (iter.next()) |entry| {
+            if (entry.value_ptr.surface) |surface| {
+                SDL.destroySurface(surface);
+            }
+            self.allocator.free(entry.key_ptr.*);
+        }
+        self.hashmap.clearAndFree();
+    }
+};
+
 pub const Font = struct {
     sheet: *SDL.Surface,
     characters: [256]Character,
     fallback: Character,
+    cache: TextCache,
 
-    fn init(self: *Font, data: []const u8) !void {
+    fn init(self: *Font, allocator: std.mem.Allocator, data: []const u8) !void {
         const rwops = SDL.IOFromMem(@constCast(@ptrCast(&data[0])), @intCast(data.len));
         if (rwops == null) {
             print_sdl_error("Could not load font: {s}");
@@ -57,14 +108,18 @@ pub const Font = struct {
             return FontError.CannotLoad;
         }
         try loadfont(image, self);
+        self.cache.init(allocator);
     }
     fn deinit(self: *Font) void {
+        self.cache.deinit();
         SDL.destroySurface(self.sheet);
     }
 
     pub const RenderOptions = packed struct {
         monospace: bool = false,
         transpatent: bool = false,
+        // The text changes every frame, drawing it glyph by glyph is cheaper than caching it
+        uncached: bool = false,
     };
 
     pub fn render_columns(self: *Font, left: []const u8, right: []const u8, y: c_int, options: RenderOptions) void {
@@ -82,6 +137,72 @@ pub const Font = struct {
     }
 
     pub fn render(self: *Font, text: []const u8, x: c_int, y: c_int, options: RenderOptions) void {
+        if (options.uncached) {
+            self.render_glyphs(text, x, y, options, window.screen);
+            return;
+        }
+        const entry = self.getText(text, options) catch {
+            self.render_glyphs(text, x, y, options, window.screen);
+            return;
+        };
+        if (entry.surface) |surface| {
+            var dest: SDL.Rect = .{ .x = x + entry.x_offset, .y = y, .w = surface.w, .h = surface.h };
+            _ = SDL.blitSurface(surface, null, window.screen, &dest);
+        }
+    }
+
+    fn getText(self: *Font, text: []const u8, options: RenderOptions) !TextCache.Entry {
+        var key_buffer: [256]u8 = undefined;
+        const key = TextCache.key(&key_buffer, text, options) orelse return error.TextTooLong;
+
+        if (self.cache.hashmap.get(key)) |entry| {
+            return entry;
+        }
+        if (self.cache.hashmap.count() >= TextCache.CAPACITY) {
+            self.cache.evictAll();
+        }
+
+        // Find out how far the glyphs reach, 'y' starts a pixel to the left
+        var left: i16 = 0;
+        var right: i16 = 0;
+        var height: u16 = 0;
+        var position: i16 = 0;
+        for (text) |character| {
+            const chardesc = self.characters[character];
+            if (!options.monospace) {
+                position += chardesc.x_offset;
+            }
+            left = @min(left, position);
+            position += @intCast(if (options.monospace) chardesc.w_mono else chardesc.w);
+            right = @max(right, position);
+            height = @max(height, chardesc.h);
+        }
+
+        var entry = TextCache.Entry{
+            .surface = null,
+            .x_offset = left,
+            .width = self.metrics(text, options),
+        };
+        errdefer if (entry.surface) |surface| SDL.destroySurface(surface);
+        if (right > left and height > 0) {
+            const surface = SDL.createSurface(right - left, height, self.sheet.format);
+            if (surface == null) {
+                return error.Failed;
+            }
+            const black = SDL.mapSurfaceRGB(surface, 0, 0, 0);
+            _ = SDL.fillSurfaceRect(surface, null, black);
+            self.render_glyphs(text, -left, 0, options, surface);
+            _ = SDL.setSurfaceColorKey(surface, options.transpatent, black);
+            entry.surface = surface;
+        }
+
+        const owned_key = try self.cache.allocator.dupe(u8, key);
+        errdefer self.cache.allocator.free(owned_key);
+        try self.cache.hashmap.put(owned_key, entry);
+        return entry;
+    }
+
+    fn render_glyphs(self: *Font, text: []const u8, x: c_int, y: c_int, options: RenderOptions, target: ?*SDL.Surface) void {
         var dest: SDL.Rect = .{ .x = x, .y = y, .w = 0, .h = 0 };
 
         const black = SDL.mapSurfaceRGB(self.sheet, 0, 0, 0);
@@ -94,20 +215,27 @@ pub const Font = struct {
                 var src = SDL.Rect{ .x = chardesc.x_mono, .y = chardesc.y, .w = chardesc.w_mono, .h = chardesc.h };
                 dest.w = chardesc.w_mono;
                 dest.h = chardesc.h;
-                _ = SDL.blitSurface(self.sheet, &src, window.screen, &dest);
+                _ = SDL.blitSurface(self.sheet, &src, target, &dest);
                 dest.x += chardesc.w_mono;
             } else {
                 dest.x += chardesc.x_offset;
                 var src = SDL.Rect{ .x = chardesc.x, .y = chardesc.y, .w = chardesc.w, .h = chardesc.h };
                 dest.w = chardesc.w;
                 dest.h = chardesc.h;
-                _ = SDL.blitSurface(self.sheet, &src, window.screen, &dest);
+                _ = SDL.blitSurface(self.sheet, &src, target, &dest);
                 dest.x += chardesc.w;
             }
         }
     }
 
     pub fn metrics(self: *Font, text: []const u8, options: RenderOptions) u16 {
+        var key_buffer: [256]u8 = undefined;
+        if (TextCache.key(&key_buffer, text, options)) |key| {
+            if (self.cache.hashmap.get(key)) |entry| {
+                return entry.width;
+            }
+        }
+
         var size: i17 = 0;
 
         // Let's assume ASCII for now... original code was trying to do something with UTF-8, but had the font files have no support for that
@@ -133,9 +261,9 @@ pub var Gold: Font = undefined;
 const gray_font_data = @embedFile("gray_font.bmp");
 pub var Gray: Font = undefined;
 
-pub fn fonts_load() !void {
-    try Gold.init(gold_font_data);
-    try Gray.init(gray_font_data);
+pub fn fonts_load(allocator: std.mem.Allocator) !void {
+    try Gold.init(allocator, gold_font_data);
+    try Gray.init(allocator, gray_font_data);
 }
 
 pub fn fonts_free() void {
@@ -183,6 +183,14 @@ pub fn viewImageFile(file: ImageFile, display_mode: DisplayMode, delay: c_int, a
         .w = image_surface.*.w,
         .h = image_surface.*.h,
     };
+    // Fades are applied when presenting the frame, so the image only has to be drawn once
+    window.window_clear(null);
+    _ = SDL.blitSurface(image_surface, &src, window.screen, &dest);
+    defer {
+        window.window_clear(null);
+        window.set_brightness(255);
+    }
+
     switch (display_mode) {
         .FadeInFadeOut => {
             var tick_start = SDL.getTicks();
@@ -208,10 +216,7 @@ pub fn viewImageFile(file: ImageFile, display_mode: DisplayMode, delay: c_int, a
                 if (image_alpha > 255)
                     image_alpha = 255;
 
-                _ = SDL.setSurfaceAlphaMod(image_surface, @truncate(image_alpha));
-                _ = SDL.setSurfaceBlendMode(image_surface, SDL.BLENDMODE_BLEND);
-                window.window_clear(null);
-                _ = SDL.blitSurface(image_surface, &src, window.screen, &dest);
+                window.set_brightness(@truncate(image_alpha));
                 window.window_render();
                 SDL.delay(1);
             }
@@ -255,10 +260,7 @@ pub fn viewImageFile(file: ImageFile, display_mode: DisplayMode, delay: c_int, a
                 if (image_alpha > 255)
                     image_alpha = 255;
 
-                _ = SDL.setSurfaceAlphaMod(image_surface, 255 - @as(u8, @truncate(image_alpha)));
-                _ = SDL.setSurfaceBlendMode(image_surface, SDL.BLENDMODE_BLEND);
-                window.window_clear(null);
-                _ = SDL.blitSurface(image_surface, &src, window.screen, &dest);
+                window.set_brightness(255 - @as(u8, @truncate(image_alpha)));
                 window.window_render();
                 SDL.delay(1);
             }
@@ -266,8 +268,6 @@ pub fn viewImageFile(file: ImageFile, display_mode: DisplayMode, delay: c_int, a
         .FadeOut => {
             var image_alpha: u64 = 0;
 
-            window.window_clear(null);
-            _ = SDL.blitSurface(image_surface, &src, window.screen, &dest);
             window.window_render();
 
             const retval = input.waitforbutton();
@@ -291,10 +291,7 @@ pub fn viewImageFile(file: ImageFile, display_mode: DisplayMode, delay: c_int, a
                 if (image_alpha > 255)
                     image_alpha = 255;
 
-                _ = SDL.setSurfaceAlphaMod(image_surface, 255 - @as(u8, @truncate(image_alpha)));
-                _ = SDL.setSurfaceBlendMode(image_surface, SDL.BLENDMODE_BLEND);
-                window.window_clear(null);
-                _ = SDL.blitSurface(image_surface, &src, window.screen, &dest);
+                window.set_brightness(255 - @as(u8, @truncate(image_alpha)));
                 window.window_render();
                 SDL.delay(1);
             }
@@ -100,6 +100,12 @@ pub fn view_menu(file: ImageFile, allocator: std.mem.Allocator) !?usize {
     var image_alpha: u64 = 0;
     const tick_start = SDL.getTicks();
 
+    window.window_clear(null);
+    _ = SDL.blitSurface(menu, &src, window.screen, &dest);
+    _ = SDL.blitSurface(menu, &sel[1], window.screen, &sel_dest[0]);
+    _ = SDL.blitSurface(menu, &sel[0], window.screen, &sel_dest[selection]);
+    defer window.set_brightness(255);
+
     // Fade in
     while (image_alpha < 255) {
         const input_state = input.processEvents();
@@ -115,13 +121,7 @@ pub fn view_menu(file: ImageFile, allocator: std.mem.Allocator) !?usize {
         if (image_alpha > 255)
             image_alpha = 255;
 
-        window.window_clear(null);
-        // FIXME: handle errors?
-        _ = SDL.setSurfaceBlendMode(menu, SDL.BLENDMODE_BLEND);
-        _ = SDL.setSurfaceAlphaMod(menu, @truncate(image_alpha));
-        _ = SDL.blitSurface(menu, &src, window.screen, &dest);
-        _ = SDL.blitSurface(menu, &sel[1], window.screen, &sel_dest[0]);
-        _ = SDL.blitSurface(menu, &sel[0], window.screen, &sel_dest[selection]);
+        window.set_brightness(@truncate(image_alpha));
         window.window_render();
         SDL.delay(1);
     }
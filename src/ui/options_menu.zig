@@ -243,7 +243,7 @@ pub fn optionsMenu(menu_context: *MenuContext) ?c_int {
                 }
             },
             .Down => {
-                if (selected < 5) {
+                if (selected < 8) {
                     selected += 1;
                 }
             },
@@ -269,16 +269,26 @@ pub fn optionsMenu(menu_context: *MenuContext) ?c_int {
             audio.setBackendType,
         );
         y += 13;
-        label("Music", y, selected == 1);
+        label("OPL", y, selected == 1);
+        enumOptions(
+            audio.OplCore,
+            audio.getOplCore(),
+            y,
+            selected == 1,
+            input_state.action,
+            audio.setOplCore,
+        );
+        y += 13;
+        label("Music", y, selected == 2);
         toggle(
             audio.music_is_playing(),
             y,
-            selected == 1,
+            selected == 2,
             input_state.action,
             audio.music_set_playing,
         );
         y += 13;
-        label("Volume", y, selected == 2);
+        label("Volume", y, selected == 3);
         slider(
             u8,
             audio.get_volume(),
@@ -287,23 +297,53 @@ pub fn optionsMenu(menu_context: *MenuContext) ?c_int {
             2,
             1,
             y,
-            selected == 2,
+            selected == 3,
             input_state.action,
             audio.set_volume,
             .None,
         );
         y += 13;
-        label("Input", y, selected == 3);
+        label("Music vol", y, selected == 4);
+        slider(
+            u8,
+            audio.get_music_volume(),
+            0,
+            128,
+            2,
+            1,
+            y,
+            selected == 4,
+            input_state.action,
+            audio.set_music_volume,
+            .None,
+        );
+        y += 13;
+        label("Sound vol", y, selected == 5);
+        slider(
+            u8,
+            audio.get_sound_volume(),
+            0,
+            128,
+            2,
+            1,
+            y,
+            selected == 5,
+            input_state.action,
+            audio.set_sound_volume,
+            .None,
+        );
+        y += 13;
+        label("Input", y, selected == 6);
         enumOptions(
             InputMode,
             input.getInputMode(),
             y,
-            selected == 3,
+            selected == 6,
             input_state.action,
             input.setInputMode,
         );
         y += 13;
-        label("Rumble", y, selected == 4);
+        label("Rumble", y, selected == 7);
         slider(
             u8,
             input.getRumble(),
@@ -312,17 +352,17 @@ pub fn optionsMenu(menu_context: *MenuContext) ?c_int {
             1,
             8,
             y,
-            selected == 4,
+            selected == 7,
             input_state.action,
             input.setRumble,
             .Options_TestRumble,
         );
         y += 13;
-        label("Fullscreen", y, selected == 5);
+        label("Fullscreen", y, selected == 8);
         toggle(
             window.is_fullscreen(),
             y,
-            selected == 5,
+            selected == 8,
             input_state.action,
             window.set_fullscreen,
         );
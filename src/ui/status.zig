@@ -55,7 +55,7 @@ fn render_extrabonus(level: *lvl.Level, last_bounds: ?Rect) Rect {
         window.window_clear(&rect);
     }
     var tmpchars = [_]u8{0} ** 10;
-    const extrabonus = std.fmt.bufPrint(&tmpchars, "{d}", .{level.extrabonus}) catch {
+    const extrabonus = std.fmt.bufPrint(&tmpchars, "{d}", .{level.state.extrabonus}) catch {
         unreachable;
     };
     const extrabonus_width = fonts.Gold.metrics(extrabonus, .{ .monospace = true });
@@ -82,7 +82,7 @@ fn render_lives(level: *lvl.Level, last_bounds: ?Rect) Rect {
         _ = SDL.fillSurfaceRect(window.screen, &rect, 0);
     }
     var tmpchars = [_]u8{0} ** 10;
-    const lives = std.fmt.bufPrint(&tmpchars, "{d}", .{level.lives}) catch {
+    const lives = std.fmt.bufPrint(&tmpchars, "{d}", .{level.state.lives}) catch {
         unreachable;
     };
     const lives_width = fonts.Gold.metrics(lives, .{ .monospace = true });
@@ -133,20 +133,20 @@ pub fn viewstatus(level: *lvl.Level, countbonus: bool) c_int {
 
     window.window_render();
 
-    if (countbonus and (level.extrabonus >= 10)) {
+    if (countbonus and (level.state.extrabonus >= 10)) {
         retval = input.waitforbutton();
         if (retval < 0) {
             return retval;
         }
-        while (level.extrabonus >= 10) {
+        while (level.state.extrabonus >= 10) {
             for (0..10) |_| {
-                level.extrabonus -= 1;
+                level.state.extrabonus -= 1;
                 last_extrabonus = render_extrabonus(level, last_extrabonus);
                 window.window_render();
                 // 150 ms
                 SDL.delay(150);
             }
-            level.lives += 1;
+            level.state.lives += 1;
             last_lives = render_lives(level, last_lives);
             window.window_render();
             // 100 ms
@@ -48,6 +48,10 @@ pub const game_height = 200;
 
 var black: u32 = 0;
 
+// Brightness of the presented frame, used for fading in and out.
+// It is applied as a color mod on the frame texture, the screen surface is left alone.
+var brightness: u8 = 255;
+
 pub var screen: ?*SDL.Surface = null;
 pub var window: ?*SDL.Window = null;
 var renderer: ?*SDL.Renderer = null;
@@ -162,12 +166,17 @@ pub fn window_clear(rect: [*c]SDL.Rect) void {
     _ = SDL.fillSurfaceRect(screen, rect, black);
 }
 
+pub fn set_brightness(value: u8) void {
+    brightness = value;
+}
+
 pub fn window_render() void {
     if (screen == null) {
         return;
     }
     const frame = SDL.createTextureFromSurface(renderer, screen);
     _ = SDL.setTextureScaleMode(frame, 0);
+    _ = SDL.setTextureColorMod(frame, brightness, brightness, brightness);
     // FIXME: process error.
     _ = SDL.setRenderDrawColor(renderer, 0, 0, 0, 255);
     _ = SDL.renderClear(renderer);